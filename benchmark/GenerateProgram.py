@@ -0,0 +1,214 @@
+#!/usr/bin/env python
+##===- benchmark/GenerateProgram.py ------------------------*- Python -*-===##
+#
+# This file is distributed under the University of Illinois Open Source
+# License. See LICENSE.TXT for details.
+#
+##===----------------------------------------------------------------------===##
+#
+# Generates a synthetic multi-file OpenMP C program for benchmarking
+# SpecCodeConv. Each knob grows the part of the analysis it's named after:
+#
+#   --files          translation units, and so cross-TU linking
+#   --globals        global scalars and pointers, spread over the files
+#   --alias-density  pointer assignments per global in each function, which
+#                    drives DeclTracker::PropogateShares and contamination
+#   --call-depth     length of the call chains out of each parallel region,
+#                    which drives VarCollector and the function summaries
+#   --struct-depth   nesting of the structs every file declares, which
+#                    drives the type paths
+#   --regions        parallel regions in each function, which drives
+#                    DirectiveList and the access planning
+#
+# The output only uses what the converter's default system includes provide,
+# so it parses without any headers.
+#
+##===----------------------------------------------------------------------===##
+
+import optparse
+import os
+import random
+
+
+def global_name(i):
+  return 'g%d' % i
+
+
+def pointer_name(i):
+  return 'gp%d' % i
+
+
+def function_name(f, level):
+  return 'f%d_%d' % (f, level)
+
+
+def struct_decls(depth):
+  lines = ['struct S0 {', '  int v;', '  int *p;', '};', '']
+  for d in range(1, depth + 1):
+    lines += ['struct S%d {' % d,
+              '  struct S%d in;' % (d - 1),
+              '  struct S%d *next;' % (d - 1),
+              '  int *p;',
+              '};',
+              '']
+  return lines
+
+
+def struct_access(depth):
+  return 's' + '.in' * depth + '.v'
+
+
+def generate_file(index, opts, rand):
+  lines = ['/* Generated by GenerateProgram.py, file %d of %d */' %
+           (index + 1, opts.files), '']
+
+  lines += ['#define N %d' % opts.array_size, '']
+  lines += struct_decls(opts.struct_depth)
+
+  # Every global is defined in exactly one file, and extern everywhere else
+  for g in range(opts.globals):
+    extern = '' if g % opts.files == index else 'extern '
+    lines.append('%sint %s[N];' % (extern, global_name(g)))
+    lines.append('%sint *%s;' % (extern, pointer_name(g)))
+  lines.append('')
+
+  # Prototypes for the whole call graph, which crosses files
+  for f in range(opts.files):
+    for level in range(opts.call_depth + 1):
+      lines.append('int %s(int *a, int i);' % function_name(f, level))
+  lines.append('')
+
+  for level in range(opts.call_depth + 1):
+    lines += generate_function(index, level, opts, rand)
+
+  if index == 0:
+    lines += generate_main(opts)
+
+  return '\n'.join(lines) + '\n'
+
+
+def generate_aliasing(opts, rand, indent):
+  lines = []
+  count = int(round(opts.alias_density * opts.globals))
+  for _ in range(count):
+    target = rand.randrange(opts.globals)
+    source = rand.randrange(opts.globals)
+    if rand.random() < 0.5:
+      lines.append('%s%s = %s;' % (indent, pointer_name(target),
+                                   global_name(source)))
+    else:
+      lines.append('%s%s = %s;' % (indent, pointer_name(target),
+                                   pointer_name(source)))
+  return lines
+
+
+def generate_function(index, level, opts, rand):
+  name = function_name(index, level)
+  lines = ['int %s(int *a, int i) {' % name,
+           '  struct S%d s;' % opts.struct_depth,
+           '  int *p = a;',
+           '  int sum = 0;',
+           '  int j;',
+           '']
+
+  lines += generate_aliasing(opts, rand, '  ')
+  lines.append('  %s = i;' % struct_access(opts.struct_depth))
+
+  # Calls go one level deeper, into the next file round
+  callee = None
+  if level < opts.call_depth:
+    callee = function_name((index + 1) % opts.files, level + 1)
+
+  # Only the top of each call chain opens parallel regions, the rest are
+  # called from inside them
+  regions = opts.regions if level == 0 else 0
+
+  for r in range(regions):
+    g = rand.randrange(opts.globals)
+    h = rand.randrange(opts.globals)
+    lines.append('')
+    if r % 2 == 0:
+      lines += ['#pragma omp parallel for private(j)',
+                '  for (j = 0; j < N; j++) {',
+                '    %s[j] = %s[j] + %s;' % (global_name(g), global_name(h),
+                                             struct_access(opts.struct_depth)),
+                '    p[j] += *%s;' % pointer_name(g)]
+      if callee:
+        lines.append('    sum += %s(%s, j);' % (callee, pointer_name(h)))
+      lines.append('  }')
+    else:
+      lines += ['#pragma omp parallel private(j)',
+                '  {',
+                '    j = %s[i %% N];' % global_name(g),
+                '    %s = %s;' % (pointer_name(h), global_name(g)),
+                '    %s[j %% N] = j;' % global_name(h)]
+      if callee:
+        lines.append('    %s(p, j);' % callee)
+      lines.append('  }')
+
+  if not regions and callee:
+    lines.append('  sum += %s(%s, i);' % (callee, pointer_name(index %
+                                                               opts.globals)))
+
+  lines += ['  sum += a[i % N] + *p;',
+            '  return sum;',
+            '}',
+            '']
+  return lines
+
+
+def generate_main(opts):
+  lines = ['int main(int argc, char **argv) {',
+           '  int i;',
+           '  int sum = 0;',
+           '']
+  for g in range(opts.globals):
+    lines.append('  %s = %s;' % (pointer_name(g), global_name(g)))
+  lines.append('')
+  lines.append('  for (i = 0; i < argc; i++) {')
+  for f in range(opts.files):
+    lines.append('    sum += %s(%s, i);' % (function_name(f, 0),
+                                            global_name(f % opts.globals)))
+  lines += ['  }',
+            '',
+            '  return sum;',
+            '}',
+            '']
+  return lines
+
+
+def main():
+  parser = optparse.OptionParser(usage='%prog [options] output-dir')
+  parser.add_option('--files', type='int', default=4)
+  parser.add_option('--globals', type='int', default=16)
+  parser.add_option('--alias-density', type='float', default=0.25,
+                    help='pointer assignments per global in each function')
+  parser.add_option('--call-depth', type='int', default=2)
+  parser.add_option('--struct-depth', type='int', default=2)
+  parser.add_option('--regions', type='int', default=2,
+                    help='parallel regions in each top level function')
+  parser.add_option('--array-size', type='int', default=1024)
+  parser.add_option('--seed', type='int', default=0)
+  opts, args = parser.parse_args()
+
+  if len(args) != 1:
+    parser.error('expected an output directory')
+
+  if opts.files < 1 or opts.globals < 1:
+    parser.error('--files and --globals must be at least 1')
+
+  if not os.path.isdir(args[0]):
+    os.makedirs(args[0])
+
+  # Seeded, so a size always generates the same program
+  rand = random.Random(opts.seed)
+
+  for index in range(opts.files):
+    path = os.path.join(args[0], 'file%d.c' % index)
+    with open(path, 'w') as f:
+      f.write(generate_file(index, opts, rand))
+    print(path)
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,165 @@
+#!/usr/bin/env python
+##===- benchmark/RunBenchmark.py ---------------------------*- Python -*-===##
+#
+# This file is distributed under the University of Illinois Open Source
+# License. See LICENSE.TXT for details.
+#
+##===----------------------------------------------------------------------===##
+#
+# Runs SpecCodeConv over generated programs of increasing size and records
+# the time and peak memory of every stage, as reported by -stats-json.
+#
+# Each size multiplies the base knobs below by the scale factor, so a stage
+# whose time grows faster than the scale shows up directly in the table.
+# Results are written as JSON and can be compared against an earlier run
+# with --baseline to catch regressions.
+#
+##===----------------------------------------------------------------------===##
+
+import json
+import optparse
+import os
+import shutil
+import subprocess
+import sys
+
+Here = os.path.dirname(os.path.abspath(__file__))
+
+
+def generate(opts, scale, directory):
+  if os.path.isdir(directory):
+    shutil.rmtree(directory)
+
+  command = [sys.executable, os.path.join(Here, 'GenerateProgram.py'),
+             '--files', str(opts.files * scale),
+             '--globals', str(opts.globals * scale),
+             '--alias-density', str(opts.alias_density),
+             '--call-depth', str(opts.call_depth),
+             '--struct-depth', str(opts.struct_depth),
+             '--regions', str(opts.regions),
+             '--seed', str(opts.seed),
+             directory]
+
+  output = subprocess.check_output(command)
+  return output.decode().split()
+
+
+def convert(opts, files, directory):
+  stats = os.path.join(directory, 'stats.json')
+  command = [opts.converter,
+             '-o', os.path.join(directory, 'out'),
+             '-j', str(opts.jobs),
+             '-stats-json', stats] + files
+
+  if subprocess.call(command) != 0:
+    sys.stderr.write('Conversion failed: %s\n' % ' '.join(command))
+    return None
+
+  with open(stats) as f:
+    return json.load(f)
+
+
+def print_table(results):
+  scales = sorted(results, key=int)
+  stages = [s['name'] for s in results[scales[0]]['stages']]
+
+  header = '%-36s' % 'Wall (s)' + ''.join('%12s' % ('x' + s) for s in scales)
+  print(header)
+
+  for index, stage in enumerate(stages):
+    row = '%-36s' % stage
+    for scale in scales:
+      row += '%12.3f' % results[scale]['stages'][index]['wall']
+    print(row)
+
+  print('')
+  header = ('%-36s' % 'Peak RSS (KB)'
+            + ''.join('%12s' % ('x' + s) for s in scales))
+  print(header)
+
+  # The peak so far once each stage had finished, so a stage's own growth is
+  # the step up from the row above it
+  for index, stage in enumerate(stages):
+    row = '%-36s' % stage
+    for scale in scales:
+      row += '%12d' % results[scale]['stages'][index]['peak_rss_kb']
+    print(row)
+
+  row = '%-36s' % 'Overall'
+  for scale in scales:
+    row += '%12d' % results[scale]['peak_rss_kb']
+  print(row)
+
+
+def compare(results, baseline, threshold):
+  regressions = 0
+
+  for scale in sorted(results, key=int):
+    if scale not in baseline:
+      continue
+
+    old = dict((s['name'], s['wall']) for s in baseline[scale]['stages'])
+
+    for stage in results[scale]['stages']:
+      before = old.get(stage['name'])
+      # Too short to be measured reliably
+      if before is None or before < 0.05:
+        continue
+      if stage['wall'] > before * (1 + threshold):
+        print('Regression at x%s in %s: %.3fs -> %.3fs' %
+              (scale, stage['name'], before, stage['wall']))
+        regressions += 1
+
+  return regressions
+
+
+def main():
+  parser = optparse.OptionParser()
+  parser.add_option('--converter', default='SpecCodeConv')
+  parser.add_option('--work-dir', default='benchmark-work')
+  parser.add_option('--scales', default='1,2,4,8',
+                    help='comma separated multipliers of --files and '
+                         '--globals')
+  parser.add_option('--files', type='int', default=4)
+  parser.add_option('--globals', type='int', default=16)
+  parser.add_option('--alias-density', type='float', default=0.25)
+  parser.add_option('--call-depth', type='int', default=2)
+  parser.add_option('--struct-depth', type='int', default=2)
+  parser.add_option('--regions', type='int', default=2)
+  parser.add_option('--seed', type='int', default=0)
+  parser.add_option('-j', '--jobs', type='int', default=1)
+  parser.add_option('--output', default='benchmark-results.json')
+  parser.add_option('--baseline',
+                    help='an earlier --output to compare against')
+  parser.add_option('--threshold', type='float', default=0.2,
+                    help='fraction a stage may slow down by before it '
+                         'counts as a regression')
+  opts, args = parser.parse_args()
+
+  results = {}
+
+  for scale in opts.scales.split(','):
+    directory = os.path.join(opts.work_dir, 'x' + scale)
+    files = generate(opts, int(scale), directory)
+
+    stats = convert(opts, files, directory)
+    if stats is None:
+      return 1
+
+    results[scale] = stats
+
+  with open(opts.output, 'w') as f:
+    json.dump(results, f, indent=1, sort_keys=True)
+
+  print_table(results)
+
+  if opts.baseline:
+    with open(opts.baseline) as f:
+      if compare(results, json.load(f), opts.threshold):
+        return 1
+
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
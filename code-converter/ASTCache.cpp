@@ -0,0 +1,437 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "ASTCache.h"
+
+#include "PragmaDirective.h"
+#include "Tools.h"
+
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/MultiplexConsumer.h"
+#include "clang/Serialization/ASTReader.h"
+#include "clang/Serialization/ASTWriter.h"
+#include "clang/Serialization/Module.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PathV2.h"
+
+using clang::ASTReader;
+using clang::DeclContext;
+using clang::FileEntry;
+using clang::IdentifierInfo;
+using clang::SourceLocation;
+using clang::SourceManager;
+using clang::SourceRange;
+using clang::TranslationUnitDecl;
+using clang::Token;
+
+namespace speculation {
+
+ASTCache::ASTCache(string Directory, string Configuration)
+    : Directory(Directory),
+      Configuration(Configuration),
+      FileSystemOpts(),
+      Files(FileSystemOpts),
+      PendingASTs() {
+
+  bool Existed;
+  llvm::sys::fs::create_directories(Directory, Existed);
+
+}
+
+// Private
+
+string ASTCache::GetPath(string Key, string Extension) {
+
+  llvm::SmallString<128> Path(Directory);
+  llvm::sys::path::append(Path, Key + "." + Extension);
+
+  return Path.str();
+
+}
+
+bool ASTCache::DependenciesUnchanged(string Key) {
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+
+  if (llvm::MemoryBuffer::getFile(GetPath(Key, "deps"), Buffer)) {
+    return false;
+  }
+
+  stringstream Deps(Buffer->getBuffer().str());
+
+  off_t Size;
+  time_t ModTime;
+  string Name;
+
+  while (Deps >> Size >> ModTime) {
+
+    Deps.get();
+    std::getline(Deps, Name);
+
+    const FileEntry *FE = Files.getFile(Name);
+
+    if (!FE || FE->getSize() != Size || FE->getModificationTime() != ModTime) {
+      return false;
+    }
+
+  }
+
+  return true;
+
+}
+
+void ASTCache::WriteDirectives(string Key, PragmaDirectiveMap &Directives) {
+
+  string Error;
+  llvm::raw_fd_ostream Out(GetPath(Key, "omp").c_str(), Error);
+
+  if (!Error.empty()) {
+    return;
+  }
+
+  PragmaDirectiveMap::iterator PIt;
+
+  for (PIt = Directives.begin(); PIt != Directives.end(); PIt++) {
+
+    PragmaDirective *Directive = PIt->second;
+
+    Out << "directive " << PIt->first << " "
+        << Directive->Range.getBegin().getRawEncoding() << " "
+        << Directive->Range.getEnd().getRawEncoding() << "\n";
+
+    if (Directive->isParallel()) {
+      Out << "construct " << Directive->ParaConstruct.Type << " "
+          << Directive->ParaConstruct.Range.getBegin().getRawEncoding() << " "
+          << Directive->ParaConstruct.Range.getEnd().getRawEncoding() << "\n";
+    }
+
+    // Re-inserting the main construct last restores Parallel/ThreadPrivate
+    Out << "construct " << Directive->MainConstruct.Type << " "
+        << Directive->MainConstruct.Range.getBegin().getRawEncoding() << " "
+        << Directive->MainConstruct.Range.getEnd().getRawEncoding() << "\n";
+
+    vector<PragmaClause>::iterator ClauseIt;
+
+    for (ClauseIt = Directive->Clauses.begin();
+         ClauseIt != Directive->Clauses.end();
+         ClauseIt++) {
+
+      Token &Op = ClauseIt->Op;
+
+      Out << "clause " << ClauseIt->Type << " "
+          << ClauseIt->Range.getBegin().getRawEncoding() << " "
+          << ClauseIt->Range.getEnd().getRawEncoding() << " "
+          << Op.getKind() << " "
+          << Op.getLocation().getRawEncoding() << " ";
+
+      if (Op.is(clang::tok::identifier)) {
+        Out << Op.getIdentifierInfo()->getName();
+      } else {
+        Out << "-";
+      }
+
+      Out << " " << ClauseIt->Options.size();
+
+      vector<IdentifierInfo *>::iterator OptionIt;
+
+      for (OptionIt = ClauseIt->Options.begin();
+           OptionIt != ClauseIt->Options.end();
+           OptionIt++) {
+
+        Out << " " << (*OptionIt)->getName();
+
+      }
+
+      Out << "\n";
+
+    }
+
+    Out << "end\n";
+
+  }
+
+}
+
+static SourceLocation Relocate(unsigned Raw, int Offset) {
+
+  SourceLocation Loc = SourceLocation::getFromRawEncoding(Raw);
+
+  if (Loc.isInvalid()) {
+    return Loc;
+  }
+
+  return Loc.getLocWithOffset(Offset);
+
+}
+
+static SourceRange Relocate(unsigned Begin, unsigned End, int Offset) {
+  return SourceRange(Relocate(Begin, Offset), Relocate(End, Offset));
+}
+
+bool ASTCache::ReadDirectives(string Key,
+                              CompilerInstance &CI,
+                              int Offset,
+                              PragmaDirectiveMap &Directives,
+                              PragmaDirectiveAllocator &Allocator) {
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+
+  if (llvm::MemoryBuffer::getFile(GetPath(Key, "omp"), Buffer)) {
+    return false;
+  }
+
+  clang::Preprocessor &PP = CI.getPreprocessor();
+
+  stringstream In(Buffer->getBuffer().str());
+  string Record;
+
+  PragmaDirective *Directive = NULL;
+  unsigned DirectiveKey = 0;
+
+  while (In >> Record) {
+
+    unsigned Type;
+    unsigned Begin;
+    unsigned End;
+
+    if (Record == "directive") {
+
+      In >> DirectiveKey >> Begin >> End;
+
+      Directive = new (Allocator.Allocate()) PragmaDirective;
+      Directive->setRange(Relocate(Begin, End, Offset));
+
+    } else if (Record == "construct" && Directive) {
+
+      In >> Type >> Begin >> End;
+
+      PragmaConstruct C;
+      C.Type = static_cast<ConstructType>(Type);
+      C.Range = Relocate(Begin, End, Offset);
+      Directive->insertConstruct(C);
+
+    } else if (Record == "clause" && Directive) {
+
+      unsigned OpKind;
+      unsigned OpLoc;
+      string OpName;
+      unsigned NumOptions;
+
+      In >> Type >> Begin >> End >> OpKind >> OpLoc >> OpName >> NumOptions;
+
+      PragmaClause C;
+      C.Type = static_cast<ClauseType>(Type);
+      C.Range = Relocate(Begin, End, Offset);
+
+      C.Op.startToken();
+      C.Op.setKind(static_cast<clang::tok::TokenKind>(OpKind));
+      C.Op.setLocation(Relocate(OpLoc, Offset));
+
+      if (C.Op.is(clang::tok::identifier)) {
+        C.Op.setIdentifierInfo(PP.getIdentifierInfo(OpName));
+      }
+
+      for (unsigned i = 0; i < NumOptions; i++) {
+
+        string Option;
+        In >> Option;
+        C.Options.push_back(PP.getIdentifierInfo(Option));
+
+      }
+
+      Directive->insertClause(C);
+
+    } else if (Record == "end" && Directive) {
+
+      SourceLocation Loc = Relocate(DirectiveKey, Offset);
+      Directives.insert(make_pair(Loc.getRawEncoding(), Directive));
+      Directive = NULL;
+
+    } else {
+
+      return false;
+
+    }
+
+  }
+
+  return Directive == NULL;
+
+}
+
+void ASTCache::WriteDependencies(string Key, CompilerInstance &CI) {
+
+  string Error;
+  llvm::raw_fd_ostream Out(GetPath(Key, "deps").c_str(), Error);
+
+  if (!Error.empty()) {
+    return;
+  }
+
+  SourceManager &SM = CI.getSourceManager();
+  SourceManager::fileinfo_iterator FileIt;
+
+  for (FileIt = SM.fileinfo_begin(); FileIt != SM.fileinfo_end(); FileIt++) {
+
+    const FileEntry *FE = FileIt->first;
+
+    Out << FE->getSize() << " " << FE->getModificationTime() << " "
+        << FE->getName() << "\n";
+
+  }
+
+}
+
+// Public
+
+string ASTCache::GetKey(string Filename, string Flags) {
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+
+  if (llvm::MemoryBuffer::getFile(Filename, Buffer)) {
+    return "";
+  }
+
+  uint64_t Hash = tools::HashString(Configuration + "\n" + Flags + "\n"
+                                    + Filename + "\n");
+  Hash = tools::HashString(Buffer->getBuffer(), Hash);
+
+  stringstream Key;
+  Key << std::hex << Hash;
+
+  return Key.str();
+
+}
+
+bool ASTCache::Contains(string Key) {
+
+  bool ASTExists = false;
+  bool DirectivesExist = false;
+  bool DepsExist = false;
+
+  llvm::sys::fs::exists(GetPath(Key, "ast"), ASTExists);
+  llvm::sys::fs::exists(GetPath(Key, "omp"), DirectivesExist);
+  llvm::sys::fs::exists(GetPath(Key, "deps"), DepsExist);
+
+  return ASTExists && DirectivesExist && DepsExist
+         && DependenciesUnchanged(Key);
+
+}
+
+ASTConsumer * ASTCache::CreateWriter(string Key,
+                                     CompilerInstance &CI,
+                                     ASTConsumer *Consumer) {
+
+  string Error;
+  string Path = GetPath(Key, "ast");
+
+  // An older entry under the same key is stale by definition
+  bool Existed;
+  llvm::sys::fs::remove(GetPath(Key, "deps"), Existed);
+
+  llvm::raw_fd_ostream *Out;
+  Out = new llvm::raw_fd_ostream(Path.c_str(),
+                                 Error,
+                                 llvm::raw_fd_ostream::F_Binary);
+
+  if (!Error.empty()) {
+    delete Out;
+    return Consumer;
+  }
+
+  PendingASTs[Key] = Out;
+
+  vector<ASTConsumer *> Consumers;
+  Consumers.push_back(Consumer);
+  Consumers.push_back(new clang::PCHGenerator(CI.getPreprocessor(),
+                                              Path,
+                                              NULL,
+                                              "",
+                                              Out));
+
+  return new clang::MultiplexConsumer(Consumers);
+
+}
+
+void ASTCache::Store(string Key,
+                     CompilerInstance &CI,
+                     PragmaDirectiveMap &Directives) {
+
+  map<string, llvm::raw_fd_ostream *>::iterator OutIt;
+  OutIt = PendingASTs.find(Key);
+
+  if (OutIt == PendingASTs.end()) {
+    return;
+  }
+
+  delete OutIt->second;
+  PendingASTs.erase(OutIt);
+
+  // The PCHGenerator doesn't write anything for a broken TU
+  if (CI.getDiagnostics().hasErrorOccurred()) {
+    return;
+  }
+
+  WriteDirectives(Key, Directives);
+  WriteDependencies(Key, CI);
+
+}
+
+bool ASTCache::Attach(string Key, CompilerInstance &CI) {
+
+  CI.createPCHExternalASTSource(GetPath(Key, "ast"), false, false, NULL);
+
+  if (!CI.getASTContext().getExternalSource()) {
+    return false;
+  }
+
+  // Everything comes from the AST, so there's nothing left to parse
+  llvm::MemoryBuffer *Empty = llvm::MemoryBuffer::getMemBuffer("", Key);
+  CI.getSourceManager().createMainFileIDForMemBuffer(Empty);
+
+  return true;
+
+}
+
+bool ASTCache::Load(string Key,
+                    CompilerInstance &CI,
+                    vector<Decl *> &Decls,
+                    PragmaDirectiveMap &Directives,
+                    PragmaDirectiveAllocator &Allocator) {
+
+  ASTReader *Reader = CI.getModuleManager();
+
+  if (!Reader) {
+    return false;
+  }
+
+  // Everything in the AST is shifted by the same amount when it's loaded, as
+  // it was compiled with a base offset of 2. The directives were keyed on
+  // the original locations so need the same shift applied.
+  clang::serialization::ModuleFile &Module
+      = Reader->getModuleManager().getPrimaryModule();
+  int Offset = static_cast<int>(Module.SLocEntryBaseOffset) - 2;
+
+  TranslationUnitDecl *TU = CI.getASTContext().getTranslationUnitDecl();
+  DeclContext::decl_iterator DeclIt;
+
+  // Implicit decls were never handed to the consumer by a real parse
+  for (DeclIt = TU->decls_begin(); DeclIt != TU->decls_end(); DeclIt++) {
+
+    if (!(*DeclIt)->isImplicit()) {
+      Decls.push_back(*DeclIt);
+    }
+
+  }
+
+  return ReadDirectives(Key, CI, Offset, Directives, Allocator);
+
+}
+
+} // End namespace speculation
@@ -0,0 +1,92 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _ASTCACHE_H_
+#define _ASTCACHE_H_
+
+#include "Classes.h"
+#include "PragmaDirective.h"
+
+#include "clang/AST/AST.h"
+#include "clang/AST/ASTConsumer.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+using clang::ASTConsumer;
+using clang::CompilerInstance;
+using clang::Decl;
+using clang::FileManager;
+using clang::FileSystemOptions;
+
+namespace speculation {
+
+// On-disk cache of parsed translation units. Each entry is keyed on a hash of
+// the file contents and the Configuration string (compiler version, include
+// paths, ...) and consists of:
+//   <Key>.ast  - the serialized AST, written by a PCHGenerator during parsing
+//   <Key>.omp  - the PragmaDirectiveMap built by the OMPPragmaHandler
+//   <Key>.deps - every file the TU read, with its size and modification time
+// The .deps file is written last, so an entry only counts once it exists.
+class ASTCache {
+
+ private:
+
+  string Directory;
+  string Configuration;
+  FileSystemOptions FileSystemOpts;
+  FileManager Files;
+
+  map<string, llvm::raw_fd_ostream *> PendingASTs;
+
+  string GetPath(string Key, string Extension);
+
+  bool DependenciesUnchanged(string Key);
+
+  void WriteDirectives(string Key, PragmaDirectiveMap &Directives);
+  bool ReadDirectives(string Key,
+                      CompilerInstance &CI,
+                      int Offset,
+                      PragmaDirectiveMap &Directives,
+                      PragmaDirectiveAllocator &Allocator);
+
+  void WriteDependencies(string Key, CompilerInstance &CI);
+
+ public:
+
+  ASTCache(string Directory, string Configuration);
+
+  // Returns the key for Filename parsed with Flags on top of the
+  // Configuration, or an empty string if it can't be read
+  string GetKey(string Filename, string Flags = "");
+
+  bool Contains(string Key);
+
+  // Wraps Consumer so that the AST gets written to the cache as a side effect
+  // of parsing. Store must be called once parsing has finished.
+  ASTConsumer * CreateWriter(string Key,
+                             CompilerInstance &CI,
+                             ASTConsumer *Consumer);
+
+  void Store(string Key, CompilerInstance &CI, PragmaDirectiveMap &Directives);
+
+  // Attaches the cached AST to CI, which must have an ASTContext but no main
+  // file yet.
+  bool Attach(string Key, CompilerInstance &CI);
+
+  // Once CI has been "parsed", fills in the top level decls and directives
+  // that the normal parse would have produced.
+  bool Load(string Key,
+            CompilerInstance &CI,
+            vector<Decl *> &Decls,
+            PragmaDirectiveMap &Directives,
+            PragmaDirectiveAllocator &Allocator);
+
+};
+
+} // End namespace speculation
+
+#endif
@@ -34,10 +34,14 @@ class DeclTracker;
 class DirectiveFinder;
 class DirectiveHandler;
 class DirectiveList;
+class FlowAnalysis;
 class FunctionCallList;
+class LoopAnalysis;
 class NoEditStmtPrinter;
 class OMPPragmaHandler;
+class PlanOptimizer;
 class PragmaDirective;
+class PrivateInference;
 class VarCollector;
 class VarTraverser;
 
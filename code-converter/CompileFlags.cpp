@@ -0,0 +1,170 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "CompileFlags.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/PathV2.h"
+
+using clang::HeaderSearchOptions;
+using clang::PreprocessorOptions;
+
+namespace speculation {
+
+static string MakeAbsolute(StringRef Directory, StringRef Path) {
+
+  if (llvm::sys::path::is_absolute(Path)) {
+    return Path;
+  }
+
+  llvm::SmallString<128> Absolute(Directory);
+  llvm::sys::path::append(Absolute, Path);
+
+  return Absolute.str();
+
+}
+
+// Matches both "-IDir" and "-I Dir", moving i past the value in the latter
+static bool GetFlagValue(const vector<string> &Args,
+                         unsigned &i,
+                         StringRef Flag,
+                         string &Value) {
+
+  StringRef Arg = Args[i];
+
+  if (!Arg.startswith(Flag)) {
+    return false;
+  }
+
+  if (Arg.size() > Flag.size()) {
+    Value = Arg.substr(Flag.size());
+    return true;
+  }
+
+  if (i + 1 == Args.size()) {
+    return false;
+  }
+
+  Value = Args[++i];
+
+  return true;
+
+}
+
+string ParseCompileCommand(const CompileCommand &Command,
+                           string File,
+                           CompileFlags &Flags) {
+
+  const vector<string> &Args = Command.CommandLine;
+  StringRef Directory = Command.Directory;
+
+  // The first argument is the compiler itself
+  for (unsigned i = 1; i < Args.size(); i++) {
+
+    string Value;
+
+    // Our own precompiled headers are used instead
+    if (Args[i] == "-include-pch") {
+      i++;
+      continue;
+    }
+
+    // -isystem and -include before -I, which they would otherwise match
+    if (GetFlagValue(Args, i, "-isystem", Value)) {
+      Flags.SystemDirectories.push_back(MakeAbsolute(Directory, Value));
+    } else if (GetFlagValue(Args, i, "-iquote", Value)) {
+      Flags.QuoteDirectories.push_back(MakeAbsolute(Directory, Value));
+    } else if (GetFlagValue(Args, i, "-include", Value)) {
+      Flags.Includes.push_back(MakeAbsolute(Directory, Value));
+    } else if (GetFlagValue(Args, i, "-I", Value)) {
+      Flags.AngledDirectories.push_back(MakeAbsolute(Directory, Value));
+    } else if (GetFlagValue(Args, i, "-D", Value)) {
+      Flags.Macros.push_back(make_pair(Value, false));
+    } else if (GetFlagValue(Args, i, "-U", Value)) {
+      Flags.Macros.push_back(make_pair(Value, true));
+    }
+
+  }
+
+  return MakeAbsolute(Directory, File);
+
+}
+
+string GetFlagsConfiguration(const CompileFlags &Flags) {
+
+  stringstream Config;
+
+  for (unsigned i = 0; i < Flags.QuoteDirectories.size(); i++) {
+    Config << "-iquote " << Flags.QuoteDirectories[i] << "\n";
+  }
+
+  for (unsigned i = 0; i < Flags.AngledDirectories.size(); i++) {
+    Config << "-I " << Flags.AngledDirectories[i] << "\n";
+  }
+
+  for (unsigned i = 0; i < Flags.SystemDirectories.size(); i++) {
+    Config << "-isystem " << Flags.SystemDirectories[i] << "\n";
+  }
+
+  for (unsigned i = 0; i < Flags.Macros.size(); i++) {
+    Config << (Flags.Macros[i].second ? "-U " : "-D ")
+           << Flags.Macros[i].first << "\n";
+  }
+
+  for (unsigned i = 0; i < Flags.Includes.size(); i++) {
+    Config << "-include " << Flags.Includes[i] << "\n";
+  }
+
+  return Config.str();
+
+}
+
+void ApplyCompileFlags(const CompileFlags &Flags, CompilerInstance &CI) {
+
+  HeaderSearchOptions &HeaderOpts = CI.getHeaderSearchOpts();
+
+  for (unsigned i = 0; i < Flags.QuoteDirectories.size(); i++) {
+    HeaderOpts.AddPath(Flags.QuoteDirectories[i],
+                       clang::frontend::Quoted,
+                       true,
+                       false,
+                       false);
+  }
+
+  for (unsigned i = 0; i < Flags.AngledDirectories.size(); i++) {
+    HeaderOpts.AddPath(Flags.AngledDirectories[i],
+                       clang::frontend::Angled,
+                       true,
+                       false,
+                       false);
+  }
+
+  for (unsigned i = 0; i < Flags.SystemDirectories.size(); i++) {
+    HeaderOpts.AddPath(Flags.SystemDirectories[i],
+                       clang::frontend::System,
+                       true,
+                       false,
+                       false);
+  }
+
+  PreprocessorOptions &PPOpts = CI.getPreprocessorOpts();
+
+  for (unsigned i = 0; i < Flags.Macros.size(); i++) {
+
+    if (Flags.Macros[i].second) {
+      PPOpts.addMacroUndef(Flags.Macros[i].first);
+    } else {
+      PPOpts.addMacroDef(Flags.Macros[i].first);
+    }
+
+  }
+
+  for (unsigned i = 0; i < Flags.Includes.size(); i++) {
+    PPOpts.Includes.push_back(Flags.Includes[i]);
+  }
+
+}
+
+} // End namespace speculation
@@ -0,0 +1,50 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _COMPILEFLAGS_H_
+#define _COMPILEFLAGS_H_
+
+#include "Classes.h"
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Tooling/CompilationDatabase.h"
+
+using clang::CompilerInstance;
+using clang::tooling::CompileCommand;
+
+namespace speculation {
+
+// The parts of a file's compile command that change how it gets parsed.
+// Anything else (optimisation, warnings, output, ...) is ignored.
+struct CompileFlags {
+
+  // -iquote, -I and -isystem, made absolute against the command's directory
+  vector<string> QuoteDirectories;
+  vector<string> AngledDirectories;
+  vector<string> SystemDirectories;
+
+  // -D (Name or Name=Value) and -U, in the order given. True for an undef.
+  vector<pair<string, bool> > Macros;
+
+  // -include
+  vector<string> Includes;
+
+};
+
+// Fills in Flags from a command out of a compilation database, and returns
+// the file it compiles, made absolute.
+string ParseCompileCommand(const CompileCommand &Command,
+                           string File,
+                           CompileFlags &Flags);
+
+// Everything in Flags, for keying caches and precompiled headers
+string GetFlagsConfiguration(const CompileFlags &Flags);
+
+// Must be applied before the Preprocessor is created
+void ApplyCompileFlags(const CompileFlags &Flags, CompilerInstance &CI);
+
+} // End namespace speculation
+
+#endif
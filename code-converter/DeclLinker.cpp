@@ -7,6 +7,7 @@
 
 #include "DeclTracker.h"
 #include "DirectiveList.h"
+#include "Log.h"
 #include "PragmaDirective.h"
 #include "StmtPrinter.h"
 #include "Tools.h"
@@ -17,7 +18,6 @@ using speculation::tools::FindLocationAfterSemi;
 using speculation::tools::FindSemiAfterLocation;
 using speculation::tools::GetLocation;
 using speculation::tools::GetRelevantParent;
-using speculation::tools::GetType;
 using speculation::tools::InsideRange;
 using speculation::tools::IsArrayIndex;
 using speculation::tools::IsPointerType;
@@ -85,8 +85,8 @@ bool DeclLinker::VisitCallExpr(CallExpr *e) {
 
     const Type * T = RDominantExpr->getType().getTypePtr();
 
-    string LT = "";
-    string RT = GetType(RDominantExpr);
+    TypePath LT = typepaths::EmptyPath;
+    TypePath RT = typepaths::GetStub(RDominantExpr);
 
     if (TrackedVars->SharePointers(VDLHS,
                                    LT,
@@ -94,14 +94,17 @@ bool DeclLinker::VisitCallExpr(CallExpr *e) {
                                    RT,
                                    T,
                                    CalledFunction,
-                                   CurrentFunction)) {
+                                   CurrentFunction)
+        && logging::Enabled(logging::Verbose)) {
 
       DiagnosticsEngine &Diags = CI->getDiagnostics();
 
       unsigned DiagID =
           Diags.getCustomDiagID(DiagnosticsEngine::Warning,
                                 "Swapping Across function above type '%0' and '%1'");
-      Diags.Report((*ArgIt)->getLocStart(), DiagID) << LT + GetType(T) << RT + GetType(T);
+      Diags.Report((*ArgIt)->getLocStart(), DiagID)
+          << typepaths::GetName(typepaths::GetTypePath(LT, T))
+          << typepaths::GetName(typepaths::GetTypePath(RT, T));
 
     }
 
@@ -137,7 +140,8 @@ bool DeclLinker::VisitDeclStmt(DeclStmt *S) {
 
       if (T->isPointerType()) {
 
-        string TS = GetType(VD->getType()->getUnqualifiedDesugaredType());
+        const Type * VT = VD->getType()->getUnqualifiedDesugaredType();
+        TypePath TS = typepaths::GetTypePath(typepaths::EmptyPath, VT);
 
         if (IsArray) {
           HandleArrayInit(VD, TS, S->getLocStart());
@@ -161,14 +165,14 @@ bool DeclLinker::VisitDeclStmt(DeclStmt *S) {
 }
 
 void DeclLinker::HandleArrayInit(VarDecl *VDLHS,
-                                 string TLHS,
+                                 TypePath TLHS,
                                  SourceLocation StmtLoc) {
 
   InitListExpr * Inits = dyn_cast<InitListExpr>(VDLHS->getInit());
 
   if (!Inits) {
     // TODO: Convert to real error
-    llvm::errs() << "Warning: Expected to find an InitListExpr but didn't!\n";
+    logging::Out() << "Warning: Expected to find an InitListExpr but didn't!\n";
     return;
   }
 
@@ -177,7 +181,7 @@ void DeclLinker::HandleArrayInit(VarDecl *VDLHS,
 }
 
 void DeclLinker::HandleArrayInitList(VarDecl *VDLHS,
-                                     string TLHS,
+                                     TypePath TLHS,
                                      InitListExpr * Inits,
                                      SourceLocation StmtLoc) {
 
@@ -206,7 +210,7 @@ void DeclLinker::HandleArrayInitList(VarDecl *VDLHS,
       }
 
       VarDecl * VDRHS = dyn_cast<VarDecl>(RDominantRef->getDecl());
-      string TRHS = GetType(RDominantExpr);
+      TypePath TRHS = typepaths::GetStub(RDominantExpr);
 
       const Type * T = RDominantExpr->getType()->getUnqualifiedDesugaredType();
 
@@ -219,7 +223,7 @@ void DeclLinker::HandleArrayInitList(VarDecl *VDLHS,
 }
 
 void DeclLinker::HandlePointerInit(VarDecl *VDLHS,
-                                   string TLHS,
+                                   TypePath TLHS,
                                    SourceLocation StmtLoc) {
 
   // Get Dominant RHS DeclRef and its expr
@@ -236,7 +240,7 @@ void DeclLinker::HandlePointerInit(VarDecl *VDLHS,
 
   VarDecl * VDRHS = dyn_cast<VarDecl>(RDominantRef->getDecl());
 
-  string TRHS = GetType(RDominantExpr);
+  TypePath TRHS = typepaths::GetStub(RDominantExpr);
 
   const Type * T = RDominantExpr->getType()->getUnqualifiedDesugaredType();
 
@@ -270,8 +274,8 @@ bool DeclLinker::VisitBinaryOperator(BinaryOperator *e)  {
   // Where on earth is it writing to!?
   // TODO: Convert to actual error!
   if (!LDominantRef) {
-    llvm::errs() << "Warning: Found a pointer being modified that we have no "
-                 << "idea where came from. Can't determine if private or not!\n";
+    logging::Out() << "Warning: Found a pointer being modified that we have no "
+                   << "idea where came from. Can't determine if private or not!\n";
     return true;
   }
 
@@ -284,7 +288,9 @@ bool DeclLinker::VisitBinaryOperator(BinaryOperator *e)  {
 
   // If there isn't a dominant variable now being pointed to, just return
   if (!RDominantRef) {
-    llvm::errs() << "No dominant right ref\n";
+    if (logging::Enabled(logging::Debug)) {
+      logging::Out() << "No dominant right ref\n";
+    }
     return true;
   }
 
@@ -293,8 +299,8 @@ bool DeclLinker::VisitBinaryOperator(BinaryOperator *e)  {
 
   const Type * T = LDominantExpr->getType().getTypePtr();
 
-  string LT = GetType(LDominantExpr);
-  string RT = GetType(RDominantExpr);
+  TypePath LT = typepaths::GetStub(LDominantExpr);
+  TypePath RT = typepaths::GetStub(RDominantExpr);
 
   maybeSwapped(VDLHS, LT, VDRHS, RT, T, e->getLocStart());
 
@@ -303,9 +309,9 @@ bool DeclLinker::VisitBinaryOperator(BinaryOperator *e)  {
 }
 
 void DeclLinker::maybeSwapped(VarDecl *VDLHS,
-                              string LStub,
+                              TypePath LStub,
                               VarDecl *VDRHS,
-                              string RStub,
+                              TypePath RStub,
                               const Type * T,
                               SourceLocation StmtLoc) {
 
@@ -315,18 +321,20 @@ void DeclLinker::maybeSwapped(VarDecl *VDLHS,
                                  RStub,
                                  T,
                                  CurrentFunction,
-                                 CurrentFunction)) {
+                                 CurrentFunction)
+      && logging::Enabled(logging::Verbose)) {
 
     DiagnosticsEngine &Diags = CI->getDiagnostics();
 
     unsigned DiagID =
         Diags.getCustomDiagID(DiagnosticsEngine::Warning,
                               "Swapping Occurred above type '%0' and '%1'");
-    Diags.Report(StmtLoc, DiagID) << LStub + GetType(T) << RStub + GetType(T);
+    Diags.Report(StmtLoc, DiagID) << typepaths::GetName(typepaths::GetTypePath(LStub, T))
+                                  << typepaths::GetName(typepaths::GetTypePath(RStub, T));
 
-    llvm::errs() << "LHS: " << VDLHS->getNameAsString() << "\n";
+    logging::Out() << "LHS: " << VDLHS->getNameAsString() << "\n";
     //FullDirectives->printStack(VDLHS);
-    llvm::errs() << "RHS: " << VDRHS->getNameAsString() << "\n";
+    logging::Out() << "RHS: " << VDRHS->getNameAsString() << "\n";
     //FullDirectives->printStack(VDRHS);
 
   }
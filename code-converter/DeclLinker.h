@@ -7,6 +7,7 @@
 #define _DECLLINKER_H_
 
 #include "Classes.h"
+#include "TypePaths.h"
 
 #include "clang/AST/AST.h"
 #include "clang/AST/RecursiveASTVisitor.h"
@@ -45,17 +46,17 @@ class DeclLinker
       bool VisitDeclStmt(DeclStmt *s);
       bool VisitBinaryOperator(BinaryOperator *e);
 
-      void HandleArrayInit(VarDecl *VDLHS, string TLHS, SourceLocation StmtLoc);
+      void HandleArrayInit(VarDecl *VDLHS, TypePath TLHS, SourceLocation StmtLoc);
       void HandleArrayInitList(VarDecl *VDLHS,
-                               string TLHS,
+                               TypePath TLHS,
                                InitListExpr * Inits,
                                SourceLocation StmtLoc);
-      void HandlePointerInit(VarDecl *VDLHS, string TLHS, SourceLocation StmtLoc);
+      void HandlePointerInit(VarDecl *VDLHS, TypePath TLHS, SourceLocation StmtLoc);
 
       void maybeSwapped(VarDecl *VDLHS,
-                        string TLHS,
+                        TypePath TLHS,
                         VarDecl *VDRHS,
-                        string TRHS,
+                        TypePath TRHS,
                         const Type * T,
                         SourceLocation StmtLoc);
 
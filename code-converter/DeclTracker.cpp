@@ -6,15 +6,16 @@
 #include "DeclTracker.h"
 
 #include "Globals.h"
+#include "Log.h"
 #include "Tools.h"
 #include "VarTraverser.h"
 
-using speculation::tools::GetType;
+#include <algorithm>
+
 using speculation::tools::GetLocation;
 
 using clang::DiagnosticsEngine;
 using clang::FieldDecl;
-using clang::StringRef;
 
 using llvm::dyn_cast;
 
@@ -25,6 +26,8 @@ DeclTracker::DeclTracker()
   : GlobalDecls(),
     AllCalls(),
     AllFunctions(),
+    FunctionAllocator(),
+    CallAllocator(),
     Changed(false) {
 
 }
@@ -49,12 +52,14 @@ void DeclTracker::TrackDecl(VarDecl * VD, SharedDeclMap &TrackedDecls) {
 
     do {
 
+      TypePath Path = typepaths::GetTypePath(typepaths::EmptyPath, T);
+
       // Do we really need to check that this type hasn't been added before?
-      SharedTypeMap::iterator TypeIt = Types.find(GetType(T));
+      SharedTypeMap::iterator TypeIt = Types.find(Path);
 
       if (TypeIt == Types.end()) {
-        TypeIt = Types.insert(make_pair(GetType(T), DeclSet())).first;
-        TypeIt->second.insert(VD);
+        TypeIt = Types.insert(make_pair(Path, DeclSet())).first;
+        TypeIt->second.set(globals::GetDeclId(VD));
       }
 
       if (T->isPointerType()) {
@@ -65,14 +70,14 @@ void DeclTracker::TrackDecl(VarDecl * VD, SharedDeclMap &TrackedDecls) {
 
         if (T->isStructureType()) {
 
-          TrackStructDecl(GetType(T),
+          TrackStructDecl(Path,
                           T->getAsStructureType()->getDecl(),
                           Types,
                           VD);
 
         } else if (T->isUnionType()) {
 
-          TrackStructDecl(GetType(T),
+          TrackStructDecl(Path,
                           T->getAsUnionType()->getDecl(),
                           Types,
                           VD);
@@ -87,7 +92,7 @@ void DeclTracker::TrackDecl(VarDecl * VD, SharedDeclMap &TrackedDecls) {
 
 }
 
-void DeclTracker::TrackStructDecl(string BaseType,
+void DeclTracker::TrackStructDecl(TypePath BaseType,
                                   const RecordDecl * RD,
                                   SharedTypeMap &Types,
                                   VarDecl * VD) {
@@ -102,26 +107,26 @@ void DeclTracker::TrackStructDecl(string BaseType,
       return;
     }
 
+    TypePath FieldStub = typepaths::GetFieldStub(BaseType, FD);
+
     // Loop over this decl's type and its derivate types
     // Adding them as private
     const Type * T = FD->getType()->getUnqualifiedDesugaredType();
 
     do {
 
-      if (StringRef(BaseType).find(StringRef(GetType(T))) != StringRef::npos) {
+      if (typepaths::Contains(BaseType, T)) {
         break;
       }
 
-      stringstream TypeString;
-      TypeString << BaseType << "." << FD->getName().str() << ":"
-		 << GetType(T);
+      TypePath Path = typepaths::GetTypePath(FieldStub, T);
 
       // Do we really need to check that this type hasn't been added before?
-      SharedTypeMap::iterator TypeIt = Types.find(TypeString.str());
+      SharedTypeMap::iterator TypeIt = Types.find(Path);
 
       if (TypeIt == Types.end()) {
-        TypeIt = Types.insert(make_pair(string(TypeString.str()), DeclSet())).first;
-        TypeIt->second.insert(VD);
+        TypeIt = Types.insert(make_pair(Path, DeclSet())).first;
+        TypeIt->second.set(globals::GetDeclId(VD));
       }
 
       if (T->isPointerType()) {
@@ -131,15 +136,9 @@ void DeclTracker::TrackStructDecl(string BaseType,
       } else {
 
         if (T->isStructureType()) {
-          stringstream TypeString;
-          TypeString << BaseType << "." << FD->getName().str() << ":"
-                     << GetType(T);
-          TrackStructDecl(string(TypeString.str()), T->getAsStructureType()->getDecl(), Types, VD);
+          TrackStructDecl(Path, T->getAsStructureType()->getDecl(), Types, VD);
         } else if (T->isUnionType()) {
-          stringstream TypeString;
-          TypeString << BaseType << "." << FD->getName().str() << ":"
-                     << GetType(T);
-          TrackStructDecl(string(TypeString.str()), T->getAsUnionType()->getDecl(), Types, VD);
+          TrackStructDecl(Path, T->getAsUnionType()->getDecl(), Types, VD);
         }
 
         T = NULL;
@@ -156,7 +155,7 @@ void DeclTracker::TrackStructDecl(string BaseType,
 FunctionTracker * DeclTracker::CreateFunction(FunctionDecl * TheFunction,
                                               CompilerInstance *CI) {
 
-  FunctionTracker *F = new FunctionTracker;
+  FunctionTracker *F = new (FunctionAllocator.Allocate()) FunctionTracker;
 
   F->TheFunction = TheFunction;
   F->CI = CI;
@@ -169,12 +168,16 @@ FunctionTracker * DeclTracker::CreateFunction(FunctionDecl * TheFunction,
     TrackDecl(*ParamIt, F->TrackedDecls);
   }
 
-  DiagnosticsEngine &Diags = CI->getDiagnostics();
+  if (logging::Enabled(logging::Verbose)) {
 
-  unsigned DiagID =
-      Diags.getCustomDiagID(DiagnosticsEngine::Warning,
-                            "Created Function '%0'");
-  Diags.Report(TheFunction->getLocStart(), DiagID) << TheFunction->getName();
+    DiagnosticsEngine &Diags = CI->getDiagnostics();
+
+    unsigned DiagID =
+        Diags.getCustomDiagID(DiagnosticsEngine::Warning,
+                              "Created Function '%0'");
+    Diags.Report(TheFunction->getLocStart(), DiagID) << TheFunction->getName();
+
+  }
 
   return F;
 
@@ -187,7 +190,7 @@ FunctionCallTracker * DeclTracker::CreateFunctionCall(CallExpr * TheCall,
 
   CompilerInstance &CI = *Parent->CI;
 
-  FunctionCallTracker *F = new FunctionCallTracker;
+  FunctionCallTracker *F = new (CallAllocator.Allocate()) FunctionCallTracker;
   F->Parent = Parent;
   F->TheCall = TheCall;
   F->TheFunction = TheFunction;
@@ -343,9 +346,9 @@ void DeclTracker::AddCall(CallExpr * C, FunctionTracker * FT) {
 
 // Public
 bool DeclTracker::SharePointers(NamedDecl * VDLHS,
-                                string LStub,
+                                TypePath LStub,
                                 NamedDecl * VDRHS,
-                                string RStub,
+                                TypePath RStub,
                                 const Type * T,
                                 FunctionTracker * LF,
                                 FunctionTracker * RF) {
@@ -369,10 +372,10 @@ bool DeclTracker::SharePointers(NamedDecl * VDLHS,
 // Private
 bool DeclTracker::SharePointers(NamedDecl * VDLHS,
                                 SharedTypeMap &TLHS,
-                                string LStub,
+                                TypePath LStub,
                                 NamedDecl * VDRHS,
                                 SharedTypeMap &TRHS,
-                                string RStub,
+                                TypePath RStub,
                                 const Type * InT,
                                 bool IncFirst) {
 
@@ -392,38 +395,28 @@ bool DeclTracker::SharePointers(NamedDecl * VDLHS,
 
   do {
 
-    size_t SLoc = StringRef(LStub).find(StringRef(GetType(T)));
-    if (SLoc != StringRef::npos) {
+    if (typepaths::Contains(LStub, T) || typepaths::Contains(RStub, T)) {
       break;
     }
 
-    SLoc = StringRef(RStub).find(StringRef(GetType(T)));
-    if (SLoc != StringRef::npos) {
-      break;
-    }
+    TypePath LPath = typepaths::GetTypePath(LStub, T);
+    TypePath RPath = typepaths::GetTypePath(RStub, T);
 
     // Do we really need to check that this type hasn't been added before?
-    SharedTypeMap::iterator TypeItLHS = TLHS.find(LStub + GetType(T));
-    SharedTypeMap::iterator TypeItRHS = TRHS.find(RStub + GetType(T));
+    SharedTypeMap::iterator TypeItLHS = TLHS.find(LPath);
+    SharedTypeMap::iterator TypeItRHS = TRHS.find(RPath);
 
     assert(TypeItLHS != TLHS.end());
     assert(TypeItRHS != TRHS.end());
 
-    DeclSet::iterator Dit;
+    DeclSet &DLHS = TypeItLHS->second;
+    DeclSet &DRHS = TypeItRHS->second;
 
-    Updated = TypeItLHS->second.insert(VDRHS).second || Updated;
-    for (Dit = TypeItRHS->second.begin();
-         Dit != TypeItRHS->second.end();
-         Dit++) {
-      Updated = TypeItLHS->second.insert(*Dit).second || Updated;
-    }
+    Updated = DLHS.test_and_set(globals::GetDeclId(VDRHS)) || Updated;
+    Updated = (DLHS |= DRHS) || Updated;
 
-    Updated = TypeItRHS->second.insert(VDLHS).second || Updated;
-    for (Dit = TypeItLHS->second.begin();
-         Dit != TypeItLHS->second.end();
-         Dit++) {
-      Updated = TypeItRHS->second.insert(*Dit).second || Updated;
-    }
+    Updated = DRHS.test_and_set(globals::GetDeclId(VDLHS)) || Updated;
+    Updated = (DRHS |= DLHS) || Updated;
 
     if (T->isPointerType()) {
       T = T->getPointeeType()->getUnqualifiedDesugaredType();
@@ -448,8 +441,8 @@ bool DeclTracker::SharePointers(NamedDecl * VDLHS,
           FieldDecl * FD = *FieldIt;
 
           const Type * NT = FD->getType()->getUnqualifiedDesugaredType();
-          string NLStub = LStub + GetType(T) + "." + FD->getNameAsString() + ":";
-          string NRStub = RStub + GetType(T) + "." + FD->getNameAsString() + ":";
+          TypePath NLStub = typepaths::GetFieldStub(LPath, FD);
+          TypePath NRStub = typepaths::GetFieldStub(RPath, FD);
 
           Updated = SharePointers(VDLHS,
                                   TLHS,
@@ -478,51 +471,51 @@ bool DeclTracker::SharePointers(NamedDecl * VDLHS,
 }
 
 // Private
-void DeclTracker::PropogateShares(SharedDeclMap &M1, SharedDeclMap &M2) {
+bool DeclTracker::PropogateShares(SharedDeclMap &M1, SharedDeclMap &M2) {
 
-  // Loop over each variable (x) in the first list.
-  // Then loop over each variable (y) in the second list.
+  // Loop over each variable (y) in the second list.
   // For each y loop over each type (t) it covers.
-  // If y contains x at type t then
+  // For each variable (x) of the first list that y contains at type t
   //    copy over all shared variables for y of type t
   //    into the list of x of type t
 
   bool Updated = false;
 
-  SharedDeclMap::iterator It1;
+  SharedDeclMap::iterator It2;
 
-  for (It1 = M1.begin(); It1 != M1.end(); It1++) {
+  for (It2 = M2.begin(); It2 != M2.end(); It2++) {
 
-    NamedDecl * Current1 = It1->first;
-    SharedTypeMap &T1 = It1->second;
+    SharedTypeMap &T2 = It2->second;
+    SharedTypeMap::iterator Tit2;
 
-    SharedDeclMap::iterator It2;
-    for (It2 = M2.begin(); It2 != M2.end(); It2++) {
+    for (Tit2 = T2.begin(); Tit2 != T2.end(); Tit2++) {
 
-      SharedTypeMap &T2 = It2->second;
-      SharedTypeMap::iterator Tit2;
+      DeclSet &D2 = Tit2->second;
+      DeclSet::iterator Found;
 
-      for (Tit2 = T2.begin(); Tit2 != T2.end(); Tit2++) {
+      for (Found = D2.begin(); Found != D2.end(); Found++) {
 
-        string Type2 = Tit2->first;
-        DeclSet &D2 = Tit2->second;
-        DeclSet::iterator Found = D2.find(Current1);
-        if (Found != D2.end()) {
-          // TODO: Need to update this to handle structs/unions!!!
-          // Might find "int *" in one and "MyStruct.a:int *" in t'other!!
-          // If it does at the moment it'll assert out, so we're at least safe
-          SharedTypeMap::iterator Tit1;
-          Tit1 = T1.find(Type2);
-          assert(Tit1 != T1.end());
+        SharedDeclMap::iterator It1 = M1.find(globals::GetDeclFromId(*Found));
 
-          DeclSet &D1 = Tit1->second;
-          DeclSet::iterator ActualVars;
-          for (ActualVars = D2.begin(); ActualVars != D2.end(); ActualVars++) {
-            Updated = D1.insert(*ActualVars).second || Updated;
-          }
+        if (It1 == M1.end()) {
+          continue;
+        }
+
+        // TODO: Need to update this to handle structs/unions!!!
+        // Might find "int *" in one and "MyStruct.a:int *" in t'other!!
+        // If it does at the moment it'll assert out, so we're at least safe
+        SharedTypeMap::iterator Tit1;
+        Tit1 = It1->second.find(Tit2->first);
+        assert(Tit1 != It1->second.end());
+
+        DeclSet &D1 = Tit1->second;
 
+        if (&D1 == &D2) {
+          continue;
         }
 
+        Updated = (D1 |= D2) || Updated;
+
       }
 
     }
@@ -531,49 +524,104 @@ void DeclTracker::PropogateShares(SharedDeclMap &M1, SharedDeclMap &M2) {
 
   Changed = Changed || Updated;
 
+  return Updated;
+
 }
 
 // Public
 void DeclTracker::PropogateShares() {
 
-  do {
+  // Every map that pulls shares from a given map, i.e. M1 for each
+  // PropogateShares(M1, M2) that needs to hold at the fixpoint
+  map<SharedDeclMap *, vector<SharedDeclMap *> > Dependents;
+  list<SharedDeclMap *> Worklist;
+  set<SharedDeclMap *> Queued;
 
-    resetChanged();
+  AddShareDependency(Dependents, &GlobalDecls, &GlobalDecls);
+  Worklist.push_back(&GlobalDecls);
 
-    PropogateShares(GlobalDecls, GlobalDecls);
+  map<FunctionDecl *, FunctionTracker *>::iterator FuncIt;
+  for (FuncIt = AllFunctions.begin();
+       FuncIt != AllFunctions.end();
+       FuncIt++) {
 
-    map<FunctionDecl *, FunctionTracker *>::iterator FuncIt;
-    for (FuncIt = AllFunctions.begin();
-         FuncIt != AllFunctions.end();
-         FuncIt++) {
+    SharedDeclMap *F = &FuncIt->second->TrackedDecls;
 
-      PropogateShares(FuncIt->second->TrackedDecls, FuncIt->second->TrackedDecls);
-      PropogateShares(GlobalDecls, FuncIt->second->TrackedDecls);
-      PropogateShares(FuncIt->second->TrackedDecls, GlobalDecls);
+    AddShareDependency(Dependents, F, F);
+    AddShareDependency(Dependents, &GlobalDecls, F);
+    AddShareDependency(Dependents, F, &GlobalDecls);
 
-    }
+    Worklist.push_back(F);
+
+  }
+
+  map<CallExpr *, FunctionCallTracker *>::iterator CallIt;
+  for (CallIt = AllCalls.begin();
+       CallIt != AllCalls.end();
+       CallIt++) {
+
+    FunctionTracker * F1 = CallIt->second->Parent;
+    FunctionTracker * F2 = GetTracker(CallIt->second->TheFunction);
 
-    map<CallExpr *, FunctionCallTracker *>::iterator CallIt;
-    for (CallIt = AllCalls.begin();
-         CallIt != AllCalls.end();
-         CallIt++) {
+    AddShareDependency(Dependents, &F1->TrackedDecls, &F2->TrackedDecls);
+    AddShareDependency(Dependents, &F2->TrackedDecls, &F1->TrackedDecls);
 
-      FunctionTracker * F1 = CallIt->second->Parent;
-      FunctionTracker * F2 = GetTracker(CallIt->second->TheFunction);
+  }
+
+  Queued.insert(Worklist.begin(), Worklist.end());
+
+  // Only maps whose sets grew need to be pushed to their dependents again
+  while (!Worklist.empty()) {
+
+    SharedDeclMap *M2 = Worklist.front();
+    Worklist.pop_front();
+    Queued.erase(M2);
 
-      PropogateShares(F1->TrackedDecls, F2->TrackedDecls);
-      PropogateShares(F2->TrackedDecls, F1->TrackedDecls);
+    vector<SharedDeclMap *> &Targets = Dependents[M2];
+    vector<SharedDeclMap *>::iterator TargetIt;
+
+    for (TargetIt = Targets.begin(); TargetIt != Targets.end(); TargetIt++) {
+
+      if (PropogateShares(**TargetIt, *M2) && Queued.insert(*TargetIt).second) {
+        Worklist.push_back(*TargetIt);
+      }
 
     }
 
-  } while(getChanged());
+  }
+
+}
+
+// Private
+void DeclTracker::AddShareDependency(
+                        map<SharedDeclMap *, vector<SharedDeclMap *> > &Deps,
+                        SharedDeclMap *M1,
+                        SharedDeclMap *M2) {
+
+  vector<SharedDeclMap *> &Targets = Deps[M2];
+
+  if (std::find(Targets.begin(), Targets.end(), M1) == Targets.end()) {
+    Targets.push_back(M1);
+  }
+
+}
+
+// Public
+void DeclTracker::Release() {
+
+  GlobalDecls.clear();
+  AllCalls.clear();
+  AllFunctions.clear();
+
+  FunctionAllocator.DestroyAll();
+  CallAllocator.DestroyAll();
 
 }
 
 // Public
 void DeclTracker::printGlobalTracker() {
 
-  llvm::errs() << "Globals:\n";
+  logging::Out() << "Globals:\n";
   printSharedDeclMap(GlobalDecls);
 
 }
@@ -600,9 +648,9 @@ void DeclTracker::printFunctionTracker(FunctionTracker * F) {
 
   assert(F);
 
-  llvm::errs() << "Function: " << F->TheFunction->getName() << ", "
-               << GetLocation(F->TheFunction->getLocStart(), *(F->CI))
-               << "\n";
+  logging::Out() << "Function: " << F->TheFunction->getName() << ", "
+                 << GetLocation(F->TheFunction->getLocStart(), *(F->CI))
+                 << "\n";
 
   printSharedDeclMap(F->TrackedDecls);
 
@@ -615,8 +663,8 @@ void DeclTracker::printSharedDeclMap(SharedDeclMap &Decls) {
 
   for (DeclIt = Decls.begin(); DeclIt != Decls.end(); DeclIt++) {
 
-    llvm::errs() << "\tDecl: " << DeclIt->first->getNameAsString()
-                 << " (" << (int) DeclIt->first << ")\n";
+    logging::Out() << "\tDecl: " << DeclIt->first->getNameAsString()
+                   << " (" << (int) DeclIt->first << ")\n";
 
     SharedTypeMap::iterator TypeIt;
 
@@ -626,20 +674,22 @@ void DeclTracker::printSharedDeclMap(SharedDeclMap &Decls) {
 
       DeclSet::iterator it;
 
-      llvm::errs() << "\t\t" << TypeIt->first;
-      llvm::errs() << ": ";
+      logging::Out() << "\t\t" << typepaths::GetName(TypeIt->first);
+      logging::Out() << ": ";
 
       for (it = TypeIt->second.begin(); it != TypeIt->second.end(); it++) {
 
         if (it != TypeIt->second.begin()) {
-          llvm::errs() << ", ";
+          logging::Out() << ", ";
         }
 
-        llvm::errs() << (*it)->getNameAsString() << " (" << (int) (*it) << ")";
+        NamedDecl * Shared = globals::GetDeclFromId(*it);
+
+        logging::Out() << Shared->getNameAsString() << " (" << (int) Shared << ")";
 
       }
 
-      llvm::errs() << "\n";
+      logging::Out() << "\n";
 
     }
 
@@ -660,7 +710,7 @@ bool DeclTracker::getChanged() {
 // Public
 bool DeclTracker::ContainsMatch(NamedDecl * D,
                                 FunctionTracker * F,
-                                set<NamedDecl *> &Accesses) {
+                                DeclSet &Accesses) {
 
   assert(D);
   assert(F);
@@ -674,22 +724,22 @@ bool DeclTracker::ContainsMatch(NamedDecl * D,
        Tit != T.end();
        Tit++) {
 
-    DeclSet::iterator DeclIt;
+    if (!Tit->second.intersects(Accesses)) {
+      continue;
+    }
 
-    for (DeclIt = Tit->second.begin();
-         DeclIt != Tit->second.end();
-         DeclIt++) {
+    if (logging::Enabled(logging::Debug)) {
 
-      set<NamedDecl *>::iterator AccIt;
-      AccIt = Accesses.find(*DeclIt);
+      DeclSet Matches(Tit->second);
+      Matches &= Accesses;
 
-      if (AccIt != Accesses.end()) {
-        llvm::errs() << "\t\tFound Match: " << D->getNameAsString() << " -> " << (*AccIt)->getNameAsString() << "\n";
-        return true;
-      }
+      NamedDecl * Match = globals::GetDeclFromId(Matches.find_first());
+
+      logging::Out() << "\t\tFound Match: " << D->getNameAsString() << " -> " << Match->getNameAsString() << "\n";
 
     }
 
+    return true;
 
   }
 
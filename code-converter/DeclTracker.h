@@ -7,10 +7,15 @@
 #define _DECLTRACKER_H_
 
 #include "Classes.h"
+#include "Globals.h"
+#include "TypePaths.h"
 
 #include "clang/AST/AST.h"
 #include "clang/Frontend/CompilerInstance.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Allocator.h"
+
 using clang::CallExpr;
 using clang::CompilerInstance;
 using clang::CompoundStmt;
@@ -27,8 +32,7 @@ using clang::VarDecl;
 
 namespace speculation {
 
-typedef set<NamedDecl *> DeclSet;
-typedef map<string, DeclSet> SharedTypeMap;
+typedef llvm::DenseMap<TypePath, DeclSet> SharedTypeMap;
 typedef map<NamedDecl *, SharedTypeMap> SharedDeclMap;
 
 struct FunctionTracker {
@@ -52,10 +56,14 @@ class DeclTracker {
   map<CallExpr *, FunctionCallTracker *> AllCalls;
   map<FunctionDecl *, FunctionTracker *> AllFunctions;
 
+  // Own every tracker, which are freed together by Release
+  llvm::SpecificBumpPtrAllocator<FunctionTracker> FunctionAllocator;
+  llvm::SpecificBumpPtrAllocator<FunctionCallTracker> CallAllocator;
+
   bool Changed;
 
   void TrackDecl(VarDecl * TheDecl, SharedDeclMap &TrackedDecls);
-  void TrackStructDecl(string BaseType, const RecordDecl * RD, SharedTypeMap &Types, VarDecl * VD);
+  void TrackStructDecl(TypePath BaseType, const RecordDecl * RD, SharedTypeMap &Types, VarDecl * VD);
 
   FunctionTracker * CreateFunction(FunctionDecl * TheDecl, CompilerInstance *CI);
   FunctionCallTracker * CreateFunctionCall(CallExpr *TheCall,
@@ -64,14 +72,17 @@ class DeclTracker {
 
   bool SharePointers(NamedDecl * VDLHS,
                      SharedTypeMap &TLHS,
-                     string LStub,
+                     TypePath LStub,
                      NamedDecl * VDRHS,
                      SharedTypeMap &TRHS,
-                     string RStub,
+                     TypePath RStub,
                      const Type * T,
                      bool IncFirst = false);
 
-  void PropogateShares(SharedDeclMap &M1, SharedDeclMap &M2);
+  bool PropogateShares(SharedDeclMap &M1, SharedDeclMap &M2);
+  void AddShareDependency(map<SharedDeclMap *, vector<SharedDeclMap *> > &Deps,
+                          SharedDeclMap *M1,
+                          SharedDeclMap *M2);
 
   void resetChanged();
   bool getChanged();
@@ -94,15 +105,19 @@ class DeclTracker {
   void AddCall(CallExpr * C, FunctionTracker *F);
 
   bool SharePointers(NamedDecl * VDLHS,
-                     string LStub,
+                     TypePath LStub,
                      NamedDecl * VDRHS,
-                     string RStub,
+                     TypePath RStub,
                      const Type * T,
                      FunctionTracker * LF,
                      FunctionTracker * RF);
 
   void PropogateShares();
 
+  // Frees every tracker once nothing will ask about pointers any more, which
+  // is after the read-only variables have been found
+  void Release();
+
   void printGlobalTracker();
   void printAllFunctionsTrackers();
   void printFunctionTracker(FunctionTracker * I);
@@ -110,7 +125,7 @@ class DeclTracker {
 
   bool ContainsMatch(NamedDecl * D,
                      FunctionTracker * F,
-                     set<NamedDecl *> &Accesses);
+                     DeclSet &Accesses);
 
 };
 
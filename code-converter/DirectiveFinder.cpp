@@ -5,7 +5,9 @@
 
 #include "DirectiveFinder.h"
 #include "DirectiveList.h"
+#include "Log.h"
 #include "PragmaDirective.h"
+#include "PrivateInference.h"
 #include "Tools.h"
 
 using speculation::tools::InsideRange;
@@ -41,19 +43,50 @@ void DirectiveFinder::HandlePossiblePragma(Stmt *S) {
     return;
   }
 
-  DiagnosticsEngine &Diags = CI.getDiagnostics();
+  if (logging::Enabled(logging::Verbose)) {
 
-  unsigned DiagID =
-      Diags.getCustomDiagID(DiagnosticsEngine::Warning,
-                            "Found a top-level OpenMP directive");
-  Diags.Report(CurrentDirectiveHeader->getLocStart(), DiagID);
+    DiagnosticsEngine &Diags = CI.getDiagnostics();
 
+    unsigned DiagID =
+        Diags.getCustomDiagID(DiagnosticsEngine::Warning,
+                              "Found a top-level OpenMP directive");
+    Diags.Report(CurrentDirectiveHeader->getLocStart(), DiagID);
+
+  }
+
+  FullDirective * FD = FullDirectives.CreateTopLevel(CurrentDirective,
+                                                      CurrentDirectiveHeader,
+                                                      S,
+                                                      CI);
+
+  ConstructType Type = CurrentDirective->MainConstruct.Type;
+
+  // Only these take a private clause
+  if (Type != ParallelConstruct && Type != ForConstruct) {
+    return;
+  }
+
+  PrivateInference Inference(Directives, CI);
+  vector<VarDecl *> Privates = Inference.Infer(CurrentDirective, S);
+
+  vector<VarDecl *>::iterator PrivateIt;
+
+  for (PrivateIt = Privates.begin(); PrivateIt != Privates.end(); PrivateIt++) {
+
+    FullDirectives.InsertInferredPrivate(FD, *PrivateIt);
+
+    DiagnosticsEngine &Diags = CI.getDiagnostics();
+
+    unsigned DiagID =
+        Diags.getCustomDiagID(DiagnosticsEngine::Warning,
+                              "'%0' is written before it is read by every "
+                              "thread and is treated as private; add "
+                              "private(%0) to the directive");
+    Diags.Report(CurrentDirectiveHeader->getLocStart(), DiagID)
+        << (*PrivateIt)->getNameAsString();
+
+  }
 
-  FullDirectives.CreateTopLevel(CurrentDirective,
-                                CurrentDirectiveHeader,
-                                S,
-                                CI);
-  
 }
 
 bool DirectiveFinder::VisitCompoundStmt(CompoundStmt *S) {
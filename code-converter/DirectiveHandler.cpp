@@ -7,13 +7,14 @@
 
 #include "DirectiveList.h"
 #include "Globals.h"
-#include "NoEditStmtPrinter.h"
+#include "Log.h"
+#include "PlanOptimizer.h"
 #include "PragmaDirective.h"
+#include "Statistics.h"
 #include "Tools.h"
 #include "VarTraverser.h"
 
 using speculation::tools::GetChildRange;
-using speculation::tools::GetType;
 using speculation::tools::InsideRange;
 using speculation::tools::FindSemiAfterLocation;
 using speculation::tools::FindLocationAfterSemi;
@@ -25,7 +26,8 @@ using speculation::tools::IsChild;
 
 namespace speculation {
 
-DirectiveHandler::DirectiveHandler(DirectiveList *FullDirectives)
+DirectiveHandler::DirectiveHandler(DirectiveList *FullDirectives,
+                                   RewritePlan *Edits)
                             : RecursiveASTVisitor<DirectiveHandler>(),
                               Directives(NULL),
                               FullDirectives(FullDirectives),
@@ -35,11 +37,16 @@ DirectiveHandler::DirectiveHandler(DirectiveList *FullDirectives)
                               ReadLocs(),
                               WriteLocs(),
                               WaitingDirective(NULL),
-                              WaitingHeader(NULL) {
+                              WaitingHeader(NULL),
+                              Plans(),
+                              CurrentPlan(NULL),
+                              Chunks(),
+                              NumChunks(0),
+                              Edits(Edits) {
 
 }
 
-void DirectiveHandler::Finish() {
+void DirectiveHandler::Finish(OutputDirectory *Output) {
 
   map<CompilerInstance *, set<FileID> >::iterator CIit;
 
@@ -60,45 +67,76 @@ void DirectiveHandler::Finish() {
         SourceLocation start = sm.getLocForStartOfFile(*FileIt);
         SourceLocation end = sm.getLocForEndOfFile(*FileIt);
 
-        rw.InsertTextAfter(start, "#if defined(_OPENMP)\n");
-        rw.InsertTextAfter(start, "  #include \"Spec/CPUSpec.h\"\n");
-        rw.InsertTextAfter(start, "#endif\n");
+        StringRef Header("#if defined(_OPENMP)\n"
+                         "  #include \"Spec/CPUSpec.h\"\n"
+                         "#endif\n");
+
+        InsertText(CI, start, Header, true, HeaderEdit, false);
 
         // TODO, Add StopWatches!
 
-        llvm::errs() << "##### " << fe->getName() << " #####\n";
-        llvm::errs() << rw.getRewrittenText(SourceRange(start, end));
-        llvm::errs() << "\n";
+        if (logging::Dumping(logging::RewrittenDump)) {
+          logging::Out() << "##### " << fe->getName() << " #####\n";
+          logging::Out() << rw.getRewrittenText(SourceRange(start, end));
+          logging::Out() << "\n";
+        }
       }
 
     }
 
   }
 
-  // Backup Original Files
-  for (CIit = files.begin(); CIit != files.end(); CIit++) {
+  // A plan gets applied to the original files later on
+  if (Edits) {
+    return;
+  }
 
-    CompilerInstance &CI = *(CIit->first);
-    SourceManager &sm = CI.getSourceManager();
-    Rewriter &rw = globals::GetRewriter(CI);
+  // The originals are left alone, the output directory gets the rewritten
+  // copies
+  if (Output) {
 
-    rw.overwriteChangedFiles();
+    for (CIit = files.begin(); CIit != files.end(); CIit++) {
 
-    set<FileID> &actualFiles = CIit->second;
-    set<FileID>::iterator FileIt;
+      CompilerInstance &CI = *(CIit->first);
+      SourceManager &sm = CI.getSourceManager();
+      Rewriter &rw = globals::GetRewriter(CI);
 
-    for (FileIt = actualFiles.begin(); FileIt != actualFiles.end(); FileIt++) {
+      set<FileID> &actualFiles = CIit->second;
+      set<FileID>::iterator FileIt;
+
+      for (FileIt = actualFiles.begin();
+           FileIt != actualFiles.end();
+           FileIt++) {
+
+        const FileEntry * fe = sm.getFileEntryForID(*FileIt);
+        const clang::RewriteBuffer * rb = rw.getRewriteBufferFor(*FileIt);
 
+        if (fe && rb) {
+          Output->Add(fe->getName(), string(rb->begin(), rb->end()));
+        }
 
+      }
 
     }
 
+    return;
+
+  }
+
+  for (CIit = files.begin(); CIit != files.end(); CIit++) {
+
+    CompilerInstance &CI = *(CIit->first);
+    Rewriter &rw = globals::GetRewriter(CI);
+
+    rw.overwriteChangedFiles();
+
   }
 
 }
 
 void DirectiveHandler::SetParentMap(Stmt * s) {
 
+  delete PM;
   PM = new ParentMap(s);
 
 }
@@ -120,11 +158,55 @@ void DirectiveHandler::HandleStackItem(PragmaDirectiveMap *Directives,
   }
 
   SetParentMap(SI->S);
+
+  CurrentPlan = &Plans[SI];
   
   TraverseStmt(SI->S);
 
+  CurrentPlan = NULL;
+
+  PlanOptimizer Optimizer(*Directives, *PM, *SI->CI);
+
+  EliminateCovered(SI, Optimizer);
+  HoistInvariantReads(SI, Optimizer);
+  SummarizeRanges(SI, Optimizer);
+  FindIndependentArrays(SI, Optimizer);
+
+  delete PM;
+  PM = NULL;
+
+}
+
+void DirectiveHandler::RewriteStackItem(StackItem *SI) {
+
+  vector<LoopChunk> &LoopChunks = Chunks[SI];
+  vector<LoopChunk>::iterator ChunkIt;
+
+  // Ahead of the ranges, which are inserted after them
+  for (ChunkIt = LoopChunks.begin(); ChunkIt != LoopChunks.end(); ChunkIt++) {
+
+    PragmaDirective * D = ChunkIt->Directive;
+
+    InsertText(*ChunkIt->CI, D->Range.getBegin(), ChunkIt->Setup, true,
+               RegionEdit);
+    InsertText(*ChunkIt->CI, D->MainConstruct.Range.getEnd(),
+               ChunkIt->Schedule, true, RegionEdit);
+
+  }
+
+  vector<AccessPoint> &Plan = Plans[SI];
+  vector<AccessPoint>::iterator PointIt;
+
+  for (PointIt = Plan.begin(); PointIt != Plan.end(); PointIt++) {
+    RewriteAccess(*PointIt);
+  }
+
   InsertCacheAssignments(SI);
 
+  if (SI->TYPE == StackItem::FullDirectiveType) {
+    InsertPrivateClause((FullDirective *) SI);
+  }
+
   SourceManager &sm = SI->CI->getSourceManager();
 
   map<CompilerInstance *, set<FileID> >::iterator CIit;
@@ -191,7 +273,7 @@ bool DirectiveHandler::VisitDeclRefExpr(DeclRefExpr *S) {
 
   vector<StmtPair> WritePairs = GenerateWritePairs(Base, Parent, Top);
   
-  WalkUpExpr(S, Var, WritePairs, true, string());
+  WalkUpExpr(S, Var, WritePairs, true, typepaths::EmptyPath);
   
   return true;
   
@@ -364,7 +446,7 @@ Stmt * DirectiveHandler::getParent(Stmt * Base) {
      case Stmt::ContinueStmtClass:
      case Stmt::NullStmtClass:
      default:
-      llvm::errs() << "Warning; Unexpected Parent Stmt Type\n";
+      logging::Out() << "Warning; Unexpected Parent Stmt Type\n";
     }
 
   }
@@ -393,7 +475,7 @@ vector<StmtPair> DirectiveHandler::GenerateWritePairs(Stmt * Base,
      case Stmt::SwitchStmtClass:
       return GenerateWritePairs(Base, dyn_cast<SwitchStmt>(Parent), Top);
      default:
-      llvm::errs() << "Error; Unexpected Parent Stmt Type\n";
+      logging::Out() << "Error; Unexpected Parent Stmt Type\n";
       return vector<StmtPair>();
     }
   } else {
@@ -587,7 +669,7 @@ void DirectiveHandler::WalkUpExpr(DeclRefExpr * Original,
                                   Expr * Var,
                                   vector<StmtPair> WritePairs,
                                   bool ActualVar,
-                                  string Struct) {
+                                  TypePath Struct) {
 
   Expr * Next = GetRelevantParent(Var, PM);
 
@@ -638,7 +720,7 @@ void DirectiveHandler::HandleBinaryOperator(DeclRefExpr * Original,
                                             Expr * Next,
                                             vector<StmtPair> WritePairs,
                                             bool ActualVar,
-                                            string Struct) {
+                                            TypePath Struct) {
 
   BinaryOperator * BO = cast<BinaryOperator>(Next);
   
@@ -680,7 +762,7 @@ void DirectiveHandler::HandleUnaryOperator(DeclRefExpr * Original,
                                            Expr * Next,
                                            vector<StmtPair> WritePairs,
                                            bool ActualVar,
-                                           string Struct) {
+                                           TypePath Struct) {
 
   UnaryOperator * UO = dyn_cast<UnaryOperator>(Next);
 
@@ -715,7 +797,7 @@ void DirectiveHandler::HandleArraySubscriptExpr(DeclRefExpr * Original,
                                                 Expr * Next,
                                                 vector<StmtPair> WritePairs,
                                                 bool ActualVar,
-                                                string Struct) {
+                                                TypePath Struct) {
 
   CompilerInstance &CI = FullDirectives->GetCI(Original->getLocStart());
 
@@ -738,16 +820,18 @@ void DirectiveHandler::HandleMemberExpr(DeclRefExpr * Original,
                                         Expr * Next,
                                         vector<StmtPair> WritePairs,
                                         bool ActualVar,
-                                        string Struct) {
+                                        TypePath Struct) {
 
   MemberExpr * Member = dyn_cast<MemberExpr>(Next);
 
   if (Member->isArrow()) {
-    llvm::errs() << "Inserting Arrow Access\n";
+    if (logging::Enabled(logging::Debug)) {
+      logging::Out() << "Inserting Arrow Access\n";
+    }
     InsertAccess(Var, Original, false, WritePairs, ActualVar, Struct);
   }
 
-  Struct = GetType(Member);
+  Struct = typepaths::GetStub(Member);
 
   WalkUpExpr(Original, Member, WritePairs, ActualVar, Struct);
 
@@ -760,18 +844,14 @@ void DirectiveHandler::InsertAccess(Expr * Current,
                                     bool Write,
                                     vector<StmtPair> WritePairs,
                                     bool ActualVar,
-                                    string Struct) {
+                                    TypePath Struct) {
 
   if (!ActualVar) return;
   
   const Type * T = Current->getType().getTypePtr();
   
   if (FullDirectives->IsPrivate(Original, Struct, T, Original->getLocStart())) {
-    return;
-  }
-
-  // Insert check to determine if a variable is read only.
-  if (FullDirectives->IsReadOnly(globals::GetNamedDecl(dyn_cast<VarDecl>(Original->getFoundDecl())))) {
+    stats::Increment(stats::PrivateCounter);
     return;
   }
 
@@ -780,115 +860,569 @@ void DirectiveHandler::InsertAccess(Expr * Current,
   CompilerInstance &CI = FullDirectives->GetCI(Current->getLocStart());
 
   for (it = WritePairs.begin(); it != WritePairs.end(); it++) {
-  
-    bool insertAfter = it->insertAfter;
-    Stmt * curStmt = it->stmt;
-    Stmt * cmpStmt = dyn_cast<CompoundStmt>(curStmt);
-    Stmt * parStmt = PM->getParent(curStmt);
-    Stmt * stmtParent = NULL;
-    if (parStmt) {
-      stmtParent = dyn_cast<CompoundStmt>(parStmt);
+
+    AccessPoint Point;
+    SetPointLocation(Point, it->stmt, it->insertAfter, CI);
+
+    if (GetOrSetAccessed(Point.Loc, Current, Write, CI)) {
+      stats::Increment(stats::DuplicateCounter);
+      continue;
     }
 
-    bool isBracket = false;
+    FullDirectives->InsertDeclAccess(Original->getFoundDecl(), Write);
 
-    SourceLocation start = curStmt->getLocStart();
-    SourceLocation end = FindSemiAfterLocation(curStmt->getLocEnd(),
-                                               CI.getASTContext());
+    Point.Write = Write;
+    Point.Original = Original;
+    Point.Current = Current;
+    Point.Root = FullDirectives->GetRootItem();
+    Point.CI = &CI;
 
-    if (end.isInvalid()) {
-      end = curStmt->getLocEnd();
-      isBracket = true;
-    }
+    CurrentPlan->push_back(Point);
     
-    SourceLocation loc;
-    
-    if (insertAfter) {
-      if (isBracket) {
-        loc = end;
-      } else {
-        loc = end.getLocWithOffset(1);
+  }
+
+}
+
+// Private
+void DirectiveHandler::SetPointLocation(AccessPoint &Point,
+                                        Stmt * curStmt,
+                                        bool insertAfter,
+                                        CompilerInstance &CI) {
+
+  Stmt * cmpStmt = dyn_cast<CompoundStmt>(curStmt);
+  Stmt * parStmt = PM->getParent(curStmt);
+  Stmt * stmtParent = NULL;
+  if (parStmt) {
+    stmtParent = dyn_cast<CompoundStmt>(parStmt);
+  }
+
+  bool isBracket = false;
+
+  SourceLocation start = curStmt->getLocStart();
+  SourceLocation end = FindSemiAfterLocation(curStmt->getLocEnd(),
+                                             CI.getASTContext());
+
+  if (end.isInvalid()) {
+    end = curStmt->getLocEnd();
+    isBracket = true;
+  }
+  
+  SourceLocation loc;
+  
+  if (insertAfter) {
+    if (isBracket) {
+      loc = end;
+    } else {
+      loc = end.getLocWithOffset(1);
+    }
+  } else {
+    loc = start;
+  }
+
+  Point.Loc = tools::UnpackMacroLoc(loc, CI);
+  Point.InsertAfter = insertAfter;
+  Point.Site = curStmt;
+  Point.BracketRange = SourceRange(start, end);
+  Point.NeedsBrackets = !cmpStmt && !stmtParent;
+
+}
+
+// Private
+void DirectiveHandler::EliminateCovered(StackItem *SI,
+                                        PlanOptimizer &Optimizer) {
+
+  vector<AccessPoint> &Plan = Plans[SI];
+  vector<AccessPoint> Optimized;
+
+  // Points grouped on the hash of their expression's profile
+  vector<llvm::FoldingSetNodeID> Profiles(Plan.size());
+  map<unsigned, vector<unsigned> > Groups;
+
+  for (unsigned i = 0; i < Plan.size(); i++) {
+    Plan[i].Current->Profile(Profiles[i], Plan[i].CI->getASTContext(), true);
+    Groups[Profiles[i].ComputeHash()].push_back(i);
+  }
+
+  for (unsigned i = 0; i < Plan.size(); i++) {
+
+    AccessPoint &Point = Plan[i];
+    vector<unsigned> &Group = Groups[Profiles[i].ComputeHash()];
+    bool Covered = false;
+
+    for (unsigned j = 0; !Covered && j < Group.size(); j++) {
+
+      AccessPoint &Earlier = Plan[Group[j]];
+
+      // Anything tracked after its statement could be skipped by a jump out
+      // of it, and a write covers a read of the same address but not the
+      // other way around
+      if (Group[j] == i
+          || Point.InsertAfter
+          || Earlier.InsertAfter
+          || (Point.Write && !Earlier.Write)) {
+        continue;
       }
+
+      Covered = Profiles[Group[j]] == Profiles[i]
+                && Optimizer.IsCovered(Earlier.Site,
+                                       Point.Site,
+                                       Point.Current,
+                                       SI->S);
+
+    }
+
+    if (Covered) {
+      stats::Increment(stats::CoveredCounter);
     } else {
-      loc = start;
+      Optimized.push_back(Point);
     }
-    
-    loc = tools::UnpackMacroLoc(loc, CI);
 
-    if (GetOrSetAccessed(loc, Current, Write)) {
+  }
+
+  Plan.swap(Optimized);
+
+}
+
+// Private
+void DirectiveHandler::HoistInvariantReads(StackItem *SI,
+                                           PlanOptimizer &Optimizer) {
+
+  vector<AccessPoint> &Plan = Plans[SI];
+  vector<AccessPoint> Optimized;
+  vector<AccessPoint>::iterator PointIt;
+
+  for (PointIt = Plan.begin(); PointIt != Plan.end(); PointIt++) {
+
+    Stmt * Loop = NULL;
+
+    if (!PointIt->Write && PointIt->Current == PointIt->Original) {
+      Loop = Optimizer.GetHoistTarget(PointIt->Original, SI->S);
+    }
+
+    if (!Loop) {
+      Optimized.push_back(*PointIt);
       continue;
     }
 
-    FullDirectives->InsertDeclAccess(Original->getFoundDecl(), Write);
+    stats::Increment(stats::HoistedCounter);
 
-    stringstream ss;
-    ss <<  "SPEC";
-    if (Write) {
-      ss << "WRITE(";
-    } else {
-      ss << "READ(";
+    AccessPoint Point = *PointIt;
+    SetPointLocation(Point, Loop, false, *Point.CI);
+
+    // Every read of it in the loop ends up here, so only the first is kept
+    if (!GetOrSetAccessed(Point.Loc, Point.Current, false, *Point.CI)) {
+      Optimized.push_back(Point);
     }
-    
-    DeclRefExpr * dre = dyn_cast<DeclRefExpr>(Original);
-    ss << dre->getNameInfo().getName().getAsString() << ", ";
-    ss << GetStmtString(Current);
 
-    ss << ");\n";
-    
-    Rewriter &rw = globals::GetRewriter(CI);
+  }
+
+  Plan.swap(Optimized);
+
+}
+
+// Private
+void DirectiveHandler::SummarizeRanges(StackItem *SI,
+                                       PlanOptimizer &Optimizer) {
+
+  PragmaDirective * RootDirective = NULL;
+
+  if (FullDirective::ClassOf(SI)) {
+    RootDirective = ((FullDirective *) SI)->Directive;
+  }
 
-    rw.InsertText(loc, StringRef(ss.str()), !insertAfter, true);
+  vector<AccessPoint> &Plan = Plans[SI];
+  vector<AccessPoint> Optimized;
+  vector<AccessPoint>::iterator PointIt;
+
+  map<PragmaDirective *, unsigned> ChunkIds;
+  set<pair<bool, string> > Summarized;
+
+  for (PointIt = Plan.begin(); PointIt != Plan.end(); PointIt++) {
+
+    ArraySubscriptExpr * Access
+        = dyn_cast<ArraySubscriptExpr>(PointIt->Current);
+    PragmaDirective * Directive = NULL;
+    CanonicalLoop * Canonical = NULL;
+    AffineIndex Index;
+
+    // Only the element itself, not something reached through it
+    if (!Access
+        || Access->getBase()->IgnoreParenImpCasts() != PointIt->Original
+        || !Optimizer.GetChunkRange(Access,
+                                    SI->S,
+                                    RootDirective,
+                                    Directive,
+                                    Canonical,
+                                    Index)) {
+      Optimized.push_back(*PointIt);
+      continue;
+    }
+
+    stats::Increment(stats::SummarizedCounter);
 
-    if (!cmpStmt && !stmtParent) {
-      SourceRange range(start, end);
-      InsertBrackets(range);
+    map<PragmaDirective *, unsigned>::iterator ChunkIt;
+    ChunkIt = ChunkIds.find(Directive);
+
+    if (ChunkIt == ChunkIds.end()) {
+      ChunkIt = ChunkIds.insert(make_pair(Directive, NumChunks++)).first;
+      Chunks[SI].push_back(CreateLoopChunk(Directive,
+                                           *Canonical,
+                                           ChunkIt->second,
+                                           *PointIt->CI));
     }
-    
+
+    AccessPoint Point = *PointIt;
+    Point.Loc = Directive->Range.getBegin();
+    Point.InsertAfter = false;
+    Point.NeedsBrackets = false;
+    Point.Range = GetChunkRange(*Canonical, Index, ChunkIt->second);
+
+    string Key = Point.Original->getNameInfo().getName().getAsString()
+                 + ", " + Point.Range;
+
+    if (Summarized.insert(make_pair(Point.Write, Key)).second) {
+      Optimized.push_back(Point);
+    }
+
   }
 
+  Plan.swap(Optimized);
+
 }
 
-bool DirectiveHandler::GetOrSetAccessed(SourceLocation Loc,
-                                       Expr * Current,
-                                       bool Write) {
+// Private
+void DirectiveHandler::FindIndependentArrays(StackItem *SI,
+                                             PlanOptimizer &Optimizer) {
 
-    SourceLocationMultimap::iterator it;
-    pair<SourceLocationMultimap::iterator,SourceLocationMultimap::iterator> ret;
-    string CurrentStr = GetStmtString(Current);
-    
-    if (Write) {
-      ret = WriteLocs.equal_range(Loc);
-    } else {
-      ret = ReadLocs.equal_range(Loc);
+  // A function can be called from any number of iterations
+  if (!FullDirective::ClassOf(SI)) {
+    return;
+  }
+
+  PragmaDirective * RootDirective = ((FullDirective *) SI)->Directive;
+
+  vector<AccessPoint> &Plan = Plans[SI];
+  vector<AccessPoint>::iterator PointIt;
+
+  map<NamedDecl *, ArrayAccesses> Arrays;
+
+  for (PointIt = Plan.begin(); PointIt != Plan.end(); PointIt++) {
+
+    NamedDecl * D = dyn_cast<VarDecl>(PointIt->Original->getFoundDecl());
+    D = globals::GetNamedDecl(D);
+
+    map<NamedDecl *, ArrayAccesses>::iterator ArrayIt = Arrays.find(D);
+
+    if (ArrayIt == Arrays.end()) {
+      ArrayAccesses Accesses;
+      Accesses.Loop = NULL;
+      Accesses.Rejected = false;
+      ArrayIt = Arrays.insert(make_pair(D, Accesses)).first;
     }
-    
-    for (it = ret.first; it != ret.second; it++) {
-      if (it->second == CurrentStr) {
-        return true;
+
+    ArrayAccesses &Accesses = ArrayIt->second;
+
+    if (Accesses.Rejected) {
+      continue;
+    }
+
+    ArraySubscriptExpr * Access
+        = dyn_cast<ArraySubscriptExpr>(PointIt->Current);
+
+    if (Access
+        && Access->getBase()->IgnoreParenImpCasts() == PointIt->Original) {
+
+      ForStmt * Loop = NULL;
+      AffineIndex Index;
+
+      if (!Optimizer.GetLoopIndex(Access, SI->S, RootDirective, Loop, Index)
+          || (Accesses.Loop && Accesses.Loop != Loop)) {
+        Accesses.Rejected = true;
+        continue;
       }
+
+      Accesses.Loop = Loop;
+      Accesses.Indices.push_back(make_pair(PointIt->Write, Index));
+
+    } else if (PointIt->Write
+               || PointIt->Current->IgnoreParenImpCasts()
+                  != PointIt->Original) {
+
+      // Reading the pointer itself is fine, as nothing writes it
+      Accesses.Rejected = true;
+
     }
-    
-    if (Write) {
-      WriteLocs.insert(make_pair(Loc, CurrentStr));
+
+  }
+
+  map<NamedDecl *, ArrayAccesses>::iterator ArrayIt;
+
+  for (ArrayIt = Arrays.begin(); ArrayIt != Arrays.end(); ArrayIt++) {
+
+    ArrayAccesses &Accesses = ArrayIt->second;
+
+    if (Accesses.Rejected || !Accesses.Loop) {
+      continue;
+    }
+
+    // Only a write can conflict, with any access, itself included
+    bool Independent = true;
+
+    for (unsigned i = 0; Independent && i < Accesses.Indices.size(); i++) {
+
+      if (!Accesses.Indices[i].first) {
+        continue;
+      }
+
+      for (unsigned j = 0; Independent && j < Accesses.Indices.size(); j++) {
+        Independent = !Optimizer.MayDepend(Accesses.Indices[i].second,
+                                           Accesses.Indices[j].second);
+      }
+
+    }
+
+    if (Independent) {
+
+      SI->IndependentDecls.set(globals::GetDeclId(ArrayIt->first));
+
+      if (logging::Enabled(logging::Debug)) {
+        logging::Out() << "\tIndependent: "
+                       << ArrayIt->first->getNameAsString() << "\n";
+      }
+
+    }
+
+  }
+
+}
+
+// Private
+LoopChunk DirectiveHandler::CreateLoopChunk(PragmaDirective * Directive,
+                                            CanonicalLoop &Canonical,
+                                            unsigned ChunkId,
+                                            CompilerInstance &CI) {
+
+  stringstream Id;
+  Id << ChunkId;
+
+  string Trips = "__spec_trips" + Id.str();
+  string Chunk = "__spec_chunk" + Id.str();
+  string Lo = "__spec_lo" + Id.str();
+  string Hi = "__spec_hi" + Id.str();
+
+  // A static schedule with one chunk per thread, handed out in thread order,
+  // so thread t runs iterations [t * chunk, (t + 1) * chunk)
+  stringstream Setup;
+
+  Setup << "long " << Trips << " = ((" << Canonical.End << ") - ("
+        << Canonical.Begin << ")";
+
+  if (Canonical.Step == 1) {
+    Setup << ");\n";
+  } else {
+    Setup << " + " << Canonical.Step - 1 << ") / " << Canonical.Step << ";\n";
+  }
+
+  Setup << "long " << Chunk << " = " << Trips << " > 0 ? (" << Trips
+        << " + omp_get_num_threads() - 1) / omp_get_num_threads() : 1;\n";
+  Setup << "long " << Lo << " = omp_get_thread_num() * " << Chunk << ";\n";
+  Setup << "long " << Hi << " = " << Lo << " + " << Chunk << " < " << Trips
+        << " ? " << Lo << " + " << Chunk << " : " << Trips << ";\n";
+
+  LoopChunk Result;
+  Result.Directive = Directive;
+  Result.Setup = Setup.str();
+  Result.Schedule = " schedule(static, " + Chunk + ")";
+  Result.CI = &CI;
+
+  return Result;
+
+}
+
+// Private
+string DirectiveHandler::GetChunkRange(CanonicalLoop &Canonical,
+                                       AffineIndex &Index,
+                                       unsigned ChunkId) {
+
+  stringstream Range;
+  const char * Bounds[] = { "__spec_lo", "__spec_hi" };
+
+  // The element touched on iteration n is
+  //   Scale * (Begin + n * Step) + Offset
+  for (unsigned i = 0; i < 2; i++) {
+
+    stringstream Induction;
+    Induction << "(" << Canonical.Begin << ") + " << Bounds[i] << ChunkId;
+
+    if (Canonical.Step != 1) {
+      Induction << " * " << Canonical.Step;
+    }
+
+    if (Index.Scale == 1) {
+      Range << Induction.str();
     } else {
-      ReadLocs.insert(make_pair(Loc, CurrentStr));      
+      Range << Index.Scale << " * (" << Induction.str() << ")";
+    }
+
+    if (Index.Offset != "0") {
+      Range << " + (" << Index.Offset << ")";
+    }
+
+    Range << ", ";
+
+  }
+
+  Range << Index.Scale * Canonical.Step;
+
+  return Range.str();
+
+}
+
+void DirectiveHandler::RewriteAccess(AccessPoint &Point) {
+
+  // Insert check to determine if a variable is read only.
+  NamedDecl * D = dyn_cast<VarDecl>(Point.Original->getFoundDecl());
+  D = globals::GetNamedDecl(D);
+
+  if (Point.Root->ReadOnlyDecls.test(globals::GetDeclId(D))) {
+    stats::Increment(stats::ReadOnlyCounter);
+    return;
+  }
+
+  if (Point.Root->IndependentDecls.test(globals::GetDeclId(D))) {
+    stats::Increment(stats::IndependentCounter);
+    return;
+  }
+
+  stats::Increment(stats::InstrumentedCounter);
+
+  PlanEdit Access;
+  Access.Kind = AccessEdit;
+  Access.InsertAfter = !Point.InsertAfter;
+  Access.Decl = Point.Original->getNameInfo().getName().getAsString();
+  Access.Write = Point.Write;
+  Access.Range = !Point.Range.empty();
+
+  if (Access.Range) {
+    Access.Expr = Point.Range;
+  } else {
+    Access.Expr = tools::GetStmtString(Point.Current, *Point.CI);
+  }
+
+  InsertEdit(*Point.CI, Point.Loc, Access);
+
+  if (Point.NeedsBrackets) {
+    InsertBrackets(Point.BracketRange, Point.CI);
+  }
+
+}
+
+bool DirectiveHandler::GetOrSetAccessed(SourceLocation Loc,
+                                        Expr * Current,
+                                        bool Write,
+                                        CompilerInstance &CI) {
+
+    llvm::FoldingSetNodeID ID;
+    Current->Profile(ID, CI.getASTContext(), true);
+
+    AccessSet &Accessed = Write ? WriteLocs : ReadLocs;
+    vector<llvm::FoldingSetNodeID> &Bucket
+        = Accessed[make_pair(Loc.getRawEncoding(), ID.ComputeHash())];
+
+    vector<llvm::FoldingSetNodeID>::iterator it;
+
+    for (it = Bucket.begin(); it != Bucket.end(); it++) {
+      if (*it == ID) {
+        return true;
+      }
     }
+
+    Bucket.push_back(ID);
     
     return false;
 
 }
 
-string DirectiveHandler::GetStmtString(Stmt * Current) {
+void DirectiveHandler::InsertText(CompilerInstance &CI,
+                                  SourceLocation Loc,
+                                  StringRef Text,
+                                  bool InsertAfter,
+                                  PlanEditKind Kind,
+                                  bool IndentNewLines) {
+
+  PlanEdit Edit;
+  Edit.Kind = Kind;
+  Edit.Text = Text;
+  Edit.InsertAfter = InsertAfter;
+  Edit.IndentNewLines = IndentNewLines;
+
+  InsertEdit(CI, Loc, Edit);
+
+}
+
+void DirectiveHandler::InsertEdit(CompilerInstance &CI,
+                                  SourceLocation Loc,
+                                  const PlanEdit &Edit,
+                                  int Tables) {
 
-    string SStr;
-    llvm::raw_string_ostream S(SStr);
+  if (Edits) {
+    Edits->RecordInsert(CI, Loc, Edit);
+  }
+
+  Rewriter &rw = globals::GetRewriter(CI);
+  rw.InsertText(Loc,
+                RewritePlan::Render(Edit, Tables),
+                Edit.InsertAfter,
+                Edit.IndentNewLines);
+
+}
 
-    CompilerInstance &CI = FullDirectives->GetCI(Current->getLocStart());
+void DirectiveHandler::InsertCheck(CompilerInstance &CI,
+                                   SourceLocation Loc,
+                                   bool InsertAfter) {
 
-    NoEditStmtPrinter P(S, 0, PrintingPolicy(CI.getLangOpts()), 0);
-    P.Visit(const_cast<Stmt*>(cast<Stmt>(Current)));
+  PlanEdit Check;
+  Check.Kind = CheckEdit;
+  Check.InsertAfter = InsertAfter;
 
-    return S.str();
+  InsertEdit(CI, Loc, Check);
+
+}
+
+PlanEdit DirectiveHandler::GetCacheInit(DeclSet &Reads,
+                                        DeclSet &Writes,
+                                        bool Leading) {
+
+  PlanEdit CacheInit;
+  CacheInit.Kind = CacheInitEdit;
+  CacheInit.Leading = Leading;
+
+  DeclSet::iterator DeclIt;
+
+  for (DeclIt = Reads.begin(); DeclIt != Reads.end(); DeclIt++) {
+    NamedDecl * D = globals::GetDeclFromId(*DeclIt);
+    CacheInit.Reads.push_back(D->getNameAsString());
+  }
+
+  for (DeclIt = Writes.begin(); DeclIt != Writes.end(); DeclIt++) {
+    NamedDecl * D = globals::GetDeclFromId(*DeclIt);
+    CacheInit.Writes.push_back(D->getNameAsString());
+  }
+
+  return CacheInit;
+
+}
+
+void DirectiveHandler::RemoveText(CompilerInstance &CI,
+                                  SourceRange Range,
+                                  PlanEditKind Kind) {
+
+  if (Edits) {
+    Edits->RecordRemove(CI, Range, Kind);
+  }
+
+  Rewriter &rw = globals::GetRewriter(CI);
+  rw.RemoveText(Range);
 
 }
 
@@ -903,10 +1437,13 @@ void DirectiveHandler::InsertBrackets(SourceRange StmtRange, CompilerInstance *C
   BracketLocs.insert(StmtRange);
   
   if (!CI) CI = &FullDirectives->GetCI(StmtRange.getBegin());
-  Rewriter &rw = globals::GetRewriter(*CI);
 
-  rw.InsertText(StmtRange.getBegin(), "{\n", false, true);
-  rw.InsertText(StmtRange.getEnd().getLocWithOffset(1), "\n}\n", true, true);
+  InsertText(*CI, StmtRange.getBegin(), "{\n", false, BracketEdit);
+  InsertText(*CI,
+             StmtRange.getEnd().getLocWithOffset(1),
+             "\n}\n",
+             true,
+             BracketEdit);
   
 }
 
@@ -933,43 +1470,30 @@ void DirectiveHandler::InsertCacheAssignments(FullDirective * FD) {
 
   assert(FD->Directive->Parallel);
 
-  Rewriter &rw = globals::GetRewriter(*(FD->CI));
-
   if (FD->Directive->MainConstruct.Type == ForConstruct) {
 
-    stringstream ss;
-
-    set<NamedDecl *>::iterator DeclIt;
-
-    for (DeclIt = FD->ReadDecls.begin();
-         DeclIt != FD->ReadDecls.end();
-         DeclIt++) {
+    DeclSet Reads(FD->ReadDecls);
+    Reads.intersectWithComplement(FD->ReadOnlyDecls);
+    Reads.intersectWithComplement(FD->IndependentDecls);
 
-      if (FD->ReadOnlyDecls.find(*DeclIt) == FD->ReadOnlyDecls.end()) {
-        ss <<  "SPECREADINIT(" << (*DeclIt)->getNameAsString() << ");\n";
-      }
-    }
-
-    for (DeclIt = FD->WriteDecls.begin();
-         DeclIt != FD->WriteDecls.end();
-         DeclIt++) {
-      ss <<  "SPECWRITEINIT(" << (*DeclIt)->getNameAsString() << ");\n";
-    }
+    DeclSet Writes(FD->WriteDecls);
+    Writes.intersectWithComplement(FD->IndependentDecls);
 
-    rw.InsertText(FD->Directive->Range.getBegin(), StringRef(ss.str()), false, true);
+    InsertEdit(*(FD->CI), FD->Directive->Range.getBegin(),
+               GetCacheInit(Reads, Writes, false));
 
     StringRef swstop("stopParallelExe();\n");
 
 
     InsertBrackets(SourceRange(FD->Directive->Range.getBegin(), FD->S->getLocEnd()), FD->CI);
-    rw.InsertText(FD->S->getLocEnd().getLocWithOffset(1), swstop, true, true);
+    InsertText(*(FD->CI), FD->S->getLocEnd().getLocWithOffset(1), swstop, true, RegionEdit);
 
     stringstream ss2;
 
     ss2 << "#pragma omp parallel\n";
 
-    rw.InsertText(FD->Directive->Range.getBegin(),StringRef(ss2.str()), false, true);
-    rw.RemoveText(FD->Directive->ParaConstruct.Range);
+    InsertText(*(FD->CI), FD->Directive->Range.getBegin(),StringRef(ss2.str()), false, RegionEdit);
+    RemoveText(*(FD->CI), FD->Directive->ParaConstruct.Range, RegionEdit);
 
 
 
@@ -984,63 +1508,38 @@ void DirectiveHandler::InsertCacheAssignments(FullDirective * FD) {
       SourceLocation End = FindSemiAfterLocation(FD->S->getLocEnd(),
                                                  FD->CI->getASTContext());
 
-      stringstream ss;
+      DeclSet Reads(FD->ReadDecls);
+      Reads.intersectWithComplement(FD->ReadOnlyDecls);
+      Reads.intersectWithComplement(FD->IndependentDecls);
 
-      set<NamedDecl *>::iterator DeclIt;
+      DeclSet Writes(FD->WriteDecls);
+      Writes.intersectWithComplement(FD->IndependentDecls);
 
-      for (DeclIt = FD->ReadDecls.begin();
-           DeclIt != FD->ReadDecls.end();
-           DeclIt++) {
-
-        if (FD->ReadOnlyDecls.find(*DeclIt) == FD->ReadOnlyDecls.end()) {
-          ss <<  "SPECREADINIT(" << (*DeclIt)->getNameAsString() << ");\n";
-        }
-
-      }
-
-      for (DeclIt = FD->WriteDecls.begin();
-           DeclIt != FD->WriteDecls.end();
-           DeclIt++) {
-        ss <<  "SPECWRITEINIT(" << (*DeclIt)->getNameAsString() << ");\n";
-      }
-
-      rw.InsertText(Begin, StringRef(ss.str()), false, true);
-      rw.InsertText(Begin, "{\n", false, true);
+      InsertEdit(*(FD->CI), Begin, GetCacheInit(Reads, Writes, false));
+      InsertText(*(FD->CI), Begin, "{\n", false, RegionEdit);
 
       StringRef swstop("\nstopParallelExe();");
 
-      rw.InsertText(FD->S->getLocEnd().getLocWithOffset(1), swstop, false, true);
+      InsertText(*(FD->CI), FD->S->getLocEnd().getLocWithOffset(1), swstop, false, RegionEdit);
 
-      rw.InsertText(End.getLocWithOffset(1), "\n}\n", true, true);
+      InsertText(*(FD->CI), End.getLocWithOffset(1), "\n}\n", true, RegionEdit);
 
 
     } else {
 
-      stringstream ss;
-
-      set<NamedDecl *>::iterator DeclIt;
-
-      for (DeclIt = FD->ReadDecls.begin();
-           DeclIt != FD->ReadDecls.end();
-           DeclIt++) {
-
-        if (FD->ReadOnlyDecls.find(*DeclIt) == FD->ReadOnlyDecls.end()) {
-          ss <<  "\nSPECREADINIT(" << (*DeclIt)->getNameAsString() << ");";
-        }
+      DeclSet Reads(FD->ReadDecls);
+      Reads.intersectWithComplement(FD->ReadOnlyDecls);
+      Reads.intersectWithComplement(FD->IndependentDecls);
 
-      }
+      DeclSet Writes(FD->WriteDecls);
+      Writes.intersectWithComplement(FD->IndependentDecls);
 
-      for (DeclIt = FD->WriteDecls.begin();
-           DeclIt != FD->WriteDecls.end();
-           DeclIt++) {
-        ss <<  "\nSPECWRITEINIT(" << (*DeclIt)->getNameAsString() << ");";
-      }
-
-      rw.InsertText(FD->S->getLocStart().getLocWithOffset(1), StringRef(ss.str()), false, true);
+      InsertEdit(*(FD->CI), FD->S->getLocStart().getLocWithOffset(1),
+                 GetCacheInit(Reads, Writes, true));
 
       StringRef swstop("\nstopParallelExe();");
 
-      rw.InsertText(FD->S->getLocEnd().getLocWithOffset(1), swstop, false, true);
+      InsertText(*(FD->CI), FD->S->getLocEnd().getLocWithOffset(1), swstop, false, RegionEdit);
 
 
     }
@@ -1049,48 +1548,64 @@ void DirectiveHandler::InsertCacheAssignments(FullDirective * FD) {
 
   StringRef swstart("startParallelExe();\n");
 
-  rw.InsertText(FD->Header->getLBracLoc(), swstart, false, true);
+  InsertText(*(FD->CI), FD->Header->getLBracLoc(), swstart, false, RegionEdit);
 
 
 }
 
-void DirectiveHandler::InsertCacheAssignments(SpeculativeFunction * SF) {
+void DirectiveHandler::InsertPrivateClause(FullDirective * FD) {
 
-  Rewriter &rw = globals::GetRewriter(*(SF->CI));
-  CompoundStmt * S = dyn_cast<CompoundStmt>(SF->S);
-  assert(S);
+  if (FD->InferredPrivateDecls.empty()) {
+    return;
+  }
 
+  // The variables go untracked, so sharing them would be a race nothing
+  // checks for
   stringstream ss;
+  ss << " private(";
 
-  set<NamedDecl *>::iterator DeclIt;
+  vector<VarDecl *>::iterator DeclIt;
 
-  for (DeclIt = SF->ReadDecls.begin();
-       DeclIt != SF->ReadDecls.end();
+  for (DeclIt = FD->InferredPrivateDecls.begin();
+       DeclIt != FD->InferredPrivateDecls.end();
        DeclIt++) {
-    if (SF->ReadOnlyDecls.find(*DeclIt) == SF->ReadOnlyDecls.end()) {
-      ss <<  "\nSPECREADINIT(" << (*DeclIt)->getNameAsString() << ");";
+
+    if (DeclIt != FD->InferredPrivateDecls.begin()) {
+      ss << ", ";
     }
-  }
 
-  for (DeclIt = SF->WriteDecls.begin();
-       DeclIt != SF->WriteDecls.end();
-       DeclIt++) {
-    ss <<  "\nSPECWRITEINIT(" << (*DeclIt)->getNameAsString() << ");";
+    ss << (*DeclIt)->getNameAsString();
+
   }
 
-  rw.InsertText(S->getLBracLoc().getLocWithOffset(1), StringRef(ss.str()), false, true);
+  ss << ")";
+
+  InsertText(*(FD->CI), FD->Directive->MainConstruct.Range.getEnd(),
+             StringRef(ss.str()), true, RegionEdit);
+
+}
+
+void DirectiveHandler::InsertCacheAssignments(SpeculativeFunction * SF) {
+
+  CompoundStmt * S = dyn_cast<CompoundStmt>(SF->S);
+  assert(S);
+
+  DeclSet Reads(SF->ReadDecls);
+  Reads.intersectWithComplement(SF->ReadOnlyDecls);
+
+  InsertEdit(*(SF->CI), S->getLBracLoc().getLocWithOffset(1),
+             GetCacheInit(Reads, SF->WriteDecls, true));
 
   stringstream ss2;
-  ss2 << "releaseCaches(" << SF->ReadDecls.size() + SF->WriteDecls.size() - SF->ReadOnlyDecls.size() << ");\n";
+  ss2 << "releaseCaches(" << SF->ReadDecls.count() + SF->WriteDecls.count() - SF->ReadOnlyDecls.count() << ");\n";
 
-  rw.InsertText(S->getRBracLoc(), StringRef(ss2.str()), false, true);
+  InsertText(*(SF->CI), S->getRBracLoc(), StringRef(ss2.str()), false, RegionEdit);
 
 }
 
 void DirectiveHandler::InsertChecks(CompilerInstance &CI, PragmaDirectiveMap &Directives) {
 
   PragmaDirectiveMap::iterator DirIt;
-  Rewriter &rw = globals::GetRewriter(CI);
 
   map<PragmaDirective *, FullDirective *> AllDirectives
       = FullDirectives->getAllDirectives();
@@ -1118,30 +1633,30 @@ void DirectiveHandler::InsertChecks(CompilerInstance &CI, PragmaDirectiveMap &Di
 
     }
 
-    StringRef s("\ndetectDependences();\n");
-
-    llvm::errs() << "Found " << PragmaDirective::getConstructTypeString(D->MainConstruct.Type) << "\n";
+    if (logging::Enabled(logging::Verbose)) {
+      logging::Out() << "Found " << PragmaDirective::getConstructTypeString(D->MainConstruct.Type) << "\n";
+    }
 
     switch (D->MainConstruct.Type) {
 
      case ParallelConstruct:
       assert(FD);
-      rw.InsertText(End.getLocWithOffset(-1),s,false,true);
+      InsertCheck(CI, End.getLocWithOffset(-1), false);
       break;
      case ForConstruct:
       assert(FD);
       if (!D->isNowait()) {
-        rw.InsertText(End,s,false,true);
+        InsertCheck(CI, End, false);
       }
       break;
      case SingleConstruct:
       assert(FD);
       if (!D->isNowait()) {
-        rw.InsertText(End,s,true,true);
+        InsertCheck(CI, End, true);
       }
       break;
      case BarrierConstruct:
-      rw.InsertText(D->Range.getEnd(),s,true,true);
+      InsertCheck(CI, D->Range.getEnd(), true);
       break;
      // No barrier hence no need for check
      case MasterConstruct:
@@ -1168,22 +1683,26 @@ void DirectiveHandler::InsertInit() {
 
       FunctionDecl * TheFunc = *FuncIt;
       CompilerInstance &CI = *globals::GetCompilerInstance(TheFunc);
-      Rewriter &rw = globals::GetRewriter(CI);
 
       assert(TheFunc->hasBody());
 
       CompoundStmt * CS = cast<CompoundStmt>(TheFunc->getBody());
       assert(CS);
 
-      stringstream ss;
-      ss << "createTables(" << FullDirectives->getMaxCachesRequired() << ");\n";
+      int Tables = FullDirectives->getMaxCachesRequired();
+
+      if (Edits) {
+        Edits->SetTables(Tables);
+      }
 
-      StringRef s(ss.str());
+      PlanEdit CreateTables;
+      CreateTables.Kind = TablesEdit;
 
       StringRef s3("\nomp_set_num_threads(MAX_THREADS);\n");
 
-      rw.InsertText(CS->getLBracLoc().getLocWithOffset(1), s, false, true);
-      rw.InsertText(CS->getLBracLoc().getLocWithOffset(1), s3, false, true);
+      InsertEdit(CI, CS->getLBracLoc().getLocWithOffset(1), CreateTables,
+                 Tables);
+      InsertText(CI, CS->getLBracLoc().getLocWithOffset(1), s3, false, InitEdit);
 
       StringRef s2("printStats();\n"
                    "if (getDependenceCheckResult()) {\n"
@@ -1196,7 +1715,7 @@ void DirectiveHandler::InsertInit() {
                    "  printf(\"\\n No dependences detected\\n\");\n"
                    "}\n");
 
-      rw.InsertText(CS->getRBracLoc(), s2, false, true);
+      InsertText(CI, CS->getRBracLoc(), s2, false, InitEdit);
 
 
       break;
@@ -7,6 +7,11 @@
 #define _DIRECTIVEHANDLER_H_
 
 #include "Classes.h"
+#include "Globals.h"
+#include "LoopAnalysis.h"
+#include "OutputDirectory.h"
+#include "RewritePlan.h"
+#include "TypePaths.h"
 
 #include "clang/Basic/FileManager.h"
 #include "clang/Lex/Preprocessor.h"
@@ -19,6 +24,9 @@
 #include "clang/AST/ParentMap.h"
 #include "clang/Frontend/CompilerInstance.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/FoldingSet.h"
+
 using clang::ASTContext;
 using clang::RecursiveASTVisitor;
 using clang::Sema;
@@ -50,6 +58,45 @@ typedef struct {
   Stmt * stmt;
 } StmtPair;
 
+// A SPECREAD/SPECWRITE found while traversing a handler start point. Deciding
+// what is read-only needs every access first, so the traversal only records
+// these and they're rewritten afterwards.
+struct AccessPoint {
+  SourceLocation Loc;
+  bool InsertAfter;
+  bool Write;
+  DeclRefExpr * Original;
+  Expr * Current;
+  // The statement it's inserted before or after
+  Stmt * Site;
+  // The statement to wrap in brackets, if it isn't in a compound statement
+  SourceRange BracketRange;
+  bool NeedsBrackets;
+  // Whose read-only decls are skipped
+  StackItem * Root;
+  CompilerInstance * CI;
+  // When the point stands for the access on every iteration of an omp for
+  // loop this thread runs, "lo, hi, stride" over the elements it touches
+  string Range;
+};
+
+// The code in front of an omp for loop's directive working out which of its
+// iterations this thread runs, and the schedule that makes that so
+struct LoopChunk {
+  PragmaDirective * Directive;
+  string Setup;
+  string Schedule;
+  CompilerInstance * CI;
+};
+
+// Every access a start point makes to an array, while they're all to affine
+// indices on iterations of the same omp for loop
+struct ArrayAccesses {
+  ForStmt * Loop;
+  vector<pair<bool, AffineIndex> > Indices;
+  bool Rejected;
+};
+
 class DirectiveHandler
     : public RecursiveASTVisitor<DirectiveHandler> {
 
@@ -70,32 +117,96 @@ class DirectiveHandler
     }
   };
 
-  struct SourceLocationComp {
-    bool operator() (const SourceLocation &lhs, const SourceLocation &rhs) const {
-      return lhs.getRawEncoding() < rhs.getRawEncoding();
-    }
-  };
-
   typedef set<SourceRange, SourceRangeComp> SourceRangeSet;
-  typedef multimap<SourceLocation, string, SourceLocationComp> SourceLocationMultimap;
+
+  // Accesses already inserted, keyed on their location and the hash of their
+  // expression's profile. Each bucket holds the profiles themselves, so a
+  // hash collision can't drop an access.
+  typedef llvm::DenseMap<pair<unsigned, unsigned>,
+                         vector<llvm::FoldingSetNodeID> > AccessSet;
 
   SourceRangeSet BracketLocs;
-  SourceLocationMultimap ReadLocs;
-  SourceLocationMultimap WriteLocs;
+  AccessSet ReadLocs;
+  AccessSet WriteLocs;
   
   PragmaDirective * WaitingDirective;
   CompoundStmt * WaitingHeader;
 
+  map<StackItem *, vector<AccessPoint> > Plans;
+  vector<AccessPoint> * CurrentPlan;
+
+  map<StackItem *, vector<LoopChunk> > Chunks;
+  unsigned NumChunks;
+
+  // Where the edits are recorded, if they're also wanted as a plan file
+  RewritePlan * Edits;
+
+  void RewriteAccess(AccessPoint &Point);
+
+  // Where and how an access before or after S is inserted
+  void SetPointLocation(AccessPoint &Point,
+                        Stmt * S,
+                        bool InsertAfter,
+                        CompilerInstance &CI);
+
+  // Drops accesses whose address was already tracked ahead of a statement
+  // that always runs before theirs, with nothing in between changing it
+  void EliminateCovered(StackItem *SI, PlanOptimizer &Optimizer);
+
+  // Moves reads of variables that a loop never writes to before the loop,
+  // so they're tracked once rather than on every iteration
+  void HoistInvariantReads(StackItem *SI, PlanOptimizer &Optimizer);
+
+  // Replaces accesses to an affine index of an array on every iteration of
+  // an omp for loop with one range over the loop's iterations this thread
+  // runs, tracked before the loop starts
+  void SummarizeRanges(StackItem *SI, PlanOptimizer &Optimizer);
+
+  // Finds the arrays that no two iterations of an omp for loop can share an
+  // element of, and sets them in the start point's IndependentDecls.
+  // GenerateReadOnly still has to rule out them being reached some other way.
+  void FindIndependentArrays(StackItem *SI, PlanOptimizer &Optimizer);
+
+  LoopChunk CreateLoopChunk(PragmaDirective * Directive,
+                            CanonicalLoop &Canonical,
+                            unsigned ChunkId,
+                            CompilerInstance &CI);
+  string GetChunkRange(CanonicalLoop &Canonical,
+                       AffineIndex &Index,
+                       unsigned ChunkId);
+
+  void InsertText(CompilerInstance &CI,
+                  SourceLocation Loc,
+                  StringRef Text,
+                  bool InsertAfter,
+                  PlanEditKind Kind,
+                  bool IndentNewLines = true);
+  void RemoveText(CompilerInstance &CI, SourceRange Range, PlanEditKind Kind);
+
+  // Inserts the text Edit renders to, with Tables for createTables()
+  void InsertEdit(CompilerInstance &CI,
+                  SourceLocation Loc,
+                  const PlanEdit &Edit,
+                  int Tables = 0);
+  void InsertCheck(CompilerInstance &CI, SourceLocation Loc, bool InsertAfter);
+
+  PlanEdit GetCacheInit(DeclSet &Reads, DeclSet &Writes, bool Leading);
+
 
  public:
 
-  DirectiveHandler(DirectiveList *FullDirectives);
+  DirectiveHandler(DirectiveList *FullDirectives, RewritePlan *Edits = NULL);
 
-  void Finish();
+  // Outputs the rewritten files. They're added to Output when given one, and
+  // otherwise only overwritten when no plan is being recorded.
+  void Finish(OutputDirectory *Output = NULL);
   
   void SetParentMap(Stmt * s);
 
+  // Traverses FD once, recording its accesses into the DirectiveList and its
+  // plan. RewriteStackItem applies the plan, once GenerateReadOnly has run.
   void HandleStackItem(PragmaDirectiveMap *Directives, StackItem *FD);
+  void RewriteStackItem(StackItem *FD);
 
   bool VisitDeclStmt(DeclStmt *s);
   bool VisitDeclRefExpr(DeclRefExpr *e);
@@ -119,46 +230,47 @@ class DirectiveHandler
                   Expr * Var,
                   vector<StmtPair> WritePairs,
                   bool ActualVar,
-                  string Struct);
+                  TypePath Struct);
                   
   void HandleBinaryOperator(DeclRefExpr * Original,
                             Expr * Current,
                             Expr * Next,
                             vector<StmtPair> WritePairs,
                             bool ActualVar,
-                            string Struct);
+                            TypePath Struct);
   
   void HandleUnaryOperator(DeclRefExpr * Original,
                            Expr * Current,
                            Expr * Next,
                            vector<StmtPair> WritePairs,
                            bool ActualVar,
-                           string Struct);
+                           TypePath Struct);
   
   void HandleArraySubscriptExpr(DeclRefExpr * Original,
                                 Expr * Current,
                                 Expr * Next,
                                 vector<StmtPair> WritePairs,
                                 bool ActualVar,
-                                string Struct);
+                                TypePath Struct);
   
   void HandleMemberExpr(DeclRefExpr * Original,
                         Expr * Current,
                         Expr * Next,
                         vector<StmtPair> WritePairs,
                         bool ActualVar,
-                        string Struct);
+                        TypePath Struct);
 
   void InsertAccess(Expr * Current, 
                     DeclRefExpr * Original,
                     bool Write,
                     vector<StmtPair> WritePairs,
                     bool ActualVar,
-                    string Struct);
+                    TypePath Struct);
 
-  bool GetOrSetAccessed(SourceLocation Loc, Expr * Current, bool Write);
-  
-  string GetStmtString(Stmt * Current);
+  bool GetOrSetAccessed(SourceLocation Loc,
+                        Expr * Current,
+                        bool Write,
+                        CompilerInstance &CI);
 
   void InsertBrackets(SourceRange StmtRange, CompilerInstance *CI = 0);
 
@@ -166,6 +278,9 @@ class DirectiveHandler
   void InsertCacheAssignments(FullDirective * FD);
   void InsertCacheAssignments(SpeculativeFunction * SF);
 
+  // Declares the variables inferred to be private in FD's directive
+  void InsertPrivateClause(FullDirective * FD);
+
   void InsertChecks(CompilerInstance &CI, PragmaDirectiveMap &Directives);
   void InsertInit();
 
@@ -7,11 +7,15 @@
 #include "DeclTracker.h"
 #include "DirectiveList.h"
 #include "Globals.h"
+#include "Log.h"
 #include "PragmaDirective.h"
+#include "Statistics.h"
 #include "Tools.h"
 #include "VarTraverser.h"
 #include "NoEditStmtPrinter.h"
 
+#include <algorithm>
+
 using clang::dyn_cast;
 using clang::ForStmt;
 using clang::FieldDecl;
@@ -21,8 +25,7 @@ using clang::Qualifiers;
 using speculation::tools::FindLocationAfterSemi;
 using speculation::tools::GetChildRange;
 using speculation::tools::GetLocation;
-using speculation::tools::GetType;
-using speculation::tools::InsideRange;
+using speculation::tools::UnpackMacroLoc;
 using speculation::tools::IsChild;
 
 namespace speculation {
@@ -33,8 +36,18 @@ DirectiveList::DirectiveList(DeclTracker * TrackedVars)
     AllDirectives(),
     AllCalls(),
     AllSpeculativeFunctions(),
+    DirectiveAllocator(),
+    CallAllocator(),
+    SpecFunctionAllocator(),
     TopLevelDirectives(),
+    TopLevelByFunction(),
     CurrentDirectives(),
+    CurrentTraversal(NULL),
+    Readers(),
+    StaleTraversals(),
+    Summaries(),
+    Recordings(),
+    Operation(0),
     Changed(false) {
 
   assert(TrackedVars);
@@ -61,11 +74,13 @@ void DirectiveList::TrackDecl(VarDecl * VD, DeclMap &TrackedDecls) {
 
   do {
 
+    TypePath Path = typepaths::GetTypePath(typepaths::EmptyPath, T);
+
     // Do we really need to check that this type hasn't been added before?
-    TypeMap::iterator TypeIt = Types.find(GetType(T));
+    TypeMap::iterator TypeIt = Types.find(Path);
     
     if (TypeIt == Types.end()) {
-      Types.insert(make_pair(GetType(T), true));
+      Types.insert(make_pair(Path, true));
     }
     
     if (T->isPointerType()) {
@@ -75,9 +90,9 @@ void DirectiveList::TrackDecl(VarDecl * VD, DeclMap &TrackedDecls) {
     } else {
 
       if (T->isStructureType()) {
-        TrackStructDecl(GetType(T), T->getAsStructureType()->getDecl(), Types);
+        TrackStructDecl(Path, T->getAsStructureType()->getDecl(), Types);
       } else if (T->isUnionType()) {
-        TrackStructDecl(GetType(T), T->getAsUnionType()->getDecl(), Types);
+        TrackStructDecl(Path, T->getAsUnionType()->getDecl(), Types);
       }
 
       T = NULL;
@@ -89,7 +104,7 @@ void DirectiveList::TrackDecl(VarDecl * VD, DeclMap &TrackedDecls) {
 }
 
 // Private
-void DirectiveList::TrackStructDecl(string BaseType,
+void DirectiveList::TrackStructDecl(TypePath BaseType,
                                     const RecordDecl * RD,
                                     TypeMap &Types) {
 
@@ -103,21 +118,22 @@ void DirectiveList::TrackStructDecl(string BaseType,
       return;
     }
 
+    TypePath FieldStub = typepaths::GetFieldStub(BaseType, FD);
+
     // Loop over this decl's type and its derivate types
     // Adding them as private
     const Type * T = FD->getType()->getUnqualifiedDesugaredType();
 
     do {
 
+      TypePath Path = typepaths::GetTypePath(FieldStub, T);
+
       // Do we really need to check that this type hasn't been added before?
-      TypeMap::iterator TypeIt = Types.find(GetType(T));
+      TypeMap::iterator TypeIt;
+      TypeIt = Types.find(typepaths::GetTypePath(typepaths::EmptyPath, T));
 
       if (TypeIt == Types.end()) {
-        stringstream TypeString;
-        TypeString << BaseType << "." << FD->getName().str() << ":"
-                   << GetType(T);
-
-        Types.insert(make_pair(string(TypeString.str()), true));
+        Types.insert(make_pair(Path, true));
       }
 
       if (T->isPointerType()) {
@@ -127,15 +143,9 @@ void DirectiveList::TrackStructDecl(string BaseType,
       } else {
 
         if (T->isStructureType()) {
-          stringstream TypeString;
-          TypeString << BaseType << "." << FD->getName().str() << ":"
-                     << GetType(T);
-          TrackStructDecl(string(TypeString.str()), T->getAsStructureType()->getDecl(), Types);
+          TrackStructDecl(Path, T->getAsStructureType()->getDecl(), Types);
         } else if (T->isUnionType()) {
-          stringstream TypeString;
-          TypeString << BaseType << "." << FD->getName().str() << ":"
-                     << GetType(T);
-          TrackStructDecl(string(TypeString.str()), T->getAsUnionType()->getDecl(), Types);
+          TrackStructDecl(Path, T->getAsUnionType()->getDecl(), Types);
         }
 
         T = NULL;
@@ -155,11 +165,13 @@ FullDirective * DirectiveList::CreateFullDirective(PragmaDirective *Directive,
                                                    CompilerInstance &CI,
                                                    StackItem * Parent) {
 
+  stats::Increment(stats::DirectivesCounter);
+
   // Generate the new directive
-  FullDirective *D = new FullDirective;
+  FullDirective *D = new (DirectiveAllocator.Allocate()) FullDirective;
   D->Directive = Directive;
   D->Header = Header;
-  D->ChildRange = GetChildRange(S, CI);
+  SetChildRange(D, GetChildRange(S, CI));
   D->S = S;
   D->CI = &CI;
   D->Parent = Parent;
@@ -179,9 +191,11 @@ FullDirective * DirectiveList::CreateFullDirective(PragmaDirective *Directive,
     TrackDecl(VD, D->TrackedDecls);
   }
 
-  llvm::errs() << "--- Created Directive ---\n";
-  printStackItem(D);
-  llvm::errs() << "-------------------------\n";
+  if (logging::Dumping(logging::StackDump)) {
+    logging::Out() << "--- Created Directive ---\n";
+    printStackItem(D);
+    logging::Out() << "-------------------------\n";
+  }
 
   return D;
 
@@ -193,13 +207,15 @@ FunctionCall * DirectiveList::CreateFunction(CallExpr *TheCall,
                                              CompilerInstance *CI,
                                              StackItem * Parent) {
 
+  stats::Increment(stats::CallsCounter);
+
   // Generate the new directive
-  FunctionCall *F = new FunctionCall;
+  FunctionCall *F = new (CallAllocator.Allocate()) FunctionCall;
   F->TheCall = TheCall;
   F->TheFunction = TheFunction;
-  F->ChildRange = GetChildRange(TheFunction->getBody(), *CI);
   F->S = TheFunction->getBody();
   F->CI = CI;
+  SetChildRange(F, GetChildRange(TheFunction->getBody(), *CI));
   F->Parent = Parent;
   
   // For each of the parameters in the function call (assume private at first)
@@ -242,9 +258,11 @@ FunctionCall * DirectiveList::CreateFunction(CallExpr *TheCall,
     
   }
   
-  llvm::errs() << "--- Created Function Call ---\n";
-  printStackItem(F);
-  llvm::errs() << "-----------------------------\n";
+  if (logging::Dumping(logging::StackDump)) {
+    logging::Out() << "--- Created Function Call ---\n";
+    printStackItem(F);
+    logging::Out() << "-----------------------------\n";
+  }
 
   return F;
 
@@ -253,10 +271,13 @@ FunctionCall * DirectiveList::CreateFunction(CallExpr *TheCall,
 // Private
 SpeculativeFunction * DirectiveList::CreateSpecFunction(FunctionCall *TheCall) {
 
-  SpeculativeFunction *S = new SpeculativeFunction;
+  SpeculativeFunction *S =
+      new (SpecFunctionAllocator.Allocate()) SpeculativeFunction;
 
   S->TheFunction = TheCall->TheFunction;
   S->ChildRange = TheCall->ChildRange;
+  S->RangeBegin = TheCall->RangeBegin;
+  S->RangeEnd = TheCall->RangeEnd;
   S->S = TheCall->S;
   S->CI = TheCall->CI;
   S->TrackedDecls = TheCall->TrackedDecls;
@@ -301,37 +322,140 @@ void DirectiveList::ContaminateSpecFunction(SpeculativeFunction *TheFunction,
 
         // Make sure the Function Calls is also marked as speculative
         if (FuncTypeIt->second) {
+          FuncTypeIt->second = CallTypeIt->second;
+        }
 
-          FuncTypes.erase(FuncTypeIt);
-          FuncTypes.insert(make_pair(CallTypeIt->first, CallTypeIt->second));
+      }
 
-        }
+    }
+
+  }
+
+}
+
+// Private
+void DirectiveList::SetChildRange(StackItem * Item, SourceRange Range) {
+
+  assert(Item->CI);
+
+  Item->ChildRange = Range;
+  Item->RangeBegin = UnpackMacroLoc(Range.getBegin(), *Item->CI).getRawEncoding();
+  Item->RangeEnd = UnpackMacroLoc(Range.getEnd(), *Item->CI).getRawEncoding();
+
+}
+
+// Private
+bool DirectiveList::InsideChildRange(SourceLocation Loc, StackItem * Item) {
+
+  // Same test as tools::InsideRange, minus unpacking the range every time
+  if (Loc.isInvalid()) {
+    return false;
+  }
+
+  unsigned Current = UnpackMacroLoc(Loc, *Item->CI).getRawEncoding();
+
+  return (Item->RangeBegin <= Current) && (Current <= Item->RangeEnd);
+
+}
+
+static bool RegionBefore(StackItem * LHS, StackItem * RHS) {
+
+  if (LHS->RangeBegin != RHS->RangeBegin) {
+    return LHS->RangeBegin < RHS->RangeBegin;
+  }
+
+  // Outermost first when two regions start together
+  return LHS->RangeEnd > RHS->RangeEnd;
+
+}
+
+static bool BeginsAfter(unsigned Loc, StackItem * Item) {
+  return Loc < Item->RangeBegin;
+}
 
+// Private
+void DirectiveList::BuildRegionIndex(RegionIndexMap &Index,
+                                     list<StackItem *> &Items) {
+
+  list<StackItem *>::iterator ItemIt;
+
+  for (ItemIt = Items.begin(); ItemIt != Items.end(); ItemIt++) {
+    Index[(*ItemIt)->CI].Regions.push_back(*ItemIt);
+  }
+
+  RegionIndexMap::iterator IndexIt;
+
+  for (IndexIt = Index.begin(); IndexIt != Index.end(); IndexIt++) {
+
+    vector<StackItem *> &Regions = IndexIt->second.Regions;
+    vector<int> &Parents = IndexIt->second.Parents;
+
+    std::stable_sort(Regions.begin(), Regions.end(), RegionBefore);
+
+    // The regions still open at each point, innermost last
+    vector<int> Open;
+
+    for (unsigned i = 0; i < Regions.size(); i++) {
+
+      while (!Open.empty()
+             && Regions[Open.back()]->RangeEnd < Regions[i]->RangeBegin) {
+        Open.pop_back();
       }
 
+      Parents.push_back(Open.empty() ? -1 : Open.back());
+      Open.push_back(i);
+
     }
 
   }
 
 }
 
+// Private
+StackItem * DirectiveList::FindEnclosingRegion(RegionIndexMap &Index,
+                                               SourceLocation Loc,
+                                               CompilerInstance &CI) {
+
+  RegionIndexMap::iterator IndexIt = Index.find(&CI);
+
+  if (IndexIt == Index.end() || Loc.isInvalid()) {
+    return NULL;
+  }
+
+  vector<StackItem *> &Regions = IndexIt->second.Regions;
+  vector<int> &Parents = IndexIt->second.Parents;
+
+  unsigned Current = UnpackMacroLoc(Loc, CI).getRawEncoding();
+
+  // The last region to begin at or before Loc
+  int i = std::upper_bound(Regions.begin(),
+                           Regions.end(),
+                           Current,
+                           BeginsAfter) - Regions.begin() - 1;
+
+  while (i >= 0 && Regions[i]->RangeEnd < Current) {
+    i = Parents[i];
+  }
+
+  return i >= 0 ? Regions[i] : NULL;
+
+}
+
 // Private
 void DirectiveList::RemoveToParent(SourceLocation Loc) {
 
   while (!CurrentDirectives.empty()
-         && !InsideRange(Loc,
-                         CurrentDirectives.front()->ChildRange,
-                         *(CurrentDirectives.front()->CI))) {
+         && !InsideChildRange(Loc, CurrentDirectives.front())) {
     CurrentDirectives.pop_front();
   }
   
 }
 
 // Public
-void DirectiveList::CreateTopLevel(PragmaDirective *Directive,
-                                   CompoundStmt *Header,
-                                   Stmt *S,
-                                   CompilerInstance &CI) {
+FullDirective * DirectiveList::CreateTopLevel(PragmaDirective *Directive,
+                                              CompoundStmt *Header,
+                                              Stmt *S,
+                                              CompilerInstance &CI) {
 
   assert(Directive);
   assert(Header);
@@ -348,6 +472,28 @@ void DirectiveList::CreateTopLevel(PragmaDirective *Directive,
   AllDirectives.insert(make_pair(Directive, D));
   TopLevelDirectives.push_back(D);
 
+  FunctionDecl * Parent = tools::GetEnclosingFunction(S);
+
+  if (Parent) {
+    TopLevelByFunction[Parent].push_back(D);
+  }
+
+  return D;
+
+}
+
+// Public
+void DirectiveList::InsertInferredPrivate(FullDirective *FD, VarDecl *VD) {
+
+  assert(FD);
+  assert(VD);
+
+  Changed = true;
+  stats::Increment(stats::InferredCounter);
+
+  TrackDecl(VD, FD->TrackedDecls);
+  FD->InferredPrivateDecls.push_back(VD);
+
 }
 
 // Public
@@ -425,13 +571,22 @@ FunctionCall * DirectiveList::Push(CallExpr *TheExpr) {
 
   FunctionCall *F = FMapIt->second;
 
+  CompilerInstance &CI = GetCI(TheExpr->getLocStart());
+  CurrentDirectives.push_front(F);
+
+  ContaminateParams(F, CI);
+
+  return F;
+
+}
+
+// Private
+void DirectiveList::ContaminateParams(FunctionCall * F, CompilerInstance &CI) {
+
   map<NamedDecl *, NamedDecl *> &ParamTranslations = F->ParamTranslations;
   FunctionDecl * TheFunction = F->TheFunction;
   CallExpr * TheCall = F->TheCall;
 
-  CompilerInstance &CI = GetCI(TheExpr->getLocStart());
-  CurrentDirectives.push_front(F);
-
   // Loop over params
   // For those with translations
   // Copy over any contamination (as far up the stack as normal)
@@ -461,18 +616,16 @@ FunctionCall * DirectiveList::Push(CallExpr *TheExpr) {
     assert(DomRef);
     assert(DomExpr);
 
-    string TARG = GetType(DomExpr);
+    TypePath TARG = typepaths::GetStub(DomExpr);
 
     ContaminateDecl(TheParam,
-                    string(),
+                    typepaths::EmptyPath,
                     TranslatedParam,
                     TARG,
                     TheArg->getType().getTypePtr());
 
   }
 
-  return F;
-
 }
 
 // Public
@@ -498,11 +651,17 @@ bool DirectiveList::InsideTopLevel(Stmt * S) {
 
   assert(S);
 
+  // A statement can only be inside the directives of its own function
+  list<FullDirective *> *Candidates = &TopLevelDirectives;
+  FunctionDecl * Parent = tools::GetEnclosingFunction(S);
+
+  if (Parent) {
+    Candidates = &TopLevelByFunction[Parent];
+  }
+
   list<FullDirective *>::iterator It;
 
-  for (It = TopLevelDirectives.begin();
-       It != TopLevelDirectives.end();
-       It++) {
+  for (It = Candidates->begin(); It != Candidates->end(); It++) {
 
     if (IsChild(S, (*It)->S)) {
       return true;
@@ -530,24 +689,20 @@ list<StackItem *> DirectiveList::GetHandlerStartPoints() {
 
   }
 
+  RegionIndexMap SpecFuncIndex;
+  BuildRegionIndex(SpecFuncIndex, Output);
+
   for (DirectiveIt = TopLevelDirectives.begin();
        DirectiveIt != TopLevelDirectives.end();
        DirectiveIt++) {
 
-    for (SpecFuncIt = AllSpeculativeFunctions.begin();
-         SpecFuncIt != AllSpeculativeFunctions.end();
-         SpecFuncIt++) {
-
-      if (InsideRange((*DirectiveIt)->Directive->Range.getBegin(),
-                      SpecFuncIt->second->ChildRange,
-                      *(SpecFuncIt->second->CI))) {
-        (*DirectiveIt)->Parent = SpecFuncIt->second;
-        break;
-      }
+    StackItem * SpecFunc = FindEnclosingRegion(SpecFuncIndex,
+                                               (*DirectiveIt)->Directive->Range.getBegin(),
+                                               *(*DirectiveIt)->CI);
 
-    }
-
-    if (SpecFuncIt == AllSpeculativeFunctions.end()) {
+    if (SpecFunc) {
+      (*DirectiveIt)->Parent = SpecFunc;
+    } else {
       Output.push_back(*DirectiveIt);
     }
 
@@ -559,7 +714,7 @@ list<StackItem *> DirectiveList::GetHandlerStartPoints() {
 
 // Public
 bool DirectiveList::IsPrivate(DeclRefExpr * Current,
-                              string TS,
+                              TypePath TS,
                               const Type * T,
                               SourceLocation Loc) {
 
@@ -591,14 +746,15 @@ bool DirectiveList::IsPrivate(DeclRefExpr * Current,
 
       Found = true;
       
-      TypeMap::iterator TypeIt = DeclIt->second.find(TS + GetType(T));
+      TypeMap::iterator TypeIt;
+      TypeIt = DeclIt->second.find(typepaths::GetTypePath(TS, T));
       
       // If we've found an entry, but not for that specific type, we must have
       // encountered an AddrOf op, at the top of a potentially private var.
       // Just check the privacy of the var itself instead of the pointer to it.
       if (TypeIt == DeclIt->second.end()) {
         T = T->getPointeeType()->getUnqualifiedDesugaredType();
-        TypeIt = DeclIt->second.find(GetType(T));
+        TypeIt = DeclIt->second.find(typepaths::GetTypePath(typepaths::EmptyPath, T));
       }
 
       // By now we really should have found the type we're looking for.
@@ -689,19 +845,24 @@ void DirectiveList::InsertPrivateDecl(VarDecl * VD) {
 
   assert(!CurrentDirectives.empty());
   
-  DeclMap &TrackedDecls = CurrentDirectives.front()->TrackedDecls;
+  StackItem * Item = CurrentDirectives.front();
+  DeclMap &TrackedDecls = Item->TrackedDecls;
   
+  Operation++;
+
   DeclMap::iterator TrackIt = TrackedDecls.find(VD);
   
   // If we haven't seen this declaration before
   if (TrackIt == TrackedDecls.end()) {
 
-    Changed = true;
-
     TrackDecl(VD, TrackedDecls);
+    MarkDeclChanged(Item, VD);
     
   }
 
+  // Only recorded once it's there, as nothing could have seen it missing
+  RecordLookup(Item, VD);
+
 }
 
 // Public
@@ -754,7 +915,7 @@ bool DirectiveList::FinishedSearchingStack(StackItem * Item,
     // (Only parameters are tracked at the function call level)
     // If it's not tracked, then it's a global, no translation needs to occur,
     // but the search must continue
-    DeclMap::iterator DeclIt = Item->TrackedDecls.find(TheDecl);
+    DeclMap::iterator DeclIt = FindTrackedDecl(Item, TheDecl);
 
     if (DeclIt != FC->TrackedDecls.end()) {
 
@@ -781,7 +942,7 @@ bool DirectiveList::FinishedSearchingStack(StackItem * Item,
   } else {
 
     // TODO: Change to actual error
-    llvm::errs() << "WTF!? ##################################\n";
+    logging::Out() << "WTF!? ##################################\n";
     assert(false);
 
   }
@@ -792,14 +953,16 @@ bool DirectiveList::FinishedSearchingStack(StackItem * Item,
 
 //Public
 bool DirectiveList::ContaminateDecl(NamedDecl * VDLHS,
-                                    string TLHS,
+                                    TypePath TLHS,
                                     NamedDecl * VDRHS,
-                                    string TRHS,
+                                    TypePath TRHS,
                                     const Type * T) {
 
   assert(VDLHS);
   assert(VDRHS);
   assert(T);
+
+  Operation++;
                                     
   // ContaminateDecl looks through all of the current directives for the LHS
   // and RHS.
@@ -851,7 +1014,7 @@ bool DirectiveList::ContaminateDecl(NamedDecl * VDLHS,
        DirItLHS != CurrentDirectives.end(); 
        DirItLHS++) {
        
-    DeclMap::iterator DeclItLHS = (*DirItLHS)->TrackedDecls.find(LHS);
+    DeclMap::iterator DeclItLHS = FindTrackedDecl(*DirItLHS, LHS);
   
     // If the "LHS" variable is tracked by this directive
     if (DeclItLHS != (*DirItLHS)->TrackedDecls.end()) {
@@ -868,7 +1031,7 @@ bool DirectiveList::ContaminateDecl(NamedDecl * VDLHS,
            DirItRHS != CurrentDirectives.end();
            DirItRHS++) {
            
-        DeclMap::iterator DeclItRHS = (*DirItRHS)->TrackedDecls.find(RHS);
+        DeclMap::iterator DeclItRHS = FindTrackedDecl(*DirItRHS, RHS);
       
         // If the "RHS" variable is tracked by this directive
         if (DeclItRHS != (*DirItRHS)->TrackedDecls.end()) {
@@ -878,8 +1041,11 @@ bool DirectiveList::ContaminateDecl(NamedDecl * VDLHS,
           TypeMap &TypesRHS = DeclItRHS->second;
           
           // We have managed to find the LHS and the RHS!
-          Contaminated = ContaminateSwap(TypesLHS, TLHS, TypesRHS, TRHS, T)
-                         || Contaminated;
+          if (ContaminateSwap(TypesLHS, TLHS, TypesRHS, TRHS, T)) {
+            MarkDeclChanged(*DirItLHS, LHS);
+            MarkDeclChanged(*DirItRHS, RHS);
+            Contaminated = true;
+          }
           
         }
            
@@ -892,7 +1058,10 @@ bool DirectiveList::ContaminateDecl(NamedDecl * VDLHS,
       if (!FoundRHS) {
         
         // We found an LHS but not an RHS
-        Contaminated = ContaminateAll(TypesLHS, TLHS, T) || Contaminated;
+        if (ContaminateAll(TypesLHS, TLHS, T)) {
+          MarkDeclChanged(*DirItLHS, LHS);
+          Contaminated = true;
+        }
         
       }
       
@@ -921,7 +1090,7 @@ bool DirectiveList::ContaminateDecl(NamedDecl * VDLHS,
          DirItRHS != CurrentDirectives.end();
          DirItRHS++) {
          
-      DeclMap::iterator DeclItRHS = (*DirItRHS)->TrackedDecls.find(RHS);
+      DeclMap::iterator DeclItRHS = FindTrackedDecl(*DirItRHS, RHS);
     
       // If the "RHS" variable is tracked by this directive
       if (DeclItRHS != (*DirItRHS)->TrackedDecls.end()) {
@@ -930,7 +1099,10 @@ bool DirectiveList::ContaminateDecl(NamedDecl * VDLHS,
         
         TypeMap &TypesRHS = DeclItRHS->second;
 
-        Contaminated = ContaminateAll(TypesRHS, TRHS, T) || Contaminated;
+        if (ContaminateAll(TypesRHS, TRHS, T)) {
+          MarkDeclChanged(*DirItRHS, RHS);
+          Contaminated = true;
+        }
         
       }
 
@@ -947,7 +1119,7 @@ bool DirectiveList::ContaminateDecl(NamedDecl * VDLHS,
 }
 
 // Private
-bool DirectiveList::ContaminateAll(TypeMap &Types, string TS, const Type * T, bool IncFirst) {
+bool DirectiveList::ContaminateAll(TypeMap &Types, TypePath TS, const Type * T, bool IncFirst) {
 
   bool Contaminated = false;
 
@@ -962,7 +1134,8 @@ bool DirectiveList::ContaminateAll(TypeMap &Types, string TS, const Type * T, bo
 
   while (CurrentT) {
 
-    TypeMap::iterator TypeIt = Types.find(TS + GetType(CurrentT));
+    TypePath Path = typepaths::GetTypePath(TS, CurrentT);
+    TypeMap::iterator TypeIt = Types.find(Path);
 
     assert(TypeIt != Types.end());
     
@@ -972,8 +1145,7 @@ bool DirectiveList::ContaminateAll(TypeMap &Types, string TS, const Type * T, bo
 
     Changed = true;
     Contaminated = true;
-    Types.erase(TypeIt);
-    Types.insert(make_pair(TS + GetType(CurrentT), false));
+    TypeIt->second = false;
 
     if (CurrentT->isPointerType()) {
       CurrentT = CurrentT->getPointeeType()->getUnqualifiedDesugaredType();
@@ -995,7 +1167,7 @@ bool DirectiveList::ContaminateAll(TypeMap &Types, string TS, const Type * T, bo
           }
 
           const Type * NT = FD->getType()->getUnqualifiedDesugaredType();
-          string NTS = TS + GetType(CurrentT) + "." + FD->getNameAsString() + ":";
+          TypePath NTS = typepaths::GetFieldStub(Path, FD);
 
           Contaminated = ContaminateAll(Types, NTS, NT, true) || Contaminated;
 
@@ -1015,7 +1187,7 @@ bool DirectiveList::ContaminateAll(TypeMap &Types, string TS, const Type * T, bo
           }
 
           const Type * NT = FD->getType()->getUnqualifiedDesugaredType();
-          string NTS = TS + GetType(CurrentT) + "." + FD->getNameAsString() + ":";
+          TypePath NTS = typepaths::GetFieldStub(Path, FD);
 
           Contaminated = ContaminateAll(Types, NTS, NT, true) || Contaminated;
 
@@ -1034,9 +1206,9 @@ bool DirectiveList::ContaminateAll(TypeMap &Types, string TS, const Type * T, bo
 
 // Private
 bool DirectiveList::ContaminateSwap(TypeMap &TypesLHS,
-                                    string TLHS,
+                                    TypePath TLHS,
                                     TypeMap &TypesRHS,
-                                    string TRHS,
+                                    TypePath TRHS,
                                     const Type * T,
                                     bool IncFirst) {
   
@@ -1053,8 +1225,11 @@ bool DirectiveList::ContaminateSwap(TypeMap &TypesLHS,
 
   while (CurrentT) {
 
-    TypeMap::iterator TypeItLHS = TypesLHS.find(TLHS + GetType(CurrentT));
-    TypeMap::iterator TypeItRHS = TypesRHS.find(TRHS + GetType(CurrentT));
+    TypePath PathLHS = typepaths::GetTypePath(TLHS, CurrentT);
+    TypePath PathRHS = typepaths::GetTypePath(TRHS, CurrentT);
+
+    TypeMap::iterator TypeItLHS = TypesLHS.find(PathLHS);
+    TypeMap::iterator TypeItRHS = TypesRHS.find(PathRHS);
 
     assert(TypeItLHS != TypesLHS.end());
     assert(TypeItRHS != TypesRHS.end());
@@ -1067,15 +1242,13 @@ bool DirectiveList::ContaminateSwap(TypeMap &TypesLHS,
 
       Changed = true;
       Contaminated = true;
-      TypesRHS.erase(TypeItRHS);
-      TypesRHS.insert(make_pair(TRHS + GetType(CurrentT), false));
+      TypeItRHS->second = false;
 
     } else if (TypeItLHS->second && !TypeItRHS->second) {
 
       Changed = true;
       Contaminated = true;
-      TypesLHS.erase(TypeItLHS);
-      TypesLHS.insert(make_pair(TLHS + GetType(CurrentT), false));
+      TypeItLHS->second = false;
 
     }
     
@@ -1099,8 +1272,8 @@ bool DirectiveList::ContaminateSwap(TypeMap &TypesLHS,
           }
 
           const Type * NT = FD->getType()->getUnqualifiedDesugaredType();
-          string NTLHS = TLHS + GetType(CurrentT) + "." + FD->getNameAsString() + ":";
-          string NTRHS = TRHS + GetType(CurrentT) + "." + FD->getNameAsString() + ":";
+          TypePath NTLHS = typepaths::GetFieldStub(PathLHS, FD);
+          TypePath NTRHS = typepaths::GetFieldStub(PathRHS, FD);
 
           Contaminated = ContaminateSwap(TypesLHS, NTLHS, TypesRHS, NTRHS, NT, true)
                          || Contaminated;
@@ -1122,8 +1295,8 @@ bool DirectiveList::ContaminateSwap(TypeMap &TypesLHS,
           }
 
           const Type * NT = FD->getType()->getUnqualifiedDesugaredType();
-          string NTLHS = TLHS + GetType(CurrentT) + "." + FD->getNameAsString() + ":";
-          string NTRHS = TRHS + GetType(CurrentT) + "." + FD->getNameAsString() + ":";
+          TypePath NTLHS = typepaths::GetFieldStub(PathLHS, FD);
+          TypePath NTRHS = typepaths::GetFieldStub(PathRHS, FD);
 
           Contaminated = ContaminateSwap(TypesLHS, NTLHS, TypesRHS, NTRHS, NT, true)
                          || Contaminated;
@@ -1195,8 +1368,8 @@ void DirectiveList::printStack(NamedDecl * VD) {
 
       CompilerInstance &CI = *((*DirIt)->CI);
 
-      llvm::errs() << "\t" << GetLocation((*DirIt)->ChildRange.getBegin(), CI)
-                   << " as " << DeclIt->first->getName() << "\n";
+      logging::Out() << "\t" << GetLocation((*DirIt)->ChildRange.getBegin(), CI)
+                     << " as " << DeclIt->first->getName() << "\n";
 
       TypeMap::iterator TypeIt;
 
@@ -1204,8 +1377,8 @@ void DirectiveList::printStack(NamedDecl * VD) {
            TypeIt != DeclIt->second.end();
            TypeIt++) {
 
-        llvm::errs() << "\t\t" << TypeIt->first;
-        llvm::errs() << ": " << (TypeIt->second ? "Private" : "Speculative") << "\n";
+        logging::Out() << "\t\t" << typepaths::GetName(TypeIt->first);
+        logging::Out() << ": " << (TypeIt->second ? "Private" : "Speculative") << "\n";
 
       }
 
@@ -1219,10 +1392,448 @@ void DirectiveList::printStack(NamedDecl * VD) {
 
   if (!Found) {
 
-    llvm::errs() << "\tNot Found!\n";
+    logging::Out() << "\tNot Found!\n";
+
+  }
+
+}
+
+// Private
+DeclMap::iterator DirectiveList::FindTrackedDecl(StackItem * Item,
+                                                 NamedDecl * D) {
+
+  RecordLookup(Item, D);
+
+  return Item->TrackedDecls.find(D);
+
+}
+
+// Private
+void DirectiveList::RecordLookup(StackItem * Item, NamedDecl * D) {
+
+  if (CurrentTraversal) {
+    Readers[make_pair(Item, D)].insert(CurrentTraversal);
+  }
+
+  list<SummaryRecording>::iterator RecIt;
+
+  for (RecIt = Recordings.begin(); RecIt != Recordings.end(); RecIt++) {
+
+    FunctionSummary &Summary = RecIt->Summary;
+
+    // The call itself is covered by the summary's entry state
+    if (Item == RecIt->Call) {
+
+      Summary.CallReads.insert(D);
+
+    } else if (RecIt->Outer.count(Item)) {
+
+      // What the params translate to is covered by ContaminateParams, anything
+      // else means the body reached past its params into the caller. That's
+      // only repeatable while the caller doesn't track it.
+      if (!RecIt->Passed.count(D)) {
+
+        Summary.OuterDecls.insert(D);
+
+        if (Item->TrackedDecls.count(D)) {
+          RecIt->Stable = false;
+        }
+
+      }
+
+    } else {
+
+      Summary.BodyReads.insert(make_pair(Item, D));
+      RecIt->FirstRead.insert(make_pair(make_pair(Item, D), Operation));
+
+    }
+
+  }
+
+}
+
+// Private
+void DirectiveList::MarkDeclChanged(StackItem * Item, NamedDecl * D) {
+
+  Changed = true;
+  Item->Version++;
+
+  list<SummaryRecording>::iterator RecIt;
+
+  for (RecIt = Recordings.begin(); RecIt != Recordings.end(); RecIt++) {
+
+    map<pair<StackItem *, NamedDecl *>, unsigned>::iterator ReadIt;
+    ReadIt = RecIt->FirstRead.find(make_pair(Item, D));
+
+    if (ReadIt != RecIt->FirstRead.end() && ReadIt->second != Operation) {
+      RecIt->Stable = false;
+    }
+
+    // The body changed its caller, which only the params' contamination
+    // passed back out by ContaminateParams is summarized as
+    if (RecIt->Outer.count(Item)) {
+      RecIt->Stable = false;
+    }
+
+  }
+
+  map<pair<StackItem *, NamedDecl *>, set<FullDirective *> >::iterator It;
+  It = Readers.find(make_pair(Item, D));
+
+  if (It != Readers.end()) {
+    StaleTraversals.insert(It->second.begin(), It->second.end());
+  }
+
+}
+
+static bool SameTypes(TypeMap &A, TypeMap &B) {
+
+  if (A.size() != B.size()) {
+    return false;
+  }
+
+  TypeMap::iterator AIt;
+
+  for (AIt = A.begin(); AIt != A.end(); AIt++) {
+
+    TypeMap::iterator BIt = B.find(AIt->first);
+
+    if (BIt == B.end() || BIt->second != AIt->second) {
+      return false;
+    }
+
+  }
+
+  return true;
+
+}
+
+static bool SameDecls(DeclMap &A, DeclMap &B) {
+
+  if (A.size() != B.size()) {
+    return false;
+  }
+
+  DeclMap::iterator AIt;
+  DeclMap::iterator BIt;
+
+  for (AIt = A.begin(), BIt = B.begin(); AIt != A.end(); AIt++, BIt++) {
+
+    if (AIt->first != BIt->first || !SameTypes(AIt->second, BIt->second)) {
+      return false;
+    }
 
   }
 
+  return true;
+
+}
+
+static bool VersionsHold(FunctionSummary &Summary) {
+
+  map<StackItem *, unsigned>::iterator VersionIt;
+
+  for (VersionIt = Summary.Versions.begin();
+       VersionIt != Summary.Versions.end();
+       VersionIt++) {
+
+    if (VersionIt->first->Version != VersionIt->second) {
+      return false;
+    }
+
+  }
+
+  return true;
+
+}
+
+// Public
+void DirectiveList::SaveStack(StackSnapshot &Snapshot) {
+
+  Snapshot.clear();
+
+  map<PragmaDirective *, FullDirective *>::iterator DirIt;
+
+  for (DirIt = AllDirectives.begin(); DirIt != AllDirectives.end(); DirIt++) {
+    Snapshot[DirIt->second] = DirIt->second->TrackedDecls;
+  }
+
+  map<CallExpr *, FunctionCall *>::iterator CallIt;
+
+  for (CallIt = AllCalls.begin(); CallIt != AllCalls.end(); CallIt++) {
+    Snapshot[CallIt->second] = CallIt->second->TrackedDecls;
+  }
+
+  list<StackItem *>::iterator StackIt;
+
+  for (StackIt = CurrentDirectives.begin();
+       StackIt != CurrentDirectives.end();
+       StackIt++) {
+    Snapshot[*StackIt] = (*StackIt)->TrackedDecls;
+  }
+
+}
+
+// Public
+void DirectiveList::RestoreStack(StackSnapshot &Snapshot) {
+
+  StackSnapshot::iterator ItemIt;
+
+  for (ItemIt = Snapshot.begin(); ItemIt != Snapshot.end(); ItemIt++) {
+
+    if (!SameDecls(ItemIt->first->TrackedDecls, ItemIt->second)) {
+      ItemIt->first->TrackedDecls = ItemIt->second;
+      // Anything recorded against what's being thrown away is stale
+      ItemIt->first->Version++;
+    }
+
+  }
+
+}
+
+// Public
+bool DirectiveList::SameStack(StackSnapshot &A, StackSnapshot &B) {
+
+  if (A.size() != B.size()) {
+    return false;
+  }
+
+  StackSnapshot::iterator AIt;
+  StackSnapshot::iterator BIt;
+
+  for (AIt = A.begin(), BIt = B.begin(); AIt != A.end(); AIt++, BIt++) {
+
+    if (AIt->first != BIt->first || !SameDecls(AIt->second, BIt->second)) {
+      return false;
+    }
+
+  }
+
+  return true;
+
+}
+
+// Private
+bool DirectiveList::CallerTracksAny(set<NamedDecl *> &Decls, FunctionCall * F) {
+
+  set<NamedDecl *>::iterator DeclIt;
+  list<StackItem *>::iterator DirIt;
+
+  for (DeclIt = Decls.begin(); DeclIt != Decls.end(); DeclIt++) {
+
+    for (DirIt = CurrentDirectives.begin();
+         DirIt != CurrentDirectives.end();
+         DirIt++) {
+
+      if (*DirIt != F && (*DirIt)->TrackedDecls.count(*DeclIt)) {
+        return true;
+      }
+
+    }
+
+  }
+
+  return false;
+
+}
+
+// Public
+bool DirectiveList::ApplySummary(FunctionCall * F, CompilerInstance &CI) {
+
+  assert(F);
+  assert(CurrentDirectives.front() == F);
+
+  map<FunctionDecl *, list<FunctionSummary> >::iterator SumIt;
+  SumIt = Summaries.find(F->TheFunction);
+
+  if (SumIt == Summaries.end()) {
+    return false;
+  }
+
+  list<FunctionSummary>::iterator It = SumIt->second.begin();
+
+  while (It != SumIt->second.end()) {
+
+    if (!SameDecls(It->Entry, F->TrackedDecls)) {
+      It++;
+      continue;
+    }
+
+    // Versions only ever go up, so this summary is stale for good
+    if (!VersionsHold(*It)) {
+      It = SumIt->second.erase(It);
+      continue;
+    }
+
+    if (CallerTracksAny(It->OuterDecls, F)) {
+      It++;
+      continue;
+    }
+
+    FunctionSummary &Summary = *It;
+
+    Operation++;
+
+    // Look everything up again, so whoever is traversing (or recording a
+    // summary further out) depends on the same entries the body would have
+    set<pair<StackItem *, NamedDecl *> >::iterator ReadIt;
+
+    for (ReadIt = Summary.BodyReads.begin();
+         ReadIt != Summary.BodyReads.end();
+         ReadIt++) {
+      RecordLookup(ReadIt->first, ReadIt->second);
+    }
+
+    set<NamedDecl *>::iterator DeclIt;
+
+    for (DeclIt = Summary.CallReads.begin();
+         DeclIt != Summary.CallReads.end();
+         DeclIt++) {
+      RecordLookup(F, *DeclIt);
+    }
+
+    list<StackItem *>::iterator DirIt;
+
+    for (DeclIt = Summary.OuterDecls.begin();
+         DeclIt != Summary.OuterDecls.end();
+         DeclIt++) {
+
+      for (DirIt = CurrentDirectives.begin();
+           DirIt != CurrentDirectives.end();
+           DirIt++) {
+
+        if (*DirIt != F) {
+          RecordLookup(*DirIt, *DeclIt);
+        }
+
+      }
+
+    }
+
+    DeclMap::iterator ExitIt;
+
+    for (ExitIt = Summary.Exit.begin(); ExitIt != Summary.Exit.end(); ExitIt++) {
+
+      DeclMap::iterator TrackIt = F->TrackedDecls.find(ExitIt->first);
+
+      if (TrackIt == F->TrackedDecls.end()) {
+        F->TrackedDecls.insert(*ExitIt);
+        MarkDeclChanged(F, ExitIt->first);
+      } else if (!SameTypes(TrackIt->second, ExitIt->second)) {
+        TrackIt->second = ExitIt->second;
+        MarkDeclChanged(F, ExitIt->first);
+      }
+
+    }
+
+    // The body would have passed any contamination of its params back out
+    // to the args as it went
+    ContaminateParams(F, CI);
+
+    return true;
+
+  }
+
+  return false;
+
+}
+
+// Public
+void DirectiveList::BeginSummary(FunctionCall * F) {
+
+  assert(F);
+  assert(CurrentDirectives.front() == F);
+
+  Recordings.push_back(SummaryRecording());
+
+  SummaryRecording &Recording = Recordings.back();
+  Recording.Call = F;
+  Recording.Summary.Entry = F->TrackedDecls;
+  Recording.Stable = true;
+
+  map<NamedDecl *, NamedDecl *>::iterator TransIt;
+
+  for (TransIt = F->ParamTranslations.begin();
+       TransIt != F->ParamTranslations.end();
+       TransIt++) {
+    Recording.Passed.insert(TransIt->second);
+  }
+
+  list<StackItem *>::iterator DirIt = CurrentDirectives.begin();
+
+  // Follow the args through any calls further out, as the search would
+  for (DirIt++; DirIt != CurrentDirectives.end(); DirIt++) {
+
+    Recording.Outer.insert(*DirIt);
+
+    if (!FunctionCall::ClassOf(*DirIt)) {
+      continue;
+    }
+
+    FunctionCall * FC = (FunctionCall *) *DirIt;
+
+    for (TransIt = FC->ParamTranslations.begin();
+         TransIt != FC->ParamTranslations.end();
+         TransIt++) {
+
+      if (Recording.Passed.count(TransIt->first)) {
+        Recording.Passed.insert(TransIt->second);
+      }
+
+    }
+
+  }
+
+}
+
+// Public
+void DirectiveList::EndSummary(FunctionCall * F) {
+
+  assert(!Recordings.empty());
+
+  SummaryRecording &Recording = Recordings.back();
+  assert(Recording.Call == F);
+
+  if (Recording.Stable) {
+
+    FunctionSummary &Summary = Recording.Summary;
+    Summary.Exit = F->TrackedDecls;
+
+    set<pair<StackItem *, NamedDecl *> >::iterator ReadIt;
+
+    for (ReadIt = Summary.BodyReads.begin();
+         ReadIt != Summary.BodyReads.end();
+         ReadIt++) {
+      Summary.Versions[ReadIt->first] = ReadIt->first->Version;
+    }
+
+    Summaries[F->TheFunction].push_back(Summary);
+
+  }
+
+  Recordings.pop_back();
+
+}
+
+// Public
+void DirectiveList::BeginTraversal(FullDirective * FD) {
+
+  assert(FD);
+
+  CurrentTraversal = FD;
+
+}
+
+// Public
+set<FullDirective *> DirectiveList::EndTraversal() {
+
+  set<FullDirective *> Stale;
+  Stale.swap(StaleTraversals);
+
+  CurrentTraversal = NULL;
+
+  return Stale;
+
 }
 
 // Public
@@ -1271,30 +1882,30 @@ void DirectiveList::printStackItem(StackItem * I) {
 
     FullDirective * D = (FullDirective *) I;
 
-    llvm::errs() << "PragmaRange: "
-                 << GetLocation(D->Directive->Range.getBegin(), *(D->CI))
-                 << " - "
-                 << GetLocation(D->Directive->Range.getEnd(), *(D->CI)) << "\n";
+    logging::Out() << "PragmaRange: "
+                   << GetLocation(D->Directive->Range.getBegin(), *(D->CI))
+                   << " - "
+                   << GetLocation(D->Directive->Range.getEnd(), *(D->CI)) << "\n";
 
   } else if (FunctionCall::ClassOf(I)){
 
     FunctionCall * C = (FunctionCall *) I;
 
-    llvm::errs() << "FunctionCall: " << C->TheFunction->getName() << ", "
-                 << GetLocation(C->TheCall->getLocStart(), *(C->CI)) << "\n";
+    logging::Out() << "FunctionCall: " << C->TheFunction->getName() << ", "
+                   << GetLocation(C->TheCall->getLocStart(), *(C->CI)) << "\n";
 
 
   } else if (SpeculativeFunction::ClassOf(I)) {
 
     SpeculativeFunction * F = (SpeculativeFunction *) I;
 
-    llvm::errs() << "SpeculativeFunction: " << F->TheFunction->getName() << ", "
-                 << GetLocation(F->TheFunction->getLocStart(), *(F->CI))
-                 << "\n";
+    logging::Out() << "SpeculativeFunction: " << F->TheFunction->getName() << ", "
+                   << GetLocation(F->TheFunction->getLocStart(), *(F->CI))
+                   << "\n";
 
   } else {
 
-    llvm::errs() << "UnknownStackItem:\n";
+    logging::Out() << "UnknownStackItem:\n";
 
   }
 
@@ -1310,8 +1921,8 @@ void DirectiveList::printDeclMap(DeclMap &Decls) {
   
   for (DeclIt = Decls.begin(); DeclIt != Decls.end(); DeclIt++) {
   
-    llvm::errs() << "\tDecl: " << DeclIt->first->getNameAsString()
-                 << " (" << (int) DeclIt->first << ")\n";
+    logging::Out() << "\tDecl: " << DeclIt->first->getNameAsString()
+                   << " (" << (int) DeclIt->first << ")\n";
     
     TypeMap::iterator TypeIt;
     
@@ -1319,8 +1930,8 @@ void DirectiveList::printDeclMap(DeclMap &Decls) {
          TypeIt != DeclIt->second.end();
          TypeIt++) {
     
-      llvm::errs() << "\t\t" << TypeIt->first;
-      llvm::errs() << ": " << (TypeIt->second ? "Private" : "Speculative") << "\n";
+      logging::Out() << "\t\t" << typepaths::GetName(TypeIt->first);
+      logging::Out() << ": " << (TypeIt->second ? "Private" : "Speculative") << "\n";
     
     }
   
@@ -1342,9 +1953,9 @@ void DirectiveList::InsertDeclAccess(NamedDecl * D, bool Write) {
     StackItem * I = *StackIt;
 
     if (Write) {
-      I->WriteDecls.insert(D);
+      I->WriteDecls.set(globals::GetDeclId(D));
     } else {
-      I->ReadDecls.insert(D);
+      I->ReadDecls.set(globals::GetDeclId(D));
     }
 
     if (FullDirective::ClassOf(I)) {
@@ -1379,7 +1990,9 @@ int DirectiveList::getMaxCachesRequired() {
        FuncIt != AllSpeculativeFunctions.end();
        FuncIt++) {
 
-    llvm::errs() << "### Handling " << FuncIt->first->getName() << " ###\n";
+    if (logging::Enabled(logging::Verbose)) {
+      logging::Out() << "### Handling " << FuncIt->first->getName() << " ###\n";
+    }
 
     int count = getMaxCachesRequired(FuncIt->second);
 
@@ -1394,7 +2007,9 @@ int DirectiveList::getMaxCachesRequired() {
        DirIt != TopLevelDirectives.end();
        DirIt++) {
 
-    llvm::errs() << "### Handling " << GetLocation((*DirIt)->ChildRange.getBegin(), *(*DirIt)->CI) << " ###\n";
+    if (logging::Enabled(logging::Verbose)) {
+      logging::Out() << "### Handling " << GetLocation((*DirIt)->ChildRange.getBegin(), *(*DirIt)->CI) << " ###\n";
+    }
 
     int count = getMaxCachesRequired(*DirIt);
 
@@ -1411,21 +2026,23 @@ int DirectiveList::getMaxCachesRequired() {
 // Private
 int DirectiveList::getMaxCachesRequired(StackItem * SI) {
 
-  switch(SI->TYPE) {
-  case StackItem::FunctionCallType:
-    assert(false && "Didn't Expect Function Call Type");
-    break;
-  case StackItem::SpeculativeFunctionType:
-    llvm::errs() << "--- Handling " << ((SpeculativeFunction *)SI)->TheFunction->getName() << " ---\n";
-    break;
-  case StackItem::FullDirectiveType:
-    llvm::errs() << "--- Handling " << GetLocation(SI->ChildRange.getBegin(), *SI->CI) << " ---\n";
-    break;
-  default:
-    assert(false && "Unknown Item Type");
+  if (logging::Enabled(logging::Debug)) {
+    switch(SI->TYPE) {
+    case StackItem::FunctionCallType:
+      assert(false && "Didn't Expect Function Call Type");
+      break;
+    case StackItem::SpeculativeFunctionType:
+      logging::Out() << "--- Handling " << ((SpeculativeFunction *)SI)->TheFunction->getName() << " ---\n";
+      break;
+    case StackItem::FullDirectiveType:
+      logging::Out() << "--- Handling " << GetLocation(SI->ChildRange.getBegin(), *SI->CI) << " ---\n";
+      break;
+    default:
+      assert(false && "Unknown Item Type");
+    }
   }
 
-  int total = SI->ReadDecls.size() + SI->WriteDecls.size() - SI->ReadOnlyDecls.size();
+  int total = SI->ReadDecls.count() + SI->WriteDecls.count() - SI->ReadOnlyDecls.count();
 
   map<CallExpr *, FunctionCall *>::iterator CallIt;
 
@@ -1464,22 +2081,16 @@ void DirectiveList::GenerateReadOnly() {
        DirIt != TopLevelDirectives.end();
        DirIt++) {
 
-    set<FunctionDecl *> AllFuncs = globals::GetAllFunctionDecls();
-    set<FunctionDecl *>::iterator FuncIt;
-
-    llvm::errs() << "### Handling "
-                 << GetLocation((*DirIt)->ChildRange.getBegin(), *(*DirIt)->CI)
-                 << " ###\n";
-
-    for (FuncIt = AllFuncs.begin(); FuncIt != AllFuncs.end(); FuncIt++) {
-      if (tools::IsChild((*DirIt)->S, (*FuncIt)->getBody())) {
-        break;
-      }
+    if (logging::Enabled(logging::Verbose)) {
+      logging::Out() << "### Handling "
+                     << GetLocation((*DirIt)->ChildRange.getBegin(), *(*DirIt)->CI)
+                     << " ###\n";
     }
 
-    assert(FuncIt != AllFuncs.end());
+    FunctionDecl * Parent = tools::GetEnclosingFunction((*DirIt)->S);
+    assert(Parent);
 
-    GenerateReadOnly(*DirIt, *FuncIt);
+    GenerateReadOnly(*DirIt, Parent);
 
   }
 
@@ -1489,9 +2100,11 @@ void DirectiveList::GenerateReadOnly() {
        FuncIt != AllSpeculativeFunctions.end();
        FuncIt++) {
 
-    llvm::errs() << "### Handling " << FuncIt->first->getNameAsString() << " "
-                 << GetLocation(FuncIt->second->ChildRange.getBegin(), *FuncIt->second->CI)
-                 << " ###\n";
+    if (logging::Enabled(logging::Verbose)) {
+      logging::Out() << "### Handling " << FuncIt->first->getNameAsString() << " "
+                     << GetLocation(FuncIt->second->ChildRange.getBegin(), *FuncIt->second->CI)
+                     << " ###\n";
+    }
 
     GenerateReadOnly(FuncIt->second);
 
@@ -1505,17 +2118,41 @@ void DirectiveList::GenerateReadOnly(FullDirective * Item,
 
   FunctionTracker * FT = TrackedVars->GetTracker(Parent);
 
-  set<NamedDecl *>::iterator ReadIt;
+  DeclSet::iterator ReadIt;
 
   for (ReadIt = Item->ReadDecls.begin();
        ReadIt != Item->ReadDecls.end();
        ReadIt++) {
 
-    NamedDecl * D = *ReadIt;
-    llvm::errs() << "\tLooking For: " << D->getNameAsString() << "\n";
+    NamedDecl * D = globals::GetDeclFromId(*ReadIt);
+    if (logging::Enabled(logging::Debug)) {
+      logging::Out() << "\tLooking For: " << D->getNameAsString() << "\n";
+    }
 
     if (IsReadOnly(D, FT, Item, TrackedVars)) {
-      Item->ReadOnlyDecls.insert(D);
+      Item->ReadOnlyDecls.set(*ReadIt);
+    }
+
+  }
+
+  // The handler only saw the array by name. Anything else that's accessed
+  // and may point into it could be on another iteration.
+  DeclSet Accessed(Item->ReadDecls);
+  Accessed |= Item->WriteDecls;
+
+  DeclSet Independent(Item->IndependentDecls);
+  DeclSet::iterator DeclIt;
+
+  for (DeclIt = Independent.begin(); DeclIt != Independent.end(); DeclIt++) {
+
+    NamedDecl * D = globals::GetDeclFromId(*DeclIt);
+
+    DeclSet Others(Accessed);
+    Others.reset(*DeclIt);
+
+    if (TrackedVars->ContainsMatch(D, FT, Others)
+        || CallsAccess(D, FT, Item)) {
+      Item->IndependentDecls.reset(*DeclIt);
     }
 
   }
@@ -1527,14 +2164,16 @@ void DirectiveList::GenerateReadOnly(SpeculativeFunction * Item) {
 
   FunctionTracker * FT = TrackedVars->GetTracker(Item->TheFunction);
 
-  set<NamedDecl *>::iterator ReadIt;
+  DeclSet::iterator ReadIt;
 
   for (ReadIt = Item->ReadDecls.begin();
        ReadIt != Item->ReadDecls.end();
        ReadIt++) {
 
-    NamedDecl * D = *ReadIt;
-    llvm::errs() << "\tLooking For: " << D->getNameAsString() << "\n";
+    NamedDecl * D = globals::GetDeclFromId(*ReadIt);
+    if (logging::Enabled(logging::Debug)) {
+      logging::Out() << "\tLooking For: " << D->getNameAsString() << "\n";
+    }
 
     // Need to find all top level directives for this function
     set<FullDirective *> TopDirectives = GetTopLevelDirectives(Item);
@@ -1552,7 +2191,7 @@ void DirectiveList::GenerateReadOnly(SpeculativeFunction * Item) {
     }
 
     if (Dit == TopDirectives.end()) {
-      Item->ReadOnlyDecls.insert(D);
+      Item->ReadOnlyDecls.set(*ReadIt);
     }
 
   }
@@ -1594,19 +2233,62 @@ bool DirectiveList::IsReadOnly(NamedDecl * D,
 
 }
 
+// Private
+bool DirectiveList::CallsAccess(NamedDecl * D,
+                                FunctionTracker * FT,
+                                StackItem * Item) {
+
+  map<CallExpr *, FunctionCall *>::iterator CallIt;
+
+  for (CallIt = AllCalls.begin(); CallIt != AllCalls.end(); CallIt++) {
+
+    CallExpr * TheCall = CallIt->first;
+    FunctionCall * TheFunc = CallIt->second;
+
+    if (tools::IsChild(TheCall, Item->S)) {
+
+      map<FunctionDecl *, SpeculativeFunction *>::iterator FuncIt;
+      FuncIt = AllSpeculativeFunctions.find(TheFunc->TheFunction);
+      assert(FuncIt != AllSpeculativeFunctions.end());
+
+      DeclSet Accessed(FuncIt->second->ReadDecls);
+      Accessed |= FuncIt->second->WriteDecls;
+
+      if (TrackedVars->ContainsMatch(D, FT, Accessed)
+          || CallsAccess(D, FT, FuncIt->second)) {
+        return true;
+      }
+
+    }
+
+  }
+
+  return false;
+
+}
+
 // Public
 bool DirectiveList::IsReadOnly(NamedDecl * D) {
 
   assert(D);
   D = globals::GetNamedDecl(D);
 
+  return GetRootItem()->ReadOnlyDecls.test(globals::GetDeclId(D));
+
+}
+
+// Public
+StackItem * DirectiveList::GetRootItem() {
+
+  assert(!CurrentDirectives.empty());
+
   StackItem * Current = CurrentDirectives.front();
 
   while (Current->Parent != NULL) {
     Current = Current->Parent;
   }
 
-  return Current->ReadOnlyDecls.find(D) != Current->ReadOnlyDecls.end();
+  return Current;
 
 }
 
@@ -1655,44 +2337,47 @@ void DirectiveList::printTopLevelDeclAccess() {
 
 void DirectiveList::printDeclAccess(StackItem * D) {
 
-  llvm::errs() << "\t### Displaying ";
+  logging::Out() << "\t### Displaying ";
 
   if (SpeculativeFunction::ClassOf(D)) {
-    llvm::errs() << ((SpeculativeFunction *) D)->TheFunction->getNameAsString()
-                 << " ";
+    logging::Out() << ((SpeculativeFunction *) D)->TheFunction->getNameAsString()
+                   << " ";
   }
 
-  llvm::errs() << GetLocation(D->ChildRange.getBegin(), *D->CI)
-               << " ###\n";
+  logging::Out() << GetLocation(D->ChildRange.getBegin(), *D->CI)
+                 << " ###\n";
 
-  set<NamedDecl *>::iterator It;
+  DeclSet::iterator It;
 
-  llvm::errs() << "Reads: ";
+  logging::Out() << "Reads: ";
   for (It = D->ReadDecls.begin(); It != D->ReadDecls.end(); It++) {
     if (It != D->ReadDecls.begin()) {
-      llvm::errs() << ", ";
+      logging::Out() << ", ";
     }
-    llvm::errs() << (*It)->getNameAsString() << " (" << (int) *It << ")";
+    NamedDecl * Current = globals::GetDeclFromId(*It);
+    logging::Out() << Current->getNameAsString() << " (" << (int) Current << ")";
   }
-  llvm::errs() << "\n";
+  logging::Out() << "\n";
 
-  llvm::errs() << "Writes: ";
+  logging::Out() << "Writes: ";
   for (It = D->WriteDecls.begin(); It != D->WriteDecls.end(); It++) {
     if (It != D->WriteDecls.begin()) {
-      llvm::errs() << ", ";
+      logging::Out() << ", ";
     }
-    llvm::errs() << (*It)->getNameAsString() << " (" << (int) *It << ")";
+    NamedDecl * Current = globals::GetDeclFromId(*It);
+    logging::Out() << Current->getNameAsString() << " (" << (int) Current << ")";
   }
-  llvm::errs() << "\n";
+  logging::Out() << "\n";
 
-  llvm::errs() << "ReadOnly: ";
+  logging::Out() << "ReadOnly: ";
   for (It = D->ReadOnlyDecls.begin(); It != D->ReadOnlyDecls.end(); It++) {
     if (It != D->ReadOnlyDecls.begin()) {
-      llvm::errs() << ", ";
+      logging::Out() << ", ";
     }
-    llvm::errs() << (*It)->getNameAsString() << " (" << (int) *It << ")";
+    NamedDecl * Current = globals::GetDeclFromId(*It);
+    logging::Out() << Current->getNameAsString() << " (" << (int) Current << ")";
   }
-  llvm::errs() << "\n";
+  logging::Out() << "\n";
 
 }
 
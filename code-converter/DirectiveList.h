@@ -7,10 +7,15 @@
 #define _DIRECTIVELIST_H_
 
 #include "Classes.h"
+#include "Globals.h"
+#include "TypePaths.h"
 
 #include "clang/AST/AST.h"
 #include "clang/Frontend/CompilerInstance.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Allocator.h"
+
 using clang::CallExpr;
 using clang::CompilerInstance;
 using clang::CompoundStmt;
@@ -30,7 +35,7 @@ using clang::VarDecl;
 
 namespace speculation {
 
-typedef map<string, bool> TypeMap;
+typedef llvm::DenseMap<TypePath, bool> TypeMap;
 typedef map<NamedDecl *, TypeMap> DeclMap;
 
 struct StackItem {
@@ -39,21 +44,38 @@ struct StackItem {
   };
   StackItemType TYPE;
   SourceRange ChildRange;
+  // ChildRange with its macros unpacked, as compared against by InsideRange
+  unsigned RangeBegin;
+  unsigned RangeEnd;
   Stmt *S;
   CompilerInstance *CI;
   DeclMap TrackedDecls;
-  set<NamedDecl *> ReadDecls;
-  set<NamedDecl *> WriteDecls;
-  set<NamedDecl *> ReadOnlyDecls;
+  DeclSet ReadDecls;
+  DeclSet WriteDecls;
+  DeclSet ReadOnlyDecls;
+  // Arrays no two iterations of an omp for loop share an element of, which
+  // need no tracking at all
+  DeclSet IndependentDecls;
   StackItem * Parent;
   int CachesRequired;
+  // Bumped whenever one of TrackedDecls changes
+  unsigned Version;
  protected:
-  StackItem(StackItemType TYPE) { this->TYPE = TYPE; CachesRequired = -1; }
+  StackItem(StackItemType TYPE) {
+    this->TYPE = TYPE;
+    CachesRequired = -1;
+    RangeBegin = 0;
+    RangeEnd = 0;
+    Version = 0;
+  }
 };
 
 struct FullDirective : public StackItem {
   PragmaDirective *Directive;
   CompoundStmt *Header;
+  // Shared variables found to be private, which the directive is rewritten
+  // to declare so
+  vector<VarDecl *> InferredPrivateDecls;
   FullDirective() : StackItem(FullDirectiveType) {}
   static bool ClassOf(StackItem *Item) {
     return Item->TYPE == FullDirectiveType;
@@ -78,6 +100,49 @@ struct SpeculativeFunction : public StackItem {
   }
 };
 
+// Regions of one CompilerInstance ordered on where they begin. Regions are
+// either nested or disjoint, so the regions enclosing a location are the last
+// one to begin before it and that region's parents.
+struct RegionIndex {
+  vector<StackItem *> Regions;
+  // Position of the innermost region enclosing each region, or -1
+  vector<int> Parents;
+};
+
+typedef map<CompilerInstance *, RegionIndex> RegionIndexMap;
+
+// The TrackedDecls of every stack item at some point
+typedef map<StackItem *, DeclMap> StackSnapshot;
+
+// What traversing a function's body left in the FunctionCall it was pushed
+// for, given what that FunctionCall tracked on entry. It holds for as long
+// as nothing the body looked up inside itself has changed, and the caller
+// tracks none of the decls the body looked for outside its params. Only
+// bodies that left their caller unchanged are summarized, as the rest of
+// the caller's contamination comes from ContaminateParams.
+struct FunctionSummary {
+  DeclMap Entry;
+  DeclMap Exit;
+  set<NamedDecl *> CallReads;
+  set<pair<StackItem *, NamedDecl *> > BodyReads;
+  map<StackItem *, unsigned> Versions;
+  set<NamedDecl *> OuterDecls;
+};
+
+// A summary being recorded while its FunctionCall's body is traversed
+struct SummaryRecording {
+  FunctionCall * Call;
+  FunctionSummary Summary;
+  // The caller's stack items, and the decls the params translate to in them
+  set<StackItem *> Outer;
+  set<NamedDecl *> Passed;
+  // The operation each entry inside the body was first looked up in. If one
+  // changes in a later operation, traversing again could come out different,
+  // so the recording isn't Stable and gets dropped.
+  map<pair<StackItem *, NamedDecl *>, unsigned> FirstRead;
+  bool Stable;
+};
+
 class DirectiveList {
 
  private:
@@ -86,13 +151,30 @@ class DirectiveList {
   map<PragmaDirective *, FullDirective *> AllDirectives;
   map<CallExpr *, FunctionCall *> AllCalls;
   map<FunctionDecl *, SpeculativeFunction *> AllSpeculativeFunctions;
+
+  // Every stack item lives as long as the list
+  llvm::SpecificBumpPtrAllocator<FullDirective> DirectiveAllocator;
+  llvm::SpecificBumpPtrAllocator<FunctionCall> CallAllocator;
+  llvm::SpecificBumpPtrAllocator<SpeculativeFunction> SpecFunctionAllocator;
+
   list<FullDirective *> TopLevelDirectives;
+  map<FunctionDecl *, list<FullDirective *> > TopLevelByFunction;
   list<StackItem *> CurrentDirectives;
 
+  // Which top level directives looked up each (item, decl) while being
+  // traversed, so only they need re-traversing when that entry changes
+  FullDirective * CurrentTraversal;
+  map<pair<StackItem *, NamedDecl *>, set<FullDirective *> > Readers;
+  set<FullDirective *> StaleTraversals;
+
+  map<FunctionDecl *, list<FunctionSummary> > Summaries;
+  list<SummaryRecording> Recordings;
+  unsigned Operation;
+
   bool Changed;
   
   void TrackDecl(VarDecl * TheDecl, DeclMap &TrackedDecls);
-  void TrackStructDecl(string BaseType, const RecordDecl * RD, TypeMap &Types);
+  void TrackStructDecl(TypePath BaseType, const RecordDecl * RD, TypeMap &Types);
   
   FullDirective * CreateFullDirective(PragmaDirective *Directive,
                                       CompoundStmt *Header,
@@ -109,15 +191,30 @@ class DirectiveList {
   void ContaminateSpecFunction(SpeculativeFunction *TheFunction,
                                FunctionCall *TheCall);
               
+  void SetChildRange(StackItem * Item, SourceRange Range);
+  bool InsideChildRange(SourceLocation Loc, StackItem * Item);
+
+  void BuildRegionIndex(RegionIndexMap &Index, list<StackItem *> &Items);
+  StackItem * FindEnclosingRegion(RegionIndexMap &Index,
+                                  SourceLocation Loc,
+                                  CompilerInstance &CI);
+
   void RemoveToParent(SourceLocation Loc);
+
+  DeclMap::iterator FindTrackedDecl(StackItem * Item, NamedDecl * D);
+  void MarkDeclChanged(StackItem * Item, NamedDecl * D);
+  void RecordLookup(StackItem * Item, NamedDecl * D);
+
+  bool CallerTracksAny(set<NamedDecl *> &Decls, FunctionCall * F);
+  void ContaminateParams(FunctionCall * F, CompilerInstance &CI);
   
   bool FinishedSearchingStack(StackItem * Item, NamedDecl *& TheDecl);
 
-  bool ContaminateAll(TypeMap &Types, string TS, const Type * T, bool IncFirst = false);
+  bool ContaminateAll(TypeMap &Types, TypePath TS, const Type * T, bool IncFirst = false);
   bool ContaminateSwap(TypeMap &TypesLHS,
-                       string TLHS,
+                       TypePath TLHS,
                        TypeMap &TypesRHS,
-                       string TRHS,
+                       TypePath TRHS,
                        const Type * T,
                        bool IncFirst = false);
 
@@ -128,6 +225,10 @@ class DirectiveList {
                   StackItem *Item,
                   DeclTracker * TrackedVars);
 
+  // Whether a function called from Item, or from one it calls, accesses D
+  // or something that may point at it
+  bool CallsAccess(NamedDecl *D, FunctionTracker *FT, StackItem *Item);
+
   set<FullDirective *> GetTopLevelDirectives(SpeculativeFunction * Item);
 
   void GenerateReadOnly(FullDirective * Item,
@@ -139,10 +240,13 @@ class DirectiveList {
  
   DirectiveList(DeclTracker * TrackedVars);
   
-  void CreateTopLevel(PragmaDirective *Directive,
-					  CompoundStmt *Header,
-					  Stmt *S,
-					  CompilerInstance &CI);
+  FullDirective * CreateTopLevel(PragmaDirective *Directive,
+                                 CompoundStmt *Header,
+                                 Stmt *S,
+                                 CompilerInstance &CI);
+
+  // Treats VD as private to FD from here on
+  void InsertInferredPrivate(FullDirective *FD, VarDecl *VD);
   
   FullDirective * Push(PragmaDirective *Directive,
                        CompoundStmt *Header,
@@ -151,13 +255,26 @@ class DirectiveList {
   
   FunctionCall * Push(CallExpr *TheExpr);
   SpeculativeFunction * Push(SpeculativeFunction *TheFunc);
+
+  // Applies a summary of F's function recorded under the same entry state,
+  // in place of traversing its body. Otherwise the traversal should be
+  // wrapped in BeginSummary/EndSummary so the next call can use it. CI is
+  // the caller's.
+  bool ApplySummary(FunctionCall * F, CompilerInstance &CI);
+  void BeginSummary(FunctionCall * F);
+  void EndSummary(FunctionCall * F);
+
+  // For checking a summary against traversing the body it stands in for
+  void SaveStack(StackSnapshot &Snapshot);
+  void RestoreStack(StackSnapshot &Snapshot);
+  static bool SameStack(StackSnapshot &A, StackSnapshot &B);
   
   list<FullDirective *> GetTopLevelDirectives();
   bool InsideTopLevel(Stmt * S);
   list<StackItem *> GetHandlerStartPoints();
             
   bool IsPrivate(DeclRefExpr * Current,
-                 string TS,
+                 TypePath TS,
                  const Type * T,
                  SourceLocation Loc);
 
@@ -170,13 +287,19 @@ class DirectiveList {
   CompoundStmt * GetHeader(SourceLocation Loc);
 
   bool ContaminateDecl(NamedDecl * VDLHS,
-                       string TLHS,
+                       TypePath TLHS,
                        NamedDecl * VDRHS,
-                       string TRHS,
+                       TypePath TRHS,
                        const Type * T);
   
   void GenerateSpecFunctions();
 
+  // Everything looked up between these is recorded against FD. EndTraversal
+  // returns the top level directives that looked up something which has
+  // changed since, and so need traversing again.
+  void BeginTraversal(FullDirective * FD);
+  set<FullDirective *> EndTraversal();
+
   void ResetChangedStatus();
   bool GetChangedStatus();
   void ResetStack();
@@ -203,6 +326,9 @@ class DirectiveList {
 
   bool IsReadOnly(NamedDecl *D);
 
+  // The outermost item the current one was reached from
+  StackItem * GetRootItem();
+
 };
 
 } // End namespace speculation
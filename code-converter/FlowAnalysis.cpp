@@ -0,0 +1,388 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "FlowAnalysis.h"
+
+#include "LoopAnalysis.h"
+#include "Tools.h"
+
+using clang::isa;
+
+using clang::CFGStmt;
+using clang::FunctionDecl;
+using clang::GotoStmt;
+using clang::IndirectGotoStmt;
+
+namespace speculation {
+
+FlowAnalysis::FlowAnalysis(Stmt * Root,
+                           ParentMap &PM,
+                           LoopAnalysis &Loops,
+                           CompilerInstance &CI)
+    : CI(CI),
+      Loops(Loops),
+      Graph(NULL),
+      StmtMap(NULL),
+      Dominators() {
+
+  FunctionDecl * F = tools::GetEnclosingFunction(Root);
+
+  if (!F) {
+    return;
+  }
+
+  CFG::BuildOptions Options;
+  Graph = CFG::buildCFG(F, Root, &CI.getASTContext(), Options);
+
+  if (!Graph) {
+    return;
+  }
+
+  // A goto can land in the middle of a statement, where nothing about what
+  // ran before it inside the statement holds
+  CFG::iterator BlockIt;
+
+  for (BlockIt = Graph->begin(); BlockIt != Graph->end(); BlockIt++) {
+
+    Stmt * Terminator = (*BlockIt)->getTerminator().getStmt();
+
+    if (Terminator
+        && (isa<GotoStmt>(Terminator) || isa<IndirectGotoStmt>(Terminator))) {
+      delete Graph;
+      Graph = NULL;
+      return;
+    }
+
+  }
+
+  StmtMap = CFGStmtMap::Build(Graph, &PM);
+
+  BuildDominators();
+
+}
+
+FlowAnalysis::~FlowAnalysis() {
+  delete StmtMap;
+  delete Graph;
+}
+
+// Private
+void FlowAnalysis::BuildDominators() {
+
+  unsigned NumBlocks = Graph->getNumBlockIDs();
+  llvm::BitVector All(NumBlocks, true);
+
+  Dominators.assign(NumBlocks, All);
+
+  unsigned EntryId = Graph->getEntry().getBlockID();
+  Dominators[EntryId].reset();
+  Dominators[EntryId].set(EntryId);
+
+  // Start points are small enough that iterating until nothing changes is
+  // cheap, whatever order the blocks come in
+  bool Changed = true;
+
+  while (Changed) {
+
+    Changed = false;
+
+    CFG::iterator BlockIt;
+
+    for (BlockIt = Graph->begin(); BlockIt != Graph->end(); BlockIt++) {
+
+      CFGBlock * Block = *BlockIt;
+      unsigned Id = Block->getBlockID();
+
+      if (Id == EntryId) {
+        continue;
+      }
+
+      llvm::BitVector Dominated(All);
+      CFGBlock::pred_iterator PredIt;
+
+      for (PredIt = Block->pred_begin();
+           PredIt != Block->pred_end();
+           PredIt++) {
+
+        // Edges the builder proved can't be taken are left as NULL
+        if (*PredIt) {
+          Dominated &= Dominators[(*PredIt)->getBlockID()];
+        }
+
+      }
+
+      Dominated.set(Id);
+
+      if (Dominated != Dominators[Id]) {
+        Dominators[Id] = Dominated;
+        Changed = true;
+      }
+
+    }
+
+  }
+
+}
+
+// Private
+bool FlowAnalysis::GetPosition(Stmt * S, CFGBlock *&Block, unsigned &Index) {
+
+  Block = StmtMap->getBlock(S);
+
+  if (!Block) {
+    return false;
+  }
+
+  CFGBlock::const_iterator ElementIt;
+  Index = 0;
+
+  for (ElementIt = Block->begin(); ElementIt != Block->end(); ElementIt++) {
+
+    const CFGStmt * Element = ElementIt->getAs<CFGStmt>();
+
+    if (Element && Element->getStmt() == S) {
+      return true;
+    }
+
+    Index++;
+
+  }
+
+  return false;
+
+}
+
+// Private
+void FlowAnalysis::Reach(CFGBlock * Start,
+                         CFGBlock * Stop,
+                         bool Forward,
+                         llvm::BitVector &Reached) {
+
+  Reached.resize(Graph->getNumBlockIDs());
+  Reached.reset();
+
+  vector<CFGBlock *> Worklist(1, Start);
+
+  while (!Worklist.empty()) {
+
+    CFGBlock * Block = Worklist.back();
+    Worklist.pop_back();
+
+    CFGBlock::succ_iterator NextIt = Forward ? Block->succ_begin()
+                                             : Block->pred_begin();
+    CFGBlock::succ_iterator NextEnd = Forward ? Block->succ_end()
+                                              : Block->pred_end();
+
+    for (; NextIt != NextEnd; NextIt++) {
+
+      CFGBlock * Next = *NextIt;
+
+      if (!Next || Next == Stop || Reached.test(Next->getBlockID())) {
+        continue;
+      }
+
+      Reached.set(Next->getBlockID());
+      Worklist.push_back(Next);
+
+    }
+
+  }
+
+}
+
+// Private
+bool FlowAnalysis::MayWrite(CFGBlock * Block,
+                            unsigned Begin,
+                            unsigned End,
+                            NamedDecl * D) {
+
+  CFGBlock::const_iterator ElementIt = Block->begin();
+  unsigned Index = 0;
+
+  for (; ElementIt != Block->end() && Index < End; ElementIt++, Index++) {
+
+    const CFGStmt * Element = ElementIt->getAs<CFGStmt>();
+
+    if (Index < Begin || !Element) {
+      continue;
+    }
+
+    if (Loops.MayWrite(const_cast<Stmt *>(Element->getStmt()), D)) {
+      return true;
+    }
+
+  }
+
+  return false;
+
+}
+
+// Private
+void FlowAnalysis::GetFactsIn(CFGBlock * Block,
+                              vector<llvm::BitVector> &FactsOut,
+                              llvm::BitVector &Facts) {
+
+  bool Entry = Block == &Graph->getEntry();
+
+  Facts = llvm::BitVector(FactsOut[Block->getBlockID()].size(), !Entry);
+
+  if (Entry) {
+    return;
+  }
+
+  CFGBlock::pred_iterator PredIt;
+
+  for (PredIt = Block->pred_begin(); PredIt != Block->pred_end(); PredIt++) {
+
+    if (*PredIt) {
+      Facts &= FactsOut[(*PredIt)->getBlockID()];
+    }
+
+  }
+
+}
+
+// Public
+bool FlowAnalysis::Dominates(Stmt * A, Stmt * B) {
+
+  CFGBlock * BlockA;
+  CFGBlock * BlockB;
+  unsigned IndexA;
+  unsigned IndexB;
+
+  if (!Graph
+      || !GetPosition(A, BlockA, IndexA)
+      || !GetPosition(B, BlockB, IndexB)) {
+    return false;
+  }
+
+  if (BlockA == BlockB) {
+    return IndexA < IndexB;
+  }
+
+  return Dominators[BlockB->getBlockID()].test(BlockA->getBlockID());
+
+}
+
+// Public
+bool FlowAnalysis::MayWriteBetween(Stmt * A, Stmt * B, NamedDecl * D) {
+
+  CFGBlock * BlockA;
+  CFGBlock * BlockB;
+  unsigned IndexA;
+  unsigned IndexB;
+
+  if (!Graph
+      || !GetPosition(A, BlockA, IndexA)
+      || !GetPosition(B, BlockB, IndexB)) {
+    return true;
+  }
+
+  // Leaving the block and coming back in would go through A again
+  if (BlockA == BlockB && IndexA < IndexB) {
+    return MayWrite(BlockA, IndexA, IndexB, D);
+  }
+
+  if (MayWrite(BlockA, IndexA, BlockA->size(), D)
+      || MayWrite(BlockB, 0, IndexB, D)) {
+    return true;
+  }
+
+  // Only blocks on a path from A to B can run in between. B's own block is
+  // among them when there's a way around from B back to itself.
+  llvm::BitVector Between;
+  llvm::BitVector ReachesB;
+
+  Reach(BlockA, BlockA, true, Between);
+  Reach(BlockB, BlockA, false, ReachesB);
+
+  Between &= ReachesB;
+
+  CFG::iterator BlockIt;
+
+  for (BlockIt = Graph->begin(); BlockIt != Graph->end(); BlockIt++) {
+
+    CFGBlock * Block = *BlockIt;
+
+    if (Between.test(Block->getBlockID())
+        && MayWrite(Block, 0, Block->size(), D)) {
+      return true;
+    }
+
+  }
+
+  return false;
+
+}
+
+// Public
+bool FlowAnalysis::Satisfies(FlowTransfer &Transfer, unsigned NumFacts) {
+
+  if (!Graph) {
+    return false;
+  }
+
+  // Everything starts set, apart from at the entry, and is only ever cleared
+  // until nothing changes
+  vector<llvm::BitVector> FactsOut(Graph->getNumBlockIDs(),
+                                   llvm::BitVector(NumFacts, true));
+  llvm::BitVector Facts;
+
+  CFG::iterator BlockIt;
+  CFGBlock::const_iterator ElementIt;
+
+  bool Changed = true;
+
+  while (Changed) {
+
+    Changed = false;
+
+    for (BlockIt = Graph->begin(); BlockIt != Graph->end(); BlockIt++) {
+
+      CFGBlock * Block = *BlockIt;
+      GetFactsIn(Block, FactsOut, Facts);
+
+      for (ElementIt = Block->begin(); ElementIt != Block->end(); ElementIt++) {
+
+        const CFGStmt * Element = ElementIt->getAs<CFGStmt>();
+
+        if (Element) {
+          Transfer.Apply(const_cast<Stmt *>(Element->getStmt()), Facts);
+        }
+
+      }
+
+      if (Facts != FactsOut[Block->getBlockID()]) {
+        FactsOut[Block->getBlockID()] = Facts;
+        Changed = true;
+      }
+
+    }
+
+  }
+
+  for (BlockIt = Graph->begin(); BlockIt != Graph->end(); BlockIt++) {
+
+    CFGBlock * Block = *BlockIt;
+    GetFactsIn(Block, FactsOut, Facts);
+
+    for (ElementIt = Block->begin(); ElementIt != Block->end(); ElementIt++) {
+
+      const CFGStmt * Element = ElementIt->getAs<CFGStmt>();
+
+      if (Element
+          && !Transfer.Apply(const_cast<Stmt *>(Element->getStmt()), Facts)) {
+        return false;
+      }
+
+    }
+
+  }
+
+  return true;
+
+}
+
+} // End namespace speculation
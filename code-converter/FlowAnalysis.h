@@ -0,0 +1,104 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _FLOWANALYSIS_H_
+#define _FLOWANALYSIS_H_
+
+#include "Classes.h"
+
+#include "clang/AST/AST.h"
+#include "clang/AST/ParentMap.h"
+#include "clang/Analysis/CFG.h"
+#include "clang/Analysis/CFGStmtMap.h"
+#include "clang/Frontend/CompilerInstance.h"
+
+#include "llvm/ADT/BitVector.h"
+
+using clang::CFG;
+using clang::CFGBlock;
+using clang::CFGStmtMap;
+using clang::CompilerInstance;
+using clang::NamedDecl;
+using clang::ParentMap;
+using clang::Stmt;
+
+namespace speculation {
+
+// What a statement does to the facts tracked by FlowAnalysis::Satisfies
+class FlowTransfer {
+
+ public:
+
+  virtual ~FlowTransfer() {}
+
+  // Updates Facts for S having run, and returns whether S only needed facts
+  // that were already set
+  virtual bool Apply(Stmt * S, llvm::BitVector &Facts) = 0;
+
+};
+
+// The control flow graph of a handler start point, for asking what runs
+// between two of its statements. Statements are only found when they're a
+// whole element of the graph, and a start point with a goto in it is left
+// alone, so anything it can't answer comes back as the conservative answer.
+class FlowAnalysis {
+
+ private:
+
+  CompilerInstance &CI;
+  LoopAnalysis &Loops;
+
+  CFG * Graph;
+  CFGStmtMap * StmtMap;
+
+  // The blocks that dominate each block, by block id
+  vector<llvm::BitVector> Dominators;
+
+  void BuildDominators();
+
+  // Where S is evaluated, as its block and its position in the block
+  bool GetPosition(Stmt * S, CFGBlock *&Block, unsigned &Index);
+
+  // Every block reachable from Start's successors, or predecessors when
+  // going backwards, without passing through Stop
+  void Reach(CFGBlock * Start,
+             CFGBlock * Stop,
+             bool Forward,
+             llvm::BitVector &Reached);
+
+  bool MayWrite(CFGBlock * Block,
+                unsigned Begin,
+                unsigned End,
+                NamedDecl * D);
+
+  // The facts set on every path to the start of Block
+  void GetFactsIn(CFGBlock * Block,
+                  vector<llvm::BitVector> &FactsOut,
+                  llvm::BitVector &Facts);
+
+ public:
+
+  FlowAnalysis(Stmt * Root,
+               ParentMap &PM,
+               LoopAnalysis &Loops,
+               CompilerInstance &CI);
+  ~FlowAnalysis();
+
+  // Whether every path to B goes through A first
+  bool Dominates(Stmt * A, Stmt * B);
+
+  // Whether D may be written on a path from the start of A to the start of B
+  // that doesn't go through A again. A has to dominate B.
+  bool MayWriteBetween(Stmt * A, Stmt * B, NamedDecl * D);
+
+  // Starting from the root with none of NumFacts set, whether every
+  // statement finds the facts it needs set on every path to it
+  bool Satisfies(FlowTransfer &Transfer, unsigned NumFacts);
+
+};
+
+} // End namespace speculation
+
+#endif
@@ -5,11 +5,15 @@
 
 #include "Globals.h"
 
+#include "Log.h"
 #include "Tools.h"
 
 #include "clang/Basic/FileManager.h"
 #include "clang/Basic/SourceManager.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+
 using clang::ASTContext;
 using clang::DiagnosticsEngine;
 using clang::FileEntry;
@@ -25,17 +29,38 @@ namespace speculation {
 
 namespace globals {
 
-static map<NamedDecl *, CompilerInstance *> CITranslationTable;
+// Everything known about a single global name, across all of the files
+struct GlobalSymbol {
+
+  // The definition every extern var of this name links to
+  NamedDecl * Var;
+  // The function every declaration of this name links to
+  FunctionDecl * Function;
+
+  GlobalSymbol() : Var(NULL), Function(NULL) { }
+
+};
+
+static llvm::StringMap<GlobalSymbol> Symbols;
+
+static GlobalSymbol &GetSymbol(NamedDecl * TheDecl) {
+  return Symbols.GetOrCreateValue(TheDecl->getName()).getValue();
+}
+
+static llvm::DenseMap<NamedDecl *, CompilerInstance *> CITranslationTable;
 
 static set<NamedDecl *> NamedDecls;
 static set<NamedDecl *> ExternNamedDecls;
-static map<NamedDecl *, NamedDecl *> NamedDeclTranslationTable;
+static llvm::DenseMap<NamedDecl *, NamedDecl *> NamedDeclTranslationTable;
 static set<NamedDecl *> ThreadPrivateDecls;
 
+static llvm::DenseMap<NamedDecl *, unsigned> DeclIds;
+static vector<NamedDecl *> IdDecls;
+
 void InsertVarDecl(VarDecl * TheDecl,
                    CompilerInstance &CI) {
 
-  {
+  if (logging::Enabled(logging::Verbose)) {
     DiagnosticsEngine &Diags = CI.getDiagnostics();
 
     unsigned DiagID =
@@ -46,11 +71,21 @@ void InsertVarDecl(VarDecl * TheDecl,
   }
 
   CITranslationTable.insert(make_pair(TheDecl, &CI));
+  GetDeclId(TheDecl);
 
   if (TheDecl->isExternC()) {
     ExternNamedDecls.insert(TheDecl);
   } else {
+
     NamedDecls.insert(TheDecl);
+
+    // The first definition seen under a name is the one everything links to
+    GlobalSymbol &Symbol = GetSymbol(TheDecl);
+
+    if (!Symbol.Var) {
+      Symbol.Var = TheDecl;
+    }
+
   }
   
 }
@@ -62,18 +97,9 @@ void LinkExternDecls() {
        ExternIt != ExternNamedDecls.end();
        ExternIt++) {
 
-    set<NamedDecl *>::iterator VarIt;
-    for (VarIt = NamedDecls.begin();
-         VarIt != NamedDecls.end();
-         VarIt++) {
-
-      if ((*ExternIt)->getName() == (*VarIt)->getName()) {
-        break;
-      }
+    GlobalSymbol &Symbol = GetSymbol(*ExternIt);
 
-    }
-
-    if(VarIt == NamedDecls.end()) {
+    if (!Symbol.Var) {
 
       DiagnosticsEngine &Diags =
               GetCompilerInstance(*ExternIt)->getDiagnostics();
@@ -85,11 +111,12 @@ void LinkExternDecls() {
 
       Diags.Report(DiagID) << (*ExternIt)->getNameAsString();
 
-      VarIt = NamedDecls.insert(*ExternIt).first;
+      NamedDecls.insert(*ExternIt);
+      Symbol.Var = *ExternIt;
 
     }
 
-    NamedDeclTranslationTable.insert(make_pair(*ExternIt, *VarIt));
+    NamedDeclTranslationTable.insert(make_pair(*ExternIt, Symbol.Var));
 
   }
 
@@ -97,7 +124,7 @@ void LinkExternDecls() {
             
 NamedDecl * GetNamedDecl(NamedDecl * TheDecl) {
 
-  map<NamedDecl *, NamedDecl *>::iterator it;
+  llvm::DenseMap<NamedDecl *, NamedDecl *>::iterator it;
   
   it = NamedDeclTranslationTable.find(TheDecl);
   
@@ -113,33 +140,57 @@ set<NamedDecl *> GetAllNamedDecls() {
   return NamedDecls;
 }
 
+unsigned GetDeclId(NamedDecl * TheDecl) {
+
+  assert(TheDecl);
+
+  llvm::DenseMap<NamedDecl *, unsigned>::iterator it;
+  it = DeclIds.find(TheDecl);
+
+  if (it != DeclIds.end()) {
+    return it->second;
+  }
+
+  unsigned Id = IdDecls.size();
+
+  DeclIds.insert(make_pair(TheDecl, Id));
+  IdDecls.push_back(TheDecl);
+
+  return Id;
+
+}
+
+NamedDecl * GetDeclFromId(unsigned Id) {
+
+  assert(Id < IdDecls.size());
+
+  return IdDecls[Id];
+
+}
+
 NamedDecl * InsertThreadPrivate(string Name, CompilerInstance &CI) {
 
-  set<NamedDecl *>::iterator it;
-  
-  for (it = NamedDecls.begin();
-       it != NamedDecls.end();
-       it++) {
-
-    NamedDecl * CurrentDecl = *it;
-    
-    if (CurrentDecl->getNameAsString() == Name) {
-      ThreadPrivateDecls.insert(CurrentDecl);
-
-      {
-        DiagnosticsEngine &Diags = CI.getDiagnostics();
-
-        unsigned DiagID =
-            Diags.getCustomDiagID(DiagnosticsEngine::Warning,
-                                  "Inserting ThreadPrivate Decl '%0' (%1)");
-        Diags.Report(CurrentDecl->getLocStart(), DiagID)
-                    << CurrentDecl->getName()
-                    << (int) CurrentDecl;
-      }
-
-      return CurrentDecl;
+  llvm::StringMap<GlobalSymbol>::iterator SymbolIt = Symbols.find(Name);
+
+  if (SymbolIt != Symbols.end() && SymbolIt->getValue().Var) {
+
+    NamedDecl * CurrentDecl = SymbolIt->getValue().Var;
+
+    ThreadPrivateDecls.insert(CurrentDecl);
+
+    if (logging::Enabled(logging::Verbose)) {
+      DiagnosticsEngine &Diags = CI.getDiagnostics();
+
+      unsigned DiagID =
+          Diags.getCustomDiagID(DiagnosticsEngine::Warning,
+                                "Inserting ThreadPrivate Decl '%0' (%1)");
+      Diags.Report(CurrentDecl->getLocStart(), DiagID)
+                  << CurrentDecl->getName()
+                  << (int) CurrentDecl;
     }
 
+    return CurrentDecl;
+
   }
   
   DiagnosticsEngine &Diags = CI.getDiagnostics();
@@ -155,16 +206,7 @@ NamedDecl * InsertThreadPrivate(string Name, CompilerInstance &CI) {
 }
 
 bool IsThreadPrivate(NamedDecl * TheDecl) {
-
-  set<NamedDecl *>::iterator it;
-  for (it = ThreadPrivateDecls.begin(); it != ThreadPrivateDecls.end(); it++) {
-    if (*it == TheDecl) {
-      break;
-    }
-  }
-  
-  return it != ThreadPrivateDecls.end();
-
+  return ThreadPrivateDecls.find(TheDecl) != ThreadPrivateDecls.end();
 }
 
 set<NamedDecl *> getThreadPrivate() {
@@ -174,14 +216,14 @@ set<NamedDecl *> getThreadPrivate() {
 static set<FunctionDecl *> FilteredFunctions;
 static set<FunctionDecl *> DefinedFunctions;
 static set<FunctionDecl *> UndefinedFunctions;
-static map<FunctionDecl *, FunctionDecl *> FunctionTranslationTable;
+static llvm::DenseMap<FunctionDecl *, FunctionDecl *> FunctionTranslationTable;
 
 // Inserts a local function declaration, in preparation for building a lookup
 // table for functions across multiple files
 void InsertFunctionDecl(FunctionDecl * TheDecl,
                         CompilerInstance &CI) {
 
-  {
+  if (logging::Enabled(logging::Verbose)) {
     DiagnosticsEngine &Diags = CI.getDiagnostics();
 
     unsigned DiagID =
@@ -204,46 +246,50 @@ void InsertFunctionDecl(FunctionDecl * TheDecl,
   }
 
   if (TheDecl->isDefined()) {
+
     DefinedFunctions.insert(TheDecl);
+
+    GlobalSymbol &Symbol = GetSymbol(TheDecl);
+
+    if (!Symbol.Function) {
+      Symbol.Function = TheDecl;
+    }
+
   } else {
     UndefinedFunctions.insert(TheDecl);
   }
 
 }
 
-// Generates the translation table for functiondecl -> implementation
-void LinkExternFunctions() {
+// Links a function declaration to the representative for its name and maps
+// its parameters onto the representative's
+static void LinkFunction(FunctionDecl * TheDecl, FunctionDecl * Target) {
 
-  set<FunctionDecl *>::iterator FuncIt;
-  for (FuncIt = DefinedFunctions.begin();
-       FuncIt != DefinedFunctions.end();
-       FuncIt++) {
+  FunctionTranslationTable.insert(make_pair(TheDecl, Target));
 
-    set<FunctionDecl *>::iterator FiltIt;
-    for (FiltIt = FilteredFunctions.begin();
-         FiltIt != FilteredFunctions.end();
-         FiltIt++) {
+  FunctionDecl::param_iterator Pit, FPit;
+  for (Pit = TheDecl->param_begin(), FPit = Target->param_begin();
+       Pit != TheDecl->param_end() && FPit != Target->param_end();
+       Pit++, FPit++) {
 
-      if ((*FuncIt)->getName() == (*FiltIt)->getName()) {
-        break;
-      }
+    NamedDeclTranslationTable.insert(make_pair(*Pit, *FPit));
 
-    }
+  }
 
-    if(FiltIt == FilteredFunctions.end()) {
-      FiltIt = FilteredFunctions.insert(*FuncIt).first;
-    }
+}
 
-    FunctionTranslationTable.insert(make_pair(*FuncIt, *FiltIt));
+// Generates the translation table for functiondecl -> implementation
+void LinkExternFunctions() {
 
-    FunctionDecl::param_iterator Pit, FPit;
-    for (Pit = (*FuncIt)->param_begin(), FPit = (*FiltIt)->param_begin();
-         Pit != (*FuncIt)->param_end() && FPit != (*FiltIt)->param_end();
-         Pit++, FPit++) {
+  set<FunctionDecl *>::iterator FuncIt;
+  for (FuncIt = DefinedFunctions.begin();
+       FuncIt != DefinedFunctions.end();
+       FuncIt++) {
 
-      NamedDeclTranslationTable.insert(make_pair(*Pit, *FPit));
+    FunctionDecl * Target = GetSymbol(*FuncIt).Function;
 
-    }
+    FilteredFunctions.insert(Target);
+    LinkFunction(*FuncIt, Target);
 
   }
 
@@ -251,18 +297,9 @@ void LinkExternFunctions() {
        FuncIt != UndefinedFunctions.end();
        FuncIt++) {
 
-    set<FunctionDecl *>::iterator FiltIt;
-    for (FiltIt = FilteredFunctions.begin();
-         FiltIt != FilteredFunctions.end();
-         FiltIt++) {
-
-      if ((*FuncIt)->getName() == (*FiltIt)->getName()) {
-        break;
-      }
+    GlobalSymbol &Symbol = GetSymbol(*FuncIt);
 
-    }
-
-    if(FiltIt == FilteredFunctions.end()) {
+    if (!Symbol.Function) {
 
       DiagnosticsEngine &Diags = GetCompilerInstance(*FuncIt)->getDiagnostics();
 
@@ -273,21 +310,12 @@ void LinkExternFunctions() {
 
       Diags.Report(DiagID) << (*FuncIt)->getNameAsString();
 
-      FiltIt = FilteredFunctions.insert(*FuncIt).first;
-
-    }
-
-    FunctionTranslationTable.insert(make_pair(*FuncIt, *FiltIt));
-
-    FunctionDecl::param_iterator Pit, FPit;
-    for (Pit = (*FuncIt)->param_begin(), FPit = (*FiltIt)->param_begin();
-         Pit != (*FuncIt)->param_end() && FPit != (*FiltIt)->param_end();
-         Pit++, FPit++) {
-
-      NamedDeclTranslationTable.insert(make_pair(*Pit, *FPit));
+      FilteredFunctions.insert(*FuncIt);
+      Symbol.Function = *FuncIt;
 
     }
 
+    LinkFunction(*FuncIt, Symbol.Function);
 
   }
 
@@ -295,7 +323,7 @@ void LinkExternFunctions() {
 
 FunctionDecl * GetFunctionDecl(FunctionDecl * TheDecl) {
 
-  map<FunctionDecl *, FunctionDecl *>::iterator FuncIt;
+  llvm::DenseMap<FunctionDecl *, FunctionDecl *>::iterator FuncIt;
   
   FuncIt = FunctionTranslationTable.find(TheDecl);
   
@@ -313,7 +341,7 @@ set<FunctionDecl *> GetAllFunctionDecls() {
 
 CompilerInstance *GetCompilerInstance(NamedDecl * TheDecl) {
 
-  map<NamedDecl *, CompilerInstance *>::iterator DeclIt;
+  llvm::DenseMap<NamedDecl *, CompilerInstance *>::iterator DeclIt;
   
   DeclIt = CITranslationTable.find(TheDecl);
   
@@ -327,25 +355,25 @@ CompilerInstance *GetCompilerInstance(NamedDecl * TheDecl) {
 }
 
 vector<CompilerInstance *> CIs;
-map<CompilerInstance *, Rewriter *> Rewriters;
+// Held by value so they go away with the map, std::map never moves them
+map<CompilerInstance *, Rewriter> Rewriters;
 
 void RegisterCompilerInstance(CompilerInstance &CI) {
 
   CIs.push_back(&CI);
 
-  Rewriter * rw = new Rewriter(CI.getSourceManager(), CI.getLangOpts());
-  Rewriters.insert(make_pair(&CI, rw));
+  Rewriters[&CI].setSourceMgr(CI.getSourceManager(), CI.getLangOpts());
 
 }
 
 Rewriter &GetRewriter(CompilerInstance &CI) {
 
-  map<CompilerInstance *, Rewriter *>::iterator it;
+  map<CompilerInstance *, Rewriter>::iterator it;
   it = Rewriters.find(&CI);
 
   assert(it != Rewriters.end());
 
-  return *(it->second);
+  return it->second;
 
 }
 
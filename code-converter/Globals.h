@@ -12,6 +12,8 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Rewrite/Core/Rewriter.h"
 
+#include "llvm/ADT/SparseBitVector.h"
+
 using clang::CompilerInstance;
 using clang::Decl;
 using clang::FunctionDecl;
@@ -22,6 +24,9 @@ using clang::VarDecl;
 
 namespace speculation {
 
+// A set of decls, by their globals::GetDeclId
+typedef llvm::SparseBitVector<> DeclSet;
+
 namespace globals {
 
 void InsertVarDecl(VarDecl * TheDecl, CompilerInstance &CI);
@@ -29,6 +34,11 @@ void LinkExternDecls();
 NamedDecl * GetNamedDecl(NamedDecl * TheDecl);
 set<NamedDecl *> GetAllNamedDecls();
 
+// Every decl gets a small, dense id the first time it's asked for, so that
+// sets of decls can be stored as bitsets
+unsigned GetDeclId(NamedDecl * TheDecl);
+NamedDecl * GetDeclFromId(unsigned Id);
+
 NamedDecl * InsertThreadPrivate(string Name, CompilerInstance &CI);
 bool IsThreadPrivate(NamedDecl * TheDecl);
 set<NamedDecl *> getThreadPrivate();
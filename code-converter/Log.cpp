@@ -0,0 +1,62 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "Log.h"
+
+namespace speculation {
+
+namespace logging {
+
+static unsigned CurrentLevel = Quiet;
+static bool Dumps[NumDumps];
+
+void SetLevel(unsigned L) {
+  CurrentLevel = L;
+}
+
+void EnableDump(Dump D) {
+
+  assert(D < NumDumps);
+
+  Dumps[D] = true;
+
+}
+
+bool Enabled(Level L) {
+  return CurrentLevel >= (unsigned) L;
+}
+
+bool Dumping(Dump D) {
+
+  assert(D < NumDumps);
+
+  return Dumps[D];
+
+}
+
+llvm::raw_ostream & Out() {
+
+  // Not closed with the object, stderr outlives it. Its destructor flushes
+  // whatever is left at exit.
+  static llvm::raw_fd_ostream Stream(2, false);
+  static bool Initialised = false;
+
+  // raw_fd_ostream won't buffer a terminal on its own
+  if (!Initialised) {
+    Stream.SetBufferSize(1 << 16);
+    Initialised = true;
+  }
+
+  return Stream;
+
+}
+
+void Flush() {
+  Out().flush();
+}
+
+} // End namespace logging
+
+} // End namespace speculation
@@ -0,0 +1,49 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include "Classes.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+namespace speculation {
+
+namespace logging {
+
+enum Level {
+  Quiet,      // Errors and warnings about the input only
+  Progress,   // Stage banners and the files being worked on
+  Verbose,    // Each directive, function and global as it's found
+  Debug       // Everything the analysis does along the way
+};
+
+enum Dump {
+  TrackersDump,   // Every FunctionTracker once pointers have been tracked
+  StackDump,      // Each directive and function call as it's created
+  RewrittenDump,  // The rewritten text of every file
+  NumDumps
+};
+
+void SetLevel(unsigned L);
+void EnableDump(Dump D);
+
+// Callers check these before building any output, so that nothing is
+// formatted at all for messages that won't be shown.
+bool Enabled(Level L);
+bool Dumping(Dump D);
+
+// A buffered stream onto stderr. Everything printed by the converter,
+// including the parser's diagnostics, goes through here so that it stays in
+// order. Flushed on exit.
+llvm::raw_ostream & Out();
+void Flush();
+
+} // End namespace logging
+
+} // End namespace speculation
+
+#endif
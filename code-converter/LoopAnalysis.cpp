@@ -0,0 +1,621 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "LoopAnalysis.h"
+
+#include "DeclExtractor.h"
+#include "Globals.h"
+#include "Tools.h"
+
+#include "clang/AST/RecursiveASTVisitor.h"
+
+#include "llvm/ADT/APSInt.h"
+
+using clang::dyn_cast;
+using clang::isa;
+
+using clang::BinaryOperator;
+using clang::BreakStmt;
+using clang::CallExpr;
+using clang::ContinueStmt;
+using clang::DeclRefExpr;
+using clang::DeclStmt;
+using clang::GotoStmt;
+using clang::IndirectGotoStmt;
+using clang::QualType;
+using clang::RecursiveASTVisitor;
+using clang::ReturnStmt;
+using clang::UnaryOperator;
+using clang::VarDecl;
+
+namespace speculation {
+
+// Looks for anything in a statement that may change a variable: assigning,
+// incrementing or taking the address of it, writing through an lvalue of its
+// type, or calling a function that could write it as a global. The last two
+// only count when the variable is Aliased, i.e. a pointer could reach it.
+class WriteFinder
+    : public RecursiveASTVisitor<WriteFinder> {
+
+ private:
+
+  NamedDecl *D;
+  const Type *T;
+  bool Aliased;
+  bool Found;
+
+  bool RefersTo(Expr *E) {
+
+    DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+
+    return Ref && globals::GetNamedDecl(Ref->getFoundDecl()) == D;
+
+  }
+
+  void CheckWrite(Expr *E) {
+
+    E = E->IgnoreParenImpCasts();
+
+    if (isa<DeclRefExpr>(E)) {
+      Found |= RefersTo(E);
+    } else {
+      // Through a pointer, which could point at it
+      Found |= Aliased && GetCanonicalType(E->getType()) == T;
+    }
+
+  }
+
+ public:
+
+  static const Type * GetCanonicalType(QualType QT) {
+    return QT.getCanonicalType().getUnqualifiedType().getTypePtr();
+  }
+
+  WriteFinder(NamedDecl *D, QualType QT, bool Aliased)
+      : RecursiveASTVisitor<WriteFinder>(),
+        D(D),
+        T(GetCanonicalType(QT)),
+        Aliased(Aliased),
+        Found(false) {
+
+  }
+
+  bool FoundWrite() {
+    return Found;
+  }
+
+  bool VisitBinaryOperator(BinaryOperator *E) {
+
+    if (E->isAssignmentOp()) {
+      CheckWrite(E->getLHS());
+    }
+
+    return !Found;
+
+  }
+
+  bool VisitUnaryOperator(UnaryOperator *E) {
+
+    if (E->isIncrementDecrementOp()) {
+      CheckWrite(E->getSubExpr());
+    } else if (E->getOpcode() == clang::UO_AddrOf) {
+      Found |= RefersTo(E->getSubExpr());
+    }
+
+    return !Found;
+
+  }
+
+  bool VisitCallExpr(CallExpr *E) {
+
+    if (!Aliased) {
+      return true;
+    }
+
+    // Library builtins such as sqrt can't know about the program's globals,
+    // so only reach its variables through pointers they're given
+    FunctionDecl *F = E->getDirectCallee();
+
+    if (!F || !F->getBuiltinID()) {
+      Found = true;
+      return false;
+    }
+
+    for (unsigned i = 0; i < E->getNumArgs(); i++) {
+      Found |= E->getArg(i)->getType()->isPointerType();
+    }
+
+    return !Found;
+
+  }
+
+};
+
+// Looks for the address of a variable being taken
+class AddressFinder
+    : public RecursiveASTVisitor<AddressFinder> {
+
+ private:
+
+  NamedDecl *D;
+  bool Found;
+
+ public:
+
+  AddressFinder(NamedDecl *D)
+      : RecursiveASTVisitor<AddressFinder>(),
+        D(D),
+        Found(false) {
+
+  }
+
+  bool FoundAddress() {
+    return Found;
+  }
+
+  bool VisitUnaryOperator(UnaryOperator *E) {
+
+    if (E->getOpcode() == clang::UO_AddrOf) {
+
+      DeclRefExpr *Ref
+          = dyn_cast<DeclRefExpr>(E->getSubExpr()->IgnoreParenImpCasts());
+
+      Found |= Ref && globals::GetNamedDecl(Ref->getFoundDecl()) == D;
+
+    }
+
+    return !Found;
+
+  }
+
+};
+
+// Looks for anything that leaves an iteration early. Jumps out of loops
+// nested inside count too, which keeps it simple at the cost of a few loops.
+class JumpFinder
+    : public RecursiveASTVisitor<JumpFinder> {
+
+ private:
+
+  bool Found;
+
+ public:
+
+  JumpFinder()
+      : RecursiveASTVisitor<JumpFinder>(),
+        Found(false) {
+
+  }
+
+  bool FoundJump() {
+    return Found;
+  }
+
+  bool VisitStmt(Stmt *S) {
+
+    Found = isa<BreakStmt>(S)
+            || isa<ContinueStmt>(S)
+            || isa<ReturnStmt>(S)
+            || isa<GotoStmt>(S)
+            || isa<IndirectGotoStmt>(S);
+
+    return !Found;
+
+  }
+
+};
+
+LoopAnalysis::LoopAnalysis(CompilerInstance &CI)
+    : CI(CI),
+      LoopWrites(),
+      AliasedDecls() {
+
+}
+
+// Private
+bool LoopAnalysis::GetConstant(Expr * E, int &Value) {
+
+  llvm::APSInt Result;
+
+  if (!E->EvaluateAsInt(Result, CI.getASTContext())
+      || Result.getMinSignedBits() > 32) {
+    return false;
+  }
+
+  Value = static_cast<int>(Result.getSExtValue());
+
+  return true;
+
+}
+
+// Private
+bool LoopAnalysis::RefersTo(Expr * E, NamedDecl * D) {
+
+  DeclRefExpr * Ref = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+
+  return Ref && globals::GetNamedDecl(Ref->getFoundDecl()) == D;
+
+}
+
+// Public
+bool LoopAnalysis::MayBeAliased(VarDecl * VD) {
+
+  map<NamedDecl *, bool>::iterator AliasedIt = AliasedDecls.find(VD);
+
+  if (AliasedIt != AliasedDecls.end()) {
+    return AliasedIt->second;
+  }
+
+  // A C local can only be reached through a pointer once its address has
+  // been taken, which has to happen in its own function. C++ references
+  // bind to it without one.
+  bool Aliased = true;
+
+  FunctionDecl * F = dyn_cast<FunctionDecl>(VD->getDeclContext());
+
+  if (VD->hasLocalStorage()
+      && !CI.getLangOpts().CPlusPlus
+      && F
+      && F->hasBody()) {
+
+    AddressFinder Finder(VD);
+    Finder.TraverseStmt(F->getBody());
+
+    Aliased = Finder.FoundAddress();
+
+  }
+
+  AliasedDecls.insert(make_pair(VD, Aliased));
+
+  return Aliased;
+
+}
+
+// Public
+bool LoopAnalysis::MayWrite(Stmt * Loop, NamedDecl * D) {
+
+  pair<Stmt *, NamedDecl *> Key(Loop, D);
+  map<pair<Stmt *, NamedDecl *>, bool>::iterator WriteIt;
+
+  WriteIt = LoopWrites.find(Key);
+
+  if (WriteIt != LoopWrites.end()) {
+    return WriteIt->second;
+  }
+
+  VarDecl * VD = dyn_cast<VarDecl>(D);
+  assert(VD);
+
+  WriteFinder Finder(D, VD->getType(), MayBeAliased(VD));
+  Finder.TraverseStmt(Loop);
+
+  LoopWrites.insert(make_pair(Key, Finder.FoundWrite()));
+
+  return Finder.FoundWrite();
+
+}
+
+// Public
+bool LoopAnalysis::HasJumps(Stmt * S) {
+
+  JumpFinder Finder;
+  Finder.TraverseStmt(S);
+
+  return Finder.FoundJump();
+
+}
+
+// Public
+bool LoopAnalysis::IsInvariant(Expr * E, CanonicalLoop &Canonical) {
+
+  if (E->HasSideEffects(CI.getASTContext())) {
+    return false;
+  }
+
+  set<NamedDecl *> Decls;
+  DeclExtractor Extractor(Decls);
+  Extractor.TraverseStmt(E);
+
+  set<NamedDecl *>::iterator DeclIt;
+
+  for (DeclIt = Decls.begin(); DeclIt != Decls.end(); DeclIt++) {
+
+    VarDecl * VD = dyn_cast<VarDecl>(*DeclIt);
+
+    if (!VD) {
+      continue;
+    }
+
+    if (Canonical.Private.count(VD->getIdentifier())
+        || tools::InsideRange(VD->getLocation(),
+                              Canonical.Loop->getSourceRange(),
+                              CI)
+        || MayWrite(Canonical.Loop, VD)) {
+      return false;
+    }
+
+  }
+
+  return true;
+
+}
+
+// Public
+bool LoopAnalysis::GetCanonicalLoop(ForStmt * Loop, CanonicalLoop &Canonical) {
+
+  Canonical.Loop = Loop;
+
+  Stmt * Init = Loop->getInit();
+  Expr * Cond = Loop->getCond();
+  Expr * Inc = Loop->getInc();
+
+  if (!Init || !Cond || !Inc) {
+    return false;
+  }
+
+  // Init, either "i = Begin" or "int i = Begin"
+  Expr * Begin = NULL;
+
+  if (BinaryOperator * Assign = dyn_cast<BinaryOperator>(Init)) {
+
+    DeclRefExpr * Ref
+        = dyn_cast<DeclRefExpr>(Assign->getLHS()->IgnoreParenImpCasts());
+
+    if (Assign->getOpcode() != clang::BO_Assign || !Ref) {
+      return false;
+    }
+
+    Canonical.Induction = globals::GetNamedDecl(Ref->getFoundDecl());
+    Begin = Assign->getRHS();
+
+  } else if (DeclStmt * DS = dyn_cast<DeclStmt>(Init)) {
+
+    VarDecl * VD = DS->isSingleDecl()
+                   ? dyn_cast<VarDecl>(DS->getSingleDecl())
+                   : NULL;
+
+    if (!VD || !VD->getInit()) {
+      return false;
+    }
+
+    Canonical.Induction = VD;
+    Begin = VD->getInit();
+
+  } else {
+    return false;
+  }
+
+  VarDecl * Induction = dyn_cast<VarDecl>(Canonical.Induction);
+
+  if (!Induction || !Induction->getType()->isIntegerType()) {
+    return false;
+  }
+
+  // Cond, "i < End" or "i <= End"
+  BinaryOperator * Compare = dyn_cast<BinaryOperator>(Cond);
+
+  if (!Compare
+      || !RefersTo(Compare->getLHS(), Induction)
+      || (Compare->getOpcode() != clang::BO_LT
+          && Compare->getOpcode() != clang::BO_LE)) {
+    return false;
+  }
+
+  Expr * End = Compare->getRHS();
+
+  // Inc, "i++", "++i", "i += Step" or "i = i + Step"
+  Expr * Step = NULL;
+
+  if (UnaryOperator * Unary = dyn_cast<UnaryOperator>(Inc)) {
+
+    if (!Unary->isIncrementOp() || !RefersTo(Unary->getSubExpr(), Induction)) {
+      return false;
+    }
+
+    Canonical.Step = 1;
+
+  } else if (BinaryOperator * Binary = dyn_cast<BinaryOperator>(Inc)) {
+
+    if (!RefersTo(Binary->getLHS(), Induction)) {
+      return false;
+    }
+
+    if (Binary->getOpcode() == clang::BO_AddAssign) {
+
+      Step = Binary->getRHS();
+
+    } else if (Binary->getOpcode() == clang::BO_Assign) {
+
+      BinaryOperator * Add
+          = dyn_cast<BinaryOperator>(Binary->getRHS()->IgnoreParenImpCasts());
+
+      if (!Add || Add->getOpcode() != clang::BO_Add) {
+        return false;
+      }
+
+      if (RefersTo(Add->getLHS(), Induction)) {
+        Step = Add->getRHS();
+      } else if (RefersTo(Add->getRHS(), Induction)) {
+        Step = Add->getLHS();
+      }
+
+    }
+
+    if (!Step || !GetConstant(Step, Canonical.Step)) {
+      return false;
+    }
+
+  } else {
+    return false;
+  }
+
+  if (Canonical.Step <= 0
+      || !IsInvariant(Begin, Canonical)
+      || !IsInvariant(End, Canonical)) {
+    return false;
+  }
+
+  Canonical.Begin = tools::GetStmtString(Begin, CI);
+  Canonical.End = tools::GetStmtString(End, CI);
+
+  if (Compare->getOpcode() == clang::BO_LE) {
+    Canonical.End = "(" + Canonical.End + ") + 1";
+  }
+
+  return true;
+
+}
+
+// Public
+bool LoopAnalysis::GetAffineIndex(Expr * E,
+                                  CanonicalLoop &Canonical,
+                                  AffineIndex &Index) {
+
+  E = E->IgnoreParenImpCasts();
+
+  if (RefersTo(E, Canonical.Induction)) {
+    Index.Scale = 1;
+    Index.Offset = "0";
+    Index.Symbolic = "0";
+    Index.Constant = 0;
+    return true;
+  }
+
+  BinaryOperator * Binary = dyn_cast<BinaryOperator>(E);
+
+  if (Binary && (Binary->getOpcode() == clang::BO_Add
+                 || Binary->getOpcode() == clang::BO_Sub)) {
+
+    AffineIndex LHS;
+    AffineIndex RHS;
+
+    if (!GetAffineIndex(Binary->getLHS(), Canonical, LHS)
+        || !GetAffineIndex(Binary->getRHS(), Canonical, RHS)) {
+      return false;
+    }
+
+    bool Add = Binary->getOpcode() == clang::BO_Add;
+
+    Index.Scale = Add ? LHS.Scale + RHS.Scale : LHS.Scale - RHS.Scale;
+
+    if (RHS.Offset == "0") {
+      Index.Offset = LHS.Offset;
+    } else if (LHS.Offset == "0" && Add) {
+      Index.Offset = RHS.Offset;
+    } else {
+      Index.Offset = LHS.Offset + (Add ? " + " : " - ") + RHS.Offset;
+    }
+
+    Index.Constant = Add ? LHS.Constant + RHS.Constant
+                         : LHS.Constant - RHS.Constant;
+
+    if (RHS.Symbolic == "0") {
+      Index.Symbolic = LHS.Symbolic;
+    } else if (LHS.Symbolic == "0" && Add) {
+      Index.Symbolic = RHS.Symbolic;
+    } else {
+      Index.Symbolic = LHS.Symbolic + (Add ? " + " : " - ") + RHS.Symbolic;
+    }
+
+    return true;
+
+  }
+
+  if (Binary && Binary->getOpcode() == clang::BO_Mul) {
+
+    int Factor;
+    AffineIndex Other;
+
+    if (GetConstant(Binary->getLHS(), Factor)) {
+      if (!GetAffineIndex(Binary->getRHS(), Canonical, Other)) {
+        return false;
+      }
+    } else if (GetConstant(Binary->getRHS(), Factor)) {
+      if (!GetAffineIndex(Binary->getLHS(), Canonical, Other)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+
+    stringstream Offset;
+    stringstream Symbolic;
+
+    if (Other.Offset == "0") {
+      Offset << "0";
+    } else {
+      Offset << Factor << " * (" << Other.Offset << ")";
+    }
+
+    if (Other.Symbolic == "0") {
+      Symbolic << "0";
+    } else {
+      Symbolic << Factor << " * (" << Other.Symbolic << ")";
+    }
+
+    Index.Scale = Factor * Other.Scale;
+    Index.Offset = Offset.str();
+    Index.Symbolic = Symbolic.str();
+    Index.Constant = Factor * Other.Constant;
+
+    return true;
+
+  }
+
+  // Anything else has to be the same on every iteration
+  if (!IsInvariant(E, Canonical)) {
+    return false;
+  }
+
+  Index.Scale = 0;
+  Index.Offset = "(" + tools::GetStmtString(E, CI) + ")";
+
+  if (GetConstant(E, Index.Constant)) {
+    Index.Symbolic = "0";
+  } else {
+    Index.Symbolic = Index.Offset;
+    Index.Constant = 0;
+  }
+
+  return true;
+
+}
+
+// Public
+bool LoopAnalysis::MayDepend(AffineIndex &A, AffineIndex &B) {
+
+  if (A.Symbolic != B.Symbolic) {
+    return true;
+  }
+
+  // A.Scale * i + A.Constant == B.Scale * j + B.Constant, for i != j
+  int Difference = B.Constant - A.Constant;
+
+  if (A.Scale == B.Scale && Difference == 0) {
+    // The same element only on the same iteration, unless it's the same
+    // element on all of them
+    return A.Scale == 0;
+  }
+
+  int X = A.Scale < 0 ? -A.Scale : A.Scale;
+  int Y = B.Scale < 0 ? -B.Scale : B.Scale;
+
+  while (Y != 0) {
+    int Remainder = X % Y;
+    X = Y;
+    Y = Remainder;
+  }
+
+  // Two fixed elements, which are either the same or never are
+  if (X == 0) {
+    return Difference == 0;
+  }
+
+  // There's no integer solution unless the GCD divides the difference
+  return Difference % X == 0;
+
+}
+
+} // End namespace speculation
@@ -0,0 +1,96 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _LOOPANALYSIS_H_
+#define _LOOPANALYSIS_H_
+
+#include "Classes.h"
+
+#include "clang/AST/AST.h"
+#include "clang/Frontend/CompilerInstance.h"
+
+using clang::CompilerInstance;
+using clang::Expr;
+using clang::ForStmt;
+using clang::IdentifierInfo;
+using clang::NamedDecl;
+using clang::Stmt;
+using clang::VarDecl;
+
+namespace speculation {
+
+// for (Induction = Begin; Induction < End; Induction += Step), with Step
+// positive. Begin and End are source text that gives the same value in front
+// of the loop as in it.
+struct CanonicalLoop {
+  ForStmt *Loop;
+  NamedDecl *Induction;
+  string Begin;
+  string End;
+  int Step;
+  // Variables with their own copy inside the loop, which can't be read in
+  // front of it
+  set<IdentifierInfo *> Private;
+};
+
+// Scale * Induction + Offset, where Offset is source text that gives the same
+// value in front of the loop as in it. Offset is also split into Symbolic, the
+// text of its parts that aren't constant ("0" if none), plus Constant, so two
+// indices can be compared.
+struct AffineIndex {
+  int Scale;
+  string Offset;
+  string Symbolic;
+  int Constant;
+};
+
+class LoopAnalysis {
+
+ private:
+
+  CompilerInstance &CI;
+
+  // Whether each loop may write each decl, as found so far
+  map<pair<Stmt *, NamedDecl *>, bool> LoopWrites;
+
+  // Whether each decl may be reached through a pointer, as found so far
+  map<NamedDecl *, bool> AliasedDecls;
+
+  bool GetConstant(Expr * E, int &Value);
+  bool RefersTo(Expr * E, NamedDecl * D);
+
+ public:
+
+  LoopAnalysis(CompilerInstance &CI);
+
+  // Whether VD could be reached through a pointer or from a call, which is
+  // ruled out only for a C local whose address is never taken
+  bool MayBeAliased(VarDecl * VD);
+
+  // Conservative: anything that might write D, directly, through a pointer
+  // or from a call, counts. Loop can be any statement.
+  bool MayWrite(Stmt * Loop, NamedDecl * D);
+
+  // Whether S can transfer control out of the middle of an iteration
+  bool HasJumps(Stmt * S);
+
+  // Whether E can be evaluated in front of Loop to the same value it has
+  // anywhere inside
+  bool IsInvariant(Expr * E, CanonicalLoop &Canonical);
+
+  // Fills in everything but Private, which must already be set
+  bool GetCanonicalLoop(ForStmt * Loop, CanonicalLoop &Canonical);
+
+  bool GetAffineIndex(Expr * E, CanonicalLoop &Canonical, AffineIndex &Index);
+
+  // Whether A on one iteration and B on another can be the same element. A
+  // GCD test, so only indices whose symbolic parts match can be told apart.
+  bool MayDepend(AffineIndex &A, AffineIndex &B);
+
+};
+
+} // End namespace speculation
+
+#endif
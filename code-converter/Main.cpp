@@ -3,16 +3,21 @@
 // License. See LICENSE.TXT for details.
 //=============================================================================
 
+#include "ASTCache.h"
 #include "BaseASTConsumer.h"
+#include "CompileFlags.h"
 #include "DeclLinker.h"
 #include "DeclTracker.h"
 #include "DirectiveFinder.h"
 #include "DirectiveHandler.h"
 #include "DirectiveList.h"
-#include "FakeDirectiveHandler.h"
 #include "Globals.h"
+#include "Log.h"
 #include "OMPPragmaHandler.h"
+#include "OutputDirectory.h"
 #include "PragmaDirective.h"
+#include "RewritePlan.h"
+#include "Statistics.h"
 #include "VarCollector.h"
 #include "Tools.h"
 
@@ -23,14 +28,27 @@
 #include "clang/Basic/SourceManager.h"
 #include "clang/Basic/TargetInfo.h"
 #include "clang/Basic/TargetOptions.h"
+#include "clang/Basic/Version.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Driver/DriverDiagnostic.h"
+#include "clang/Lex/Lexer.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Parse/ParseAST.h"
 #include "clang/Parse/Parser.h"
+#include "clang/Serialization/ASTWriter.h"
+#include "clang/Tooling/CompilationDatabase.h"
 
 #include "llvm/Support/CommandLine.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PathV2.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
 
 using clang::ASTConsumer;
 using clang::ASTContext;
@@ -43,8 +61,10 @@ using clang::HeaderSearchOptions;
 using clang::Parser;
 using clang::TargetInfo;
 using clang::TargetOptions;
+using clang::TextDiagnosticPrinter;
 using clang::Token;
 using clang::VarDecl;
+using clang::tooling::CompilationDatabase;
 
 using clang::FunctionDecl;
 
@@ -59,12 +79,102 @@ using std::string;
 
 llvm::cl::list<string> InputFilenames(llvm::cl::Positional,
                                       llvm::cl::desc("<Input files>"),
-                                      llvm::cl::OneOrMore);
+                                      llvm::cl::ZeroOrMore);
 
 llvm::cl::list<string> IncludeDirectories("I",
                                           llvm::cl::desc("Include a Directory"),
                                           llvm::cl::ZeroOrMore);
 
+llvm::cl::opt<string> BuildPath("p",
+                                llvm::cl::desc("Build directory holding a "
+                                               "compile_commands.json to take "
+                                               "each file's flags from. "
+                                               "Converts every file in it if "
+                                               "none are given"),
+                                llvm::cl::init(""));
+
+llvm::cl::list<string> PCHHeaders("pch-include",
+                                  llvm::cl::desc("Precompile a system header "
+                                                 "once and share it between "
+                                                 "every input file"),
+                                  llvm::cl::ZeroOrMore);
+
+llvm::cl::opt<string> PCHDirectory("pch-dir",
+                                   llvm::cl::desc("Directory to build the "
+                                                  "precompiled header in"),
+                                   llvm::cl::init(""));
+
+llvm::cl::opt<string> CacheDirectory("cache-dir",
+                                     llvm::cl::desc("Reuse the parsed ASTs of "
+                                                    "unchanged files stored "
+                                                    "in this directory"),
+                                     llvm::cl::init(""));
+
+llvm::cl::opt<string> OutputDir("o",
+                                llvm::cl::desc("Write the rewritten sources "
+                                               "under this directory instead "
+                                               "of overwriting them"),
+                                llvm::cl::init(""));
+
+llvm::cl::opt<string> EmitPlan("emit-plan",
+                               llvm::cl::desc("Write every edit to this file "
+                                              "instead of to the sources"),
+                               llvm::cl::init(""));
+
+llvm::cl::opt<string> ApplyPlan("apply-plan",
+                                llvm::cl::desc("Apply the edits in a file "
+                                               "written by -emit-plan, "
+                                               "without any analysis"),
+                                llvm::cl::init(""));
+
+llvm::cl::opt<bool> Stats("stats",
+                          llvm::cl::desc("Print the time and memory each "
+                                         "stage took and what was found "
+                                         "along the way"),
+                          llvm::cl::init(false));
+
+llvm::cl::opt<bool> TimeStages("time-stages",
+                               llvm::cl::desc("Print the time and memory "
+                                              "each stage took"),
+                               llvm::cl::init(false));
+
+llvm::cl::opt<string> StatsJSON("stats-json",
+                                llvm::cl::desc("Write the -stats report to "
+                                               "this file as JSON"),
+                                llvm::cl::init(""));
+
+llvm::cl::opt<unsigned> Verbosity("v",
+                                  llvm::cl::desc("How much to print: 1 for "
+                                                 "each stage, 2 for what it "
+                                                 "finds, 3 for everything"),
+                                  llvm::cl::init(0));
+
+llvm::cl::opt<bool> DumpTrackers("dump-trackers",
+                                 llvm::cl::desc("Print every function's "
+                                                "pointer tracker"),
+                                 llvm::cl::init(false));
+
+llvm::cl::opt<bool> DumpStack("dump-stack",
+                              llvm::cl::desc("Print each directive and "
+                                             "function call as it's created"),
+                              llvm::cl::init(false));
+
+llvm::cl::opt<bool> DumpRewritten("dump-rewritten",
+                                  llvm::cl::desc("Print the rewritten text of "
+                                                 "every file"),
+                                  llvm::cl::init(false));
+
+llvm::cl::opt<bool> VerifySummaries("verify-summaries",
+                                     llvm::cl::desc("Check every function "
+                                                    "summary used against "
+                                                    "traversing the body"),
+                                     llvm::cl::init(false));
+
+llvm::cl::opt<unsigned> Jobs("j",
+                             llvm::cl::desc("Number of files to parse in "
+                                            "parallel"),
+                             llvm::cl::init(1));
+
 string sysincludes[] = {
   "/usr/local/include",
   "/home/s0347677/clang/out/bin/../lib/clang/3.2/include",
@@ -97,11 +207,483 @@ void addSysIncludes(HeaderSearchOptions &headopts) {
 
 }
 
+// Sets up everything up to and including the Preprocessor. A NULL Client
+// reports straight to the log. Flags come on top of the usual includes.
+void InitCompilerInstance(CompilerInstance &CI,
+                          clang::DiagnosticConsumer *Client,
+                          const CompileFlags &Flags = CompileFlags()) {
+
+  if (!Client) {
+    Client = new TextDiagnosticPrinter(logging::Out(), &CI.getDiagnosticOpts());
+  }
+
+  CI.createDiagnostics(0, NULL, Client);
+  DiagnosticsEngine &Diags = CI.getDiagnostics();
+
+  DiagnosticOptions &DiagOpts = CI.getDiagnosticOpts();
+  DiagOpts.ShowColors = 1;
+  
+  HeaderSearchOptions &headopts = CI.getHeaderSearchOpts();
+  addSysIncludes(headopts);
+
+  for (unsigned j = 0; j < IncludeDirectories.size(); j++) {
+
+    headopts.AddPath(StringRef(IncludeDirectories[j]),
+                     clang::frontend::Quoted,
+                     true,
+                     false,
+                     false);
+
+  }
+
+  ApplyCompileFlags(Flags, CI);
+
+  TargetOptions to;
+  to.Triple = llvm::sys::getDefaultTargetTriple();
+  TargetInfo *pti = TargetInfo::CreateTargetInfo(Diags, &to);
+  CI.setTarget(pti);
+
+  CI.createFileManager();
+  CI.createSourceManager(CI.getFileManager());
+  CI.createPreprocessor();
+  CI.getPreprocessorOpts().UsePredefines = false;
+
+}
+
+// Everything other than the source itself that changes the resulting AST
+string GetIncludeConfiguration() {
+
+  stringstream Config;
+
+  Config << clang::getClangFullVersion() << "\n";
+
+  for (unsigned i = 0; i < SizeOfArray(sysincludes); i++) {
+    Config << "-isystem " << sysincludes[i] << "\n";
+  }
+
+  for (unsigned i = 0; i < SizeOfArray(externcincludes); i++) {
+    Config << "-isystem " << externcincludes[i] << "\n";
+  }
+
+  for (unsigned i = 0; i < IncludeDirectories.size(); i++) {
+    Config << "-I " << IncludeDirectories[i] << "\n";
+  }
+
+  return Config.str();
+
+}
+
+// Every file GetSystemPCH has created, for RemoveSystemPCHs
+static vector<string> SystemPCHFiles;
+
+// Precompiles the -pch-include headers. Only built once for each distinct
+// include configuration, then loaded by every CompilerInstance sharing it.
+// Returns an empty string if the PCH couldn't be built.
+string GetSystemPCH(const CompileFlags &Flags) {
+
+  static map<string, string> BuiltPCHs;
+
+  stringstream Config;
+
+  Config << GetIncludeConfiguration();
+  Config << GetFlagsConfiguration(Flags);
+
+  for (unsigned i = 0; i < PCHHeaders.size(); i++) {
+    Config << "#include <" << PCHHeaders[i] << ">\n";
+  }
+
+  map<string, string>::iterator PCHIt = BuiltPCHs.find(Config.str());
+
+  if (PCHIt != BuiltPCHs.end()) {
+    return PCHIt->second;
+  }
+
+  llvm::SmallString<128> Dir(PCHDirectory);
+
+  if (Dir.empty()) {
+    llvm::sys::path::system_temp_directory(true, Dir);
+  }
+
+  stringstream Name;
+  Name << "SpecCodeConv-" << std::hex << tools::HashString(Config.str());
+
+  BuiltPCHs[Config.str()] = "";
+
+  // The name is unique to this run, so that runs side by side never write
+  // over a PCH another one is loading, and the PCH takes the same name
+  llvm::SmallString<128> Model(Dir);
+  llvm::sys::path::append(Model, Name.str() + "-%%%%%%%%.h");
+
+  llvm::SmallString<128> PreludeFile;
+  int PreludeFD;
+
+  llvm::error_code EC = llvm::sys::fs::unique_file(Model.str(),
+                                                   PreludeFD,
+                                                   PreludeFile);
+
+  if (EC) {
+    logging::Out() << "\tCouldn't create " << Model.str() << ": "
+                   << EC.message() << "\n";
+    return "";
+  }
+
+  llvm::SmallString<128> PCHFile(PreludeFile);
+  llvm::sys::path::replace_extension(PCHFile, "pch");
+
+  SystemPCHFiles.push_back(PreludeFile.str());
+  SystemPCHFiles.push_back(PCHFile.str());
+
+  string Error;
+
+  {
+    llvm::raw_fd_ostream Prelude(PreludeFD, true);
+
+    for (unsigned i = 0; i < PCHHeaders.size(); i++) {
+      Prelude << "#include <" << PCHHeaders[i] << ">\n";
+    }
+
+    Prelude.close();
+
+    if (Prelude.has_error()) {
+      Error = "write failed";
+      Prelude.clear_error();
+    }
+  }
+
+  if (!Error.empty()) {
+    logging::Out() << "\tCouldn't write " << PreludeFile.str() << ": "
+                   << Error << "\n";
+    return "";
+  }
+
+  if (logging::Enabled(logging::Progress)) {
+    logging::Out() << "\tBuilding: " << PCHFile.str() << "\n";
+  }
+
+  CompilerInstance CI;
+  InitCompilerInstance(CI, NULL, Flags);
+
+  const FileEntry *pFile = CI.getFileManager().getFile(PreludeFile);
+  CI.getSourceManager().createMainFileID(pFile);
+
+  llvm::raw_fd_ostream *Out;
+  Out = new llvm::raw_fd_ostream(PCHFile.c_str(),
+                                 Error,
+                                 llvm::raw_fd_ostream::F_Binary);
+
+  if (!Error.empty()) {
+    logging::Out() << "\tCouldn't write " << PCHFile.str() << ": "
+                   << Error << "\n";
+    delete Out;
+    return "";
+  }
+
+  clang::PCHGenerator *Generator;
+  Generator = new clang::PCHGenerator(CI.getPreprocessor(),
+                                      PCHFile,
+                                      NULL,
+                                      "",
+                                      Out);
+  CI.setASTConsumer(Generator);
+  CI.createASTContext();
+
+  CI.getDiagnosticClient().BeginSourceFile(CI.getLangOpts(),
+                                           &CI.getPreprocessor());
+  clang::ParseAST(CI.getPreprocessor(), Generator, CI.getASTContext(),
+                  false, clang::TU_Prefix);
+  CI.getDiagnosticClient().EndSourceFile();
+
+  delete Out;
+
+  if (CI.getDiagnostics().hasErrorOccurred()) {
+    return "";
+  }
+
+  BuiltPCHs[Config.str()] = PCHFile.str();
+
+  return PCHFile.str();
+
+}
+
+void RemoveSystemPCHs() {
+
+  for (unsigned i = 0; i < SystemPCHFiles.size(); i++) {
+    bool Existed;
+    llvm::sys::fs::remove(SystemPCHFiles[i], Existed);
+  }
+
+  SystemPCHFiles.clear();
+
+}
+
+// Whether Filename could change what the system headers it includes mean,
+// by defining or undefining a macro (e.g. _GNU_SOURCE) ahead of one of its
+// #includes, or by including a local header that could do so ahead of
+// another. The system PCH is loaded ahead of everything in the file, where
+// none of that would be seen.
+bool MayConfigureIncludes(const string &Filename) {
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+
+  if (llvm::MemoryBuffer::getFile(Filename, Buffer)) {
+    return true;
+  }
+
+  clang::LangOptions LangOpts;
+  clang::Lexer Lex(clang::SourceLocation(),
+                   LangOpts,
+                   Buffer->getBufferStart(),
+                   Buffer->getBufferStart(),
+                   Buffer->getBufferEnd());
+
+  bool Configured = false;
+  Token Tok;
+
+  while (!Lex.LexFromRawLexer(Tok)) {
+
+    if (!Tok.is(clang::tok::hash) || !Tok.isAtStartOfLine()) {
+      continue;
+    }
+
+    Lex.LexFromRawLexer(Tok);
+
+    if (!Tok.is(clang::tok::raw_identifier)) {
+      continue;
+    }
+
+    StringRef Directive(Tok.getRawIdentifierData(), Tok.getLength());
+
+    if (Directive == "define" || Directive == "undef") {
+      Configured = true;
+    } else if (Directive == "include"
+               || Directive == "include_next"
+               || Directive == "import") {
+
+      if (Configured) {
+        return true;
+      }
+
+      // A quoted include is taken to be a local header
+      Lex.LexFromRawLexer(Tok);
+      Configured = Tok.isNot(clang::tok::less);
+
+    }
+
+  }
+
+  return false;
+
+}
+
+// Diagnostic stream for a single CompilerInstance. While deferred, anything
+// reported is held back so that files parsed in parallel still print their
+// diagnostics in input order once released.
+class DeferredErrStream : public llvm::raw_ostream {
+
+ private:
+
+  string Buffer;
+  bool Deferred;
+  uint64_t Pos;
+
+  virtual void write_impl(const char *Ptr, size_t Size) {
+
+    if (Deferred) {
+      Buffer.append(Ptr, Size);
+    } else {
+      logging::Out().write(Ptr, Size);
+    }
+
+    Pos += Size;
+
+  }
+
+  virtual uint64_t current_pos() const {
+    return Pos;
+  }
+
+ public:
+
+  DeferredErrStream()
+      : llvm::raw_ostream(true),
+        Buffer(),
+        Deferred(false),
+        Pos(0) { }
+
+  void Defer() {
+    Deferred = true;
+  }
+
+  void Release() {
+
+    logging::Out() << Buffer;
+    Buffer.clear();
+    Deferred = false;
+
+  }
+
+};
+
+struct ParseJob {
+
+  CompilerInstance *CI;
+  string Filename;
+  ASTConsumer *Consumer;
+  string CacheKey;
+  bool Cached;
+
+};
+
+// Everything in here must only touch its own CompilerInstance, as it may be
+// run on a worker thread.
+void ParseTranslationUnit(unsigned Index, void *Data) {
+
+  ParseJob &Job = (*static_cast<vector<ParseJob> *>(Data))[Index];
+  CompilerInstance &CI = *Job.CI;
+
+  // A cached AST has already been attached along with an empty main file
+  if (!Job.Cached) {
+
+    const FileEntry *pFile;
+    pFile = CI.getFileManager().getFile(StringRef(Job.Filename));
+    
+    if (!pFile) {
+      CI.getDiagnostics().Report(clang::diag::err_drv_no_such_file)
+          << Job.Filename;
+      return;
+    }
+    
+    CI.getSourceManager().createMainFileID(pFile);
+
+  }
+
+  CI.getDiagnosticClient().BeginSourceFile(CI.getLangOpts(),
+                                           &CI.getPreprocessor());
+  clang::ParseAST(CI.getPreprocessor(), Job.Consumer, CI.getASTContext());
+
+}
+
+// Ends the last stage and times the next, announcing it if asked to
+void BeginStage(StringRef Name) {
+
+  stats::BeginStage(Name);
+
+  if (!logging::Enabled(logging::Progress)) {
+    return;
+  }
+
+  string Rule(Name.size() + 8, '#');
+
+  logging::Out() << "\n";
+  logging::Out() << Rule << "\n";
+  logging::Out() << "### " << Name << " ###\n";
+  logging::Out() << Rule << "\n";
+  logging::Out() << "\n";
+
+}
+
 int main(int argc, char *argv[]) {
 
   llvm::cl::ParseCommandLineOptions(argc, argv);
+
+  logging::SetLevel(Verbosity);
+
+  if (DumpTrackers) {
+    logging::EnableDump(logging::TrackersDump);
+  }
+
+  if (DumpStack) {
+    logging::EnableDump(logging::StackDump);
+  }
+
+  if (DumpRewritten) {
+    logging::EnableDump(logging::RewrittenDump);
+  }
+
+  if (!ApplyPlan.empty()) {
+
+    BeginStage("Applying Edit Plan");
+
+    CompilerInstance CI;
+    InitCompilerInstance(CI, NULL);
+
+    RewritePlan Plan;
+
+    if (!Plan.Read(ApplyPlan)) {
+      logging::Out() << "\tCouldn't read " << ApplyPlan << "\n";
+      return 1;
+    }
+
+    OutputDirectory *Output = NULL;
+
+    if (!OutputDir.empty()) {
+      Output = new OutputDirectory(OutputDir);
+    }
+
+    bool Applied = Plan.Apply(CI, Output);
+
+    if (Output) {
+      Applied = Applied && Output->Write(Jobs);
+      delete Output;
+    }
+
+    return Applied ? 0 : 1;
+
+  }
+
+  vector<string> Inputs(InputFilenames.begin(), InputFilenames.end());
+  vector<CompileFlags> InputFlags(Inputs.size());
+
+  if (!BuildPath.empty()) {
+
+    string Error;
+    llvm::OwningPtr<CompilationDatabase> Database(
+        CompilationDatabase::loadFromDirectory(BuildPath, Error));
+
+    if (!Database) {
+      logging::Out() << "\tCouldn't load the compilation database: "
+                     << Error << "\n";
+      return 1;
+    }
+
+    // Sorted, so the whole project converts the same way every time
+    if (Inputs.empty()) {
+      Inputs = Database->getAllFiles();
+      std::sort(Inputs.begin(), Inputs.end());
+      InputFlags.resize(Inputs.size());
+    }
+
+    for (unsigned i = 0; i < Inputs.size(); i++) {
+
+      llvm::SmallString<128> Absolute(Inputs[i]);
+      llvm::sys::fs::make_absolute(Absolute);
+
+      vector<clang::tooling::CompileCommand> Commands;
+      Commands = Database->getCompileCommands(Absolute.str());
+
+      // A file built more than once is converted as its first build sees it
+      if (Commands.empty()) {
+        logging::Out() << "\tNo compile command for " << Inputs[i]
+                       << ", using the default flags\n";
+      } else {
+        Inputs[i] = ParseCompileCommand(Commands.front(),
+                                        Absolute.str(),
+                                        InputFlags[i]);
+      }
+
+    }
+
+  }
+
+  if (Inputs.empty()) {
+    logging::Out() << "No input files\n";
+    return 1;
+  }
   
-  CompilerInstance *CIs = new CompilerInstance[InputFilenames.size()];
+  CompilerInstance *CIs = new CompilerInstance[Inputs.size()];
+  // Files are parsed concurrently, so each gets its own
+  PragmaDirectiveAllocator *PragmaAllocators
+      = new PragmaDirectiveAllocator[Inputs.size()];
 
   map<CompilerInstance *, PragmaDirectiveMap> Directives;
   map<CompilerInstance *, vector<Decl *> > AllDecls;
@@ -110,85 +692,157 @@ int main(int argc, char *argv[]) {
   
   map<CompilerInstance *, string> FilenameMap;
 
-  // First load all of the AST's and extract the top level Decls.
+  ASTCache *Cache = NULL;
 
-  llvm::errs() << "\n";
-  llvm::errs() << "#####################\n";
-  llvm::errs() << "### Parsing Files ###\n";
-  llvm::errs() << "#####################\n";
-  llvm::errs() << "\n";
+  if (!CacheDirectory.empty()) {
+    Cache = new ASTCache(CacheDirectory, GetIncludeConfiguration());
+  }
 
-  for (unsigned i = 0; i < InputFilenames.size(); i++) {
-    llvm::errs() << "\tParsing: " << InputFilenames[i] << "\n";
-    FilenameMap.insert(make_pair(&CIs[i], string(InputFilenames[i])));
+  // One for each distinct set of flags
+  vector<string> SystemPCHs(Inputs.size());
 
-    CompilerInstance &CI = CIs[i];
+  if (!PCHHeaders.empty()) {
 
-    AllDecls.insert(make_pair(&CI, vector<Decl *>()));
-    Directives.insert(make_pair(&CI, PragmaDirectiveMap()));
+    BeginStage("Precompiling System Headers");
 
-    CI.createDiagnostics(0,NULL);
-    DiagnosticsEngine &Diags = CI.getDiagnostics();
+    for (unsigned i = 0; i < Inputs.size(); i++) {
 
-    DiagnosticOptions &DiagOpts = CI.getDiagnosticOpts();
-    DiagOpts.ShowColors = 1;
-    
-    HeaderSearchOptions &headopts = CI.getHeaderSearchOpts();
-    addSysIncludes(headopts);
+      if (MayConfigureIncludes(Inputs[i])) {
+
+        if (logging::Enabled(logging::Progress)) {
+          logging::Out() << "\tNot using the system PCH for " << Inputs[i]
+                         << ", which may configure its system headers\n";
+        }
+
+        continue;
+
+      }
+
+      SystemPCHs[i] = GetSystemPCH(InputFlags[i]);
+
+    }
 
-    for (unsigned j = 0; j < IncludeDirectories.size(); j++) {
+  }
+
+  // First load all of the AST's and extract the top level Decls.
+
+  BeginStage("Parsing Files");
+
+  vector<ParseJob> ParseJobs;
+  vector<DeferredErrStream *> DiagStreams;
 
-      headopts.AddPath(StringRef(IncludeDirectories[j]),
-                       clang::frontend::Quoted,
-                       true,
-                       false,
-                       false);
+  for (unsigned i = 0; i < Inputs.size(); i++) {
 
+    string CacheKey;
+    bool Cached = false;
+
+    if (Cache) {
+      CacheKey = Cache->GetKey(Inputs[i], GetFlagsConfiguration(InputFlags[i]));
+      Cached = !CacheKey.empty() && Cache->Contains(CacheKey);
     }
 
-    TargetOptions to;
-    to.Triple = llvm::sys::getDefaultTargetTriple();
-    TargetInfo *pti = TargetInfo::CreateTargetInfo(Diags, &to);
-    CI.setTarget(pti);
+    if (!logging::Enabled(logging::Progress)) {
+      // Nothing to say
+    } else if (Cached) {
+      logging::Out() << "\tLoading: " << Inputs[i] << " (cached)\n";
+    } else {
+      logging::Out() << "\tParsing: " << Inputs[i] << "\n";
+    }
+
+    FilenameMap.insert(make_pair(&CIs[i], string(Inputs[i])));
+
+    CompilerInstance &CI = CIs[i];
+
+    AllDecls.insert(make_pair(&CI, vector<Decl *>()));
+    Directives.insert(make_pair(&CI, PragmaDirectiveMap()));
+
+    DeferredErrStream *DiagStream = new DeferredErrStream();
+    DiagStreams.push_back(DiagStream);
 
-    CI.createFileManager();
-    CI.createSourceManager(CI.getFileManager());
-    CI.createPreprocessor();
-    CI.getPreprocessorOpts().UsePredefines = false;
+    InitCompilerInstance(CI,
+                         new TextDiagnosticPrinter(*DiagStream,
+                                                   &CI.getDiagnosticOpts()),
+                         InputFlags[i]);
+    DiagnosticsEngine &Diags = CI.getDiagnostics();
 
-    OMPPragmaHandler *PH = new OMPPragmaHandler(Directives[&CI], Diags);
+    OMPPragmaHandler *PH = new OMPPragmaHandler(Directives[&CI],
+                                                PragmaAllocators[i],
+                                                Diags);
     CI.getPreprocessor().AddPragmaHandler(PH);
 
     BaseASTConsumer *astConsumer = new BaseASTConsumer(AllDecls[&CI],
                                                        Diags);
-    CI.setASTConsumer(astConsumer);
+    ASTConsumer *Consumer = astConsumer;
+
+    // Cache entries are kept self contained, so anything being written to
+    // the cache is parsed without the system PCH
+    if (Cache && !Cached && !CacheKey.empty()) {
+      Consumer = Cache->CreateWriter(CacheKey, CI, astConsumer);
+    }
+
+    CI.setASTConsumer(Consumer);
 
     CI.createASTContext();
 
-    globals::RegisterCompilerInstance(CI);
+    if (Cached && !Cache->Attach(CacheKey, CI)) {
+      logging::Out() << "\tCouldn't load cached AST, parsing instead\n";
+      CI.getDiagnostics().Reset();
+      Cached = false;
+      CacheKey = "";
+    }
 
-    const FileEntry *pFile = CI.getFileManager().getFile(StringRef(InputFilenames[i]));
-    
-    if (!pFile) {
-      Diags.Report(clang::diag::err_drv_no_such_file)
-          << InputFilenames[i];
-      continue;
+    if (!SystemPCHs[i].empty() && !Cached && Consumer == astConsumer) {
+      CI.createPCHExternalASTSource(SystemPCHs[i], false, false, NULL);
+    }
+
+    ParseJob Job;
+    Job.CI = &CI;
+    Job.Filename = Inputs[i];
+    Job.Consumer = Consumer;
+    Job.CacheKey = CacheKey;
+    Job.Cached = Cached;
+    ParseJobs.push_back(Job);
+
+    if (Jobs > 1) {
+      DiagStream->Defer();
     }
-    
-    CI.getSourceManager().createMainFileID(pFile);
-    CI.getDiagnosticClient().BeginSourceFile(CI.getLangOpts(),
-                                             &CI.getPreprocessor());
-    clang::ParseAST(CI.getPreprocessor(), astConsumer, CI.getASTContext());
 
   }
 
+  // The files don't depend on each other, so they can be parsed in any order
+  tools::ParallelFor(Jobs, ParseJobs.size(), ParseTranslationUnit, &ParseJobs);
+
+  // Registration happens in input order so that the result doesn't depend on
+  // which thread finished first
+  for (unsigned i = 0; i < ParseJobs.size(); i++) {
 
+    ParseJob &Job = ParseJobs[i];
+    CompilerInstance &CI = *Job.CI;
 
-  llvm::errs() << "\n";
-  llvm::errs() << "##########################\n";
-  llvm::errs() << "### Extracting Globals ###\n";
-  llvm::errs() << "##########################\n";
-  llvm::errs() << "\n";
+    DiagStreams[i]->Release();
+
+    if (Job.Cached) {
+
+      if (!Cache->Load(Job.CacheKey,
+                       CI,
+                       AllDecls[&CI],
+                       Directives[&CI],
+                       PragmaAllocators[i])) {
+        logging::Out() << "\tCached directives for " << Job.Filename
+                       << " are unreadable\n";
+      }
+
+    } else if (Cache && !Job.CacheKey.empty()) {
+
+      Cache->Store(Job.CacheKey, CI, Directives[&CI]);
+
+    }
+
+    globals::RegisterCompilerInstance(CI);
+
+  }
+
+  BeginStage("Extracting Globals");
 
   // Next extract all of the globals and link any shared ones
   // While we're at it, record which of the VarDecls are threadprivate
@@ -203,7 +857,9 @@ int main(int argc, char *argv[]) {
 
     string Filename = FilenameMap.find(&CI)->second;
 
-    llvm::errs() << "\t### Extracting from " << Filename << " ###\n\n";
+    if (logging::Enabled(logging::Verbose)) {
+      logging::Out() << "\t### Extracting from " << Filename << " ###\n\n";
+    }
 
     // Loop over each decl within that CI
     vector<Decl *>::iterator it;
@@ -225,10 +881,12 @@ int main(int argc, char *argv[]) {
       if ((VD = dyn_cast<VarDecl>(D))) {
 
         globals::InsertVarDecl(VD, CI);
+        stats::Increment(stats::DeclsCounter);
 
       } else if ((FD = dyn_cast<FunctionDecl>(D))) {
 
         globals::InsertFunctionDecl(FD, CI);
+        stats::Increment(stats::DeclsCounter);
 
       }
 
@@ -236,27 +894,30 @@ int main(int argc, char *argv[]) {
 
   }
   
-  llvm::errs() << "\n";
-  llvm::errs() << "###########################\n";
-  llvm::errs() << "### Linking Extern Vars ###\n";
-  llvm::errs() << "###########################\n";
-  llvm::errs() << "\n";
+  BeginStage("Linking Extern Vars");
 
   globals::LinkExternDecls();
 
-  llvm::errs() << "\n";
-  llvm::errs() << "#########################\n";
-  llvm::errs() << "### Linking Functions ###\n";
-  llvm::errs() << "#########################\n";
-  llvm::errs() << "\n";
+  BeginStage("Linking Functions");
 
   globals::LinkExternFunctions();
+
+  stats::Increment(stats::FunctionsCounter,
+                   globals::GetAllFunctionDecls().size());
+
+  // Every later stage asks which statements lie inside which
+  set<FunctionDecl *> IndexedFunctions = globals::GetAllFunctionDecls();
+  set<FunctionDecl *>::iterator IndexIt;
+
+  for (IndexIt = IndexedFunctions.begin();
+       IndexIt != IndexedFunctions.end();
+       IndexIt++) {
+
+    tools::IndexFunction(*IndexIt);
+
+  }
   
-  llvm::errs() << "\n";
-  llvm::errs() << "#################################\n";
-  llvm::errs() << "### Extracting Thread Private ###\n";
-  llvm::errs() << "#################################\n";
-  llvm::errs() << "\n";
+  BeginStage("Extracting Thread Private");
 
   // Loop over each CompilerInstance
   for (CIit = AllDecls.begin(); CIit != AllDecls.end(); CIit++) {
@@ -286,11 +947,7 @@ int main(int argc, char *argv[]) {
 
   }
 
-  llvm::errs() << "\n";
-  llvm::errs() << "#########################\n";
-  llvm::errs() << "### Tracking Pointers ###\n";
-  llvm::errs() << "#########################\n";
-  llvm::errs() << "\n";
+  BeginStage("Tracking Pointers");
 
   set<NamedDecl *> GlobalVars = globals::GetAllNamedDecls();
   set<NamedDecl *>::iterator GlobalIt;
@@ -328,7 +985,9 @@ int main(int argc, char *argv[]) {
 
   TrackedVars.PropogateShares();
 
-  TrackedVars.printAllFunctionsTrackers();
+  if (logging::Dumping(logging::TrackersDump)) {
+    TrackedVars.printAllFunctionsTrackers();
+  }
 
   // Now that we've set up translation tables between:
   //   Shared Global Variables
@@ -354,11 +1013,7 @@ int main(int argc, char *argv[]) {
   //   I need to treat threadprivate pointers as contaminated
   //   either that or traverse everything and see if they get contaminated
   
-  llvm::errs() << "\n";
-  llvm::errs() << "##########################\n";
-  llvm::errs() << "### Finding Directives ###\n";
-  llvm::errs() << "##########################\n";
-  llvm::errs() << "\n";
+  BeginStage("Finding Directives");
 
   set<FunctionDecl *> ImplementedFunctions = globals::GetAllFunctionDecls();
   set<FunctionDecl *>::iterator FunctionIt;
@@ -370,115 +1025,124 @@ int main(int argc, char *argv[]) {
     
     CompilerInstance &CI = *globals::GetCompilerInstance(*FunctionIt);
     
-    llvm::errs() << "\t### Searching in: " << (*FunctionIt)->getName() << " ###\n\n";
+    if (logging::Enabled(logging::Verbose)) {
+      logging::Out() << "\t### Searching in: " << (*FunctionIt)->getName() << " ###\n\n";
+    }
 
     if ((*FunctionIt)->hasBody()) {
       DirectiveFinder Finder(Directives[&CI], FullDirectives, CI);
       Finder.TraverseStmt((*FunctionIt)->getBody());
-    } else {
-      llvm::errs() << "\t\tFunction has no body!\n";
+    } else if (logging::Enabled(logging::Verbose)) {
+      logging::Out() << "\t\tFunction has no body!\n";
     }
 
   }
   
-  llvm::errs() << "\n";
-  llvm::errs() << "##################################\n";
-  llvm::errs() << "### Scanning For Contamination ###\n";
-  llvm::errs() << "##################################\n";
-  llvm::errs() << "\n";
+  BeginStage("Scanning For Contamination");
 
   list<FullDirective *> TopLevelDirectives = 
                                   FullDirectives.GetTopLevelDirectives();
   list<FullDirective *>::iterator DirectiveIt;
 
-  VarCollector VC;
+  VarCollector VC(VerifySummaries);
   // Loop over the top level pragma statements recording var contamination
-  // Repeat until further contamination doesn't occur
-  do {
+  // Repeat for those that saw something get further contaminated, until
+  // further contamination doesn't occur
+  list<FullDirective *> Pending = TopLevelDirectives;
+  set<FullDirective *> Queued(Pending.begin(), Pending.end());
+
+  FullDirectives.ResetChangedStatus();
+
+  while (!Pending.empty()) {
+
+    FullDirective * FD = Pending.front();
+    Pending.pop_front();
+    Queued.erase(FD);
 
-    FullDirectives.ResetChangedStatus();
+    FullDirectives.BeginTraversal(FD);
+    stats::Increment(stats::TraversalsCounter);
 
+    VC.HandleDirective(&Directives[FD->CI], &FullDirectives, FD);
+
+    set<FullDirective *> Stale = FullDirectives.EndTraversal();
+
+    // Requeue in program order so the output doesn't depend on pointers
     for (DirectiveIt = TopLevelDirectives.begin();
          DirectiveIt != TopLevelDirectives.end();
          DirectiveIt++) {
 
-      VC.HandleDirective(&Directives[(*DirectiveIt)->CI],
-                         &FullDirectives,
-                         *DirectiveIt);
+      if (Stale.count(*DirectiveIt) && Queued.insert(*DirectiveIt).second) {
+        Pending.push_back(*DirectiveIt);
+      }
 
     }
 
-  } while(FullDirectives.GetChangedStatus());
+  }
   
-  llvm::errs() << "\n";
-  llvm::errs() << "####################################\n";
-  llvm::errs() << "### Collating Call Contamination ###\n";
-  llvm::errs() << "####################################\n";
-  llvm::errs() << "\n";
+  BeginStage("Collating Call Contamination");
 
   FullDirectives.GenerateSpecFunctions();
 
-  llvm::errs() << "\n";
-  llvm::errs() << "#####################################\n";
-  llvm::errs() << "### Generating Read + Write Lists ###\n";
-  llvm::errs() << "#####################################\n";
-  llvm::errs() << "\n";
+  BeginStage("Generating Read + Write Lists");
 
   list<StackItem *> HandlerStartPoints = FullDirectives.GetHandlerStartPoints();
   list<StackItem *>::iterator StartIt;
 
-  FakeDirectiveHandler FH(&FullDirectives);
+  // The only traversal of the start points, the rewriting below works from
+  // the access plans recorded here
+  RewritePlan Plan;
+  DirectiveHandler H(&FullDirectives, EmitPlan.empty() ? NULL : &Plan);
   for (StartIt = HandlerStartPoints.begin();
        StartIt != HandlerStartPoints.end();
        StartIt++) {
 
-    SourceLocation Loc = (*StartIt)->S->getLocStart();
-    CompilerInstance &CI = *((*StartIt)->CI);
+    if (logging::Enabled(logging::Verbose)) {
+
+      SourceLocation Loc = (*StartIt)->S->getLocStart();
+      CompilerInstance &CI = *((*StartIt)->CI);
 
-    llvm::errs() << "\t### Handling " << tools::GetLocation(Loc, CI)
-                 << " ###\n\n";
+      logging::Out() << "\t### Handling " << tools::GetLocation(Loc, CI)
+                     << " ###\n\n";
 
-    FH.HandleStackItem(&Directives[(*StartIt)->CI], *StartIt);
+    }
+
+    H.HandleStackItem(&Directives[(*StartIt)->CI], *StartIt);
 
   }
 
-  llvm::errs() << "\n";
-  llvm::errs() << "#######################################\n";
-  llvm::errs() << "### Discovering Read-Only Variables ###\n";
-  llvm::errs() << "#######################################\n";
-  llvm::errs() << "\n";
+  BeginStage("Discovering Read-Only Variables");
 
   FullDirectives.GenerateReadOnly();
 
-  llvm::errs() << "\nResults:\n";
-  FullDirectives.printTopLevelDeclAccess();
+  if (logging::Enabled(logging::Verbose)) {
+    logging::Out() << "\nResults:\n";
+    FullDirectives.printTopLevelDeclAccess();
+  }
+
+  // Only the directive stack is needed from here on
+  TrackedVars.Release();
 
-  llvm::errs() << "\n";
-  llvm::errs() << "######################################\n";
-  llvm::errs() << "### Inserting Speculative Accesses ###\n";
-  llvm::errs() << "######################################\n";
-  llvm::errs() << "\n";
+  BeginStage("Inserting Speculative Accesses");
 
-  DirectiveHandler H(&FullDirectives);
   for (StartIt = HandlerStartPoints.begin();
        StartIt != HandlerStartPoints.end();
        StartIt++) {
 
-    SourceLocation Loc = (*StartIt)->S->getLocStart();
-    CompilerInstance &CI = *((*StartIt)->CI);
+    if (logging::Enabled(logging::Verbose)) {
 
-    llvm::errs() << "\t### Handling " << tools::GetLocation(Loc, CI)
-                 << " ###\n\n";
+      SourceLocation Loc = (*StartIt)->S->getLocStart();
+      CompilerInstance &CI = *((*StartIt)->CI);
 
-    H.HandleStackItem(&Directives[(*StartIt)->CI], *StartIt);
+      logging::Out() << "\t### Handling " << tools::GetLocation(Loc, CI)
+                     << " ###\n\n";
+
+    }
+
+    H.RewriteStackItem(*StartIt);
 
   }
   
-  llvm::errs() << "\n";
-  llvm::errs() << "########################\n";
-  llvm::errs() << "### Inserting Checks ###\n";
-  llvm::errs() << "########################\n";
-  llvm::errs() << "\n";
+  BeginStage("Inserting Checks");
 
   map<CompilerInstance *, PragmaDirectiveMap>::iterator PragmaIt;
 
@@ -490,28 +1154,104 @@ int main(int argc, char *argv[]) {
 
   }
 
-  llvm::errs() << "\n";
-  llvm::errs() << "######################\n";
-  llvm::errs() << "### Inserting Init ###\n";
-  llvm::errs() << "######################\n";
-  llvm::errs() << "\n";
+  BeginStage("Inserting Init");
 
   H.InsertInit();
 
-  llvm::errs() << "\n";
-  llvm::errs() << "####################\n";
-  llvm::errs() << "### Finishing Up ###\n";
-  llvm::errs() << "####################\n";
-  llvm::errs() << "\n";
+  BeginStage("Finishing Up");
+
+  OutputDirectory *Output = NULL;
 
-  H.Finish();
+  if (!OutputDir.empty() && EmitPlan.empty()) {
+    Output = new OutputDirectory(OutputDir);
+  }
+
+  H.Finish(Output);
+
+  int Result = 0;
+
+  if (Output) {
+
+    // Sources and local headers without any edits are copied across too, so
+    // that the output directory builds on its own
+    for (unsigned i = 0; i < Inputs.size(); i++) {
+
+      if (!Output->Copy(Inputs[i])) {
+        logging::Out() << "\tCouldn't read " << Inputs[i] << "\n";
+        Result = 1;
+      }
+
+    }
+
+    if (!CacheDirectory.empty()) {
+      Output->Exclude(CacheDirectory);
+    }
+
+    if (!PCHDirectory.empty()) {
+      Output->Exclude(PCHDirectory);
+    }
+
+    for (unsigned i = 0; i < Inputs.size(); i++) {
+
+      llvm::SmallVector<const FileEntry *, 64> Read;
+      CIs[i].getFileManager().GetUniqueIDMapping(Read);
+
+      for (unsigned j = 0; j < Read.size(); j++) {
+
+        if (Read[j] && !Output->CopyLocal(Read[j]->getName())) {
+          logging::Out() << "\tCouldn't read " << Read[j]->getName() << "\n";
+          Result = 1;
+        }
+
+      }
+
+    }
+
+    if (!Output->Write(Jobs)) {
+      Result = 1;
+    }
+
+    delete Output;
+
+  }
+
+  if (!EmitPlan.empty() && !Plan.Write(EmitPlan)) {
+    logging::Out() << "\tCouldn't write " << EmitPlan << "\n";
+    Result = 1;
+  }
+
+  stats::EndStage();
+
+  if (Stats || TimeStages) {
+
+    logging::Out() << "\n";
+    logging::Out() << "##################\n";
+    logging::Out() << "### Statistics ###\n";
+    logging::Out() << "##################\n";
+    logging::Out() << "\n";
+
+    stats::PrintStages(logging::Out());
+
+    if (Stats) {
+      logging::Out() << "\n";
+      stats::PrintCounters(logging::Out());
+    }
+
+  }
+
+  if (!StatsJSON.empty() && !stats::WriteJSON(StatsJSON)) {
+    logging::Out() << "\tCouldn't write " << StatsJSON << "\n";
+  }
 
   // Clean up
-  for (unsigned i = 0; i < InputFilenames.size(); i++) {
+  for (unsigned i = 0; i < Inputs.size(); i++) {
     CIs[i].getDiagnosticClient().EndSourceFile();
   }
 
+  delete [] PragmaAllocators;
+
+  RemoveSystemPCHs();
 
-  return 0;
+  return Result;
 }
 
@@ -5,14 +5,17 @@
 
 #include "OMPPragmaHandler.h"
 
+#include "Log.h"
 #include "PragmaDirective.h"
 
 namespace speculation {
 
 OMPPragmaHandler::OMPPragmaHandler(PragmaDirectiveMap &Directives,
+                                   PragmaDirectiveAllocator &Allocator,
                                    DiagnosticsEngine &Diags) 
   : PragmaHandler("omp"),
     Directives(Directives),
+    Allocator(Allocator),
     Diags(Diags),
     DiagUnrecognisedIdentifier(0),
     DiagFoundPragmaStmt(0),
@@ -151,11 +154,13 @@ void OMPPragmaHandler::HandlePragma(Preprocessor &PP,
                                     SourceRange IntroducerRange,
                                     Token &FirstTok) {
 
-
-  Diags.Report(IntroducerRange.getBegin(), DiagFoundPragmaStmt);
+  if (logging::Enabled(logging::Verbose)) {
+    Diags.Report(IntroducerRange.getBegin(), DiagFoundPragmaStmt);
+  }
                                     
   // TODO: Clean this up because I'm too lazy to now
-  PragmaDirective * DirectivePointer = new PragmaDirective;
+  PragmaDirective * DirectivePointer =
+      new (Allocator.Allocate()) PragmaDirective;
   PragmaDirective &Directive = *DirectivePointer;
     
   // First lex the pragma statement extracting the variable names
@@ -7,6 +7,7 @@
 #define _OMPPRAGMAHANDLER_H_
 
 #include "Classes.h"
+#include "PragmaDirective.h"
 
 #include "clang/AST/AST.h"
 #include "clang/Lex/Preprocessor.h"
@@ -32,6 +33,7 @@ class OMPPragmaHandler : public PragmaHandler {
  private:
   
   PragmaDirectiveMap &Directives;
+  PragmaDirectiveAllocator &Allocator;
   DiagnosticsEngine &Diags;
   
   unsigned DiagUnrecognisedIdentifier;
@@ -55,7 +57,9 @@ class OMPPragmaHandler : public PragmaHandler {
   
  public:
 
-  OMPPragmaHandler(PragmaDirectiveMap &Directives, DiagnosticsEngine &Diags);
+  OMPPragmaHandler(PragmaDirectiveMap &Directives,
+                   PragmaDirectiveAllocator &Allocator,
+                   DiagnosticsEngine &Diags);
 
   virtual void HandlePragma(Preprocessor &PP, PragmaIntroducerKind Introducer,
                             SourceRange IntroducerRange, Token &FirstTok);
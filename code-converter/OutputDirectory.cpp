@@ -0,0 +1,336 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "OutputDirectory.h"
+
+#include "Log.h"
+#include "Tools.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PathV2.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace speculation {
+
+struct OutputJob {
+
+  string Directory;
+  vector<OutputFile> *Files;
+  map<string, uint64_t> *Manifest;
+
+};
+
+OutputDirectory::OutputDirectory(string Directory)
+    : Directory(Directory),
+      Files(),
+      FileIndices(),
+      Manifest(),
+      Excluded() {
+
+  bool Existed;
+  llvm::sys::fs::create_directories(Directory, Existed);
+
+  Exclude(Directory);
+
+  ReadManifest();
+
+}
+
+// Private
+
+string OutputDirectory::GetAbsolutePath(StringRef Source) {
+
+  llvm::SmallString<128> Absolute(Source);
+  llvm::sys::fs::make_absolute(Absolute);
+
+  return Absolute.str();
+
+}
+
+bool OutputDirectory::IsUnder(StringRef Path, StringRef Parent) {
+
+  return Path.startswith(Parent)
+         && Path.size() > Parent.size()
+         && llvm::sys::path::is_separator(Path[Parent.size()]);
+
+}
+
+string OutputDirectory::GetRelativePath(StringRef Source) {
+
+  string Path = GetAbsolutePath(Source);
+
+  llvm::SmallString<128> Current;
+  llvm::sys::fs::current_path(Current);
+
+  if (IsUnder(Path, Current.str())) {
+    return Path.substr(Current.size() + 1);
+  }
+
+  return llvm::sys::path::relative_path(Path);
+
+}
+
+string OutputDirectory::GetManifestPath() {
+
+  llvm::SmallString<128> Path(Directory);
+  llvm::sys::path::append(Path, ".SpecCodeConv-manifest");
+
+  return Path.str();
+
+}
+
+// One "<hash> <path>" line per file
+void OutputDirectory::ReadManifest() {
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+
+  if (llvm::MemoryBuffer::getFile(GetManifestPath(), Buffer)) {
+    return;
+  }
+
+  StringRef Rest = Buffer->getBuffer();
+
+  while (!Rest.empty()) {
+
+    std::pair<StringRef, StringRef> Line = Rest.split('\n');
+    std::pair<StringRef, StringRef> Fields = Line.first.split(' ');
+    Rest = Line.second;
+
+    uint64_t Hash;
+
+    if (Fields.second.empty() || Fields.first.getAsInteger(16, Hash)) {
+      continue;
+    }
+
+    Manifest[Fields.second] = Hash;
+
+  }
+
+}
+
+bool OutputDirectory::WriteManifest() {
+
+  string Error;
+  llvm::raw_fd_ostream Out(GetManifestPath().c_str(), Error);
+
+  if (!Error.empty()) {
+    return false;
+  }
+
+  map<string, uint64_t>::iterator It;
+
+  for (It = Manifest.begin(); It != Manifest.end(); It++) {
+    Out.write_hex(It->second) << " " << It->first << "\n";
+  }
+
+  return !Out.has_error();
+
+}
+
+// Only touches its own OutputFile and reads the manifest, as it may be run on
+// a worker thread.
+void OutputDirectory::WriteFile(unsigned Index, void *Data) {
+
+  OutputJob &Job = *static_cast<OutputJob *>(Data);
+  OutputFile &File = (*Job.Files)[Index];
+
+  llvm::SmallString<128> Path(Job.Directory);
+  llvm::sys::path::append(Path, File.Path);
+
+  File.Hash = tools::HashString(File.Text);
+
+  map<string, uint64_t>::iterator It = Job.Manifest->find(File.Path);
+
+  bool Exists = false;
+  llvm::sys::fs::exists(Path.str(), Exists);
+
+  if (Exists && It != Job.Manifest->end() && It->second == File.Hash) {
+    File.Unchanged = true;
+    return;
+  }
+
+  StringRef Parent = llvm::sys::path::parent_path(Path.str());
+
+  bool Existed;
+  llvm::sys::fs::create_directories(Parent, Existed);
+
+  // Written aside and renamed over, so a build never sees half a file. The
+  // name is unique, so nothing else writing next to it can get in the way.
+  llvm::SmallString<128> TempModel(Path);
+  TempModel += "-%%%%%%%%.tmp";
+
+  llvm::SmallString<128> TempPath;
+  int TempFD;
+
+  llvm::error_code EC = llvm::sys::fs::unique_file(TempModel.str(),
+                                                   TempFD,
+                                                   TempPath);
+
+  if (EC) {
+    File.Error = EC.message();
+    return;
+  }
+
+  {
+    llvm::raw_fd_ostream Out(TempFD, true);
+
+    Out << File.Text;
+    Out.close();
+
+    if (Out.has_error()) {
+      File.Error = "write failed";
+      Out.clear_error();
+    }
+  }
+
+  if (File.Error.empty()) {
+    EC = llvm::sys::fs::rename(TempPath.str(), Path.str());
+  }
+
+  if (EC) {
+    File.Error = EC.message();
+  }
+
+  if (!File.Error.empty()) {
+    bool Existed;
+    llvm::sys::fs::remove(TempPath.str(), Existed);
+  }
+
+}
+
+// Public
+
+void OutputDirectory::Add(StringRef Source, StringRef Text) {
+
+  OutputFile File;
+  File.Path = GetRelativePath(Source);
+  File.Text = Text;
+  File.Hash = 0;
+  File.Unchanged = false;
+
+  // Each file is written once, by one thread
+  map<string, unsigned>::iterator IndexIt = FileIndices.find(File.Path);
+
+  if (IndexIt == FileIndices.end()) {
+    FileIndices.insert(make_pair(File.Path, Files.size()));
+    Files.push_back(File);
+    return;
+  }
+
+  OutputFile &Previous = Files[IndexIt->second];
+
+  if (Previous.Text != File.Text) {
+    logging::Out() << "\tRewritten differently more than once, keeping the "
+                   << "last: " << File.Path << "\n";
+  }
+
+  Previous = File;
+
+}
+
+bool OutputDirectory::Copy(StringRef Source) {
+
+  if (FileIndices.count(GetRelativePath(Source))) {
+    return true;
+  }
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+
+  if (llvm::MemoryBuffer::getFile(Source, Buffer)) {
+    return false;
+  }
+
+  Add(Source, Buffer->getBuffer());
+
+  return true;
+
+}
+
+bool OutputDirectory::CopyLocal(StringRef Source) {
+
+  string Path = GetAbsolutePath(Source);
+
+  llvm::SmallString<128> Current;
+  llvm::sys::fs::current_path(Current);
+
+  if (!IsUnder(Path, Current.str())) {
+    return true;
+  }
+
+  vector<string>::iterator ExcludedIt;
+
+  for (ExcludedIt = Excluded.begin();
+       ExcludedIt != Excluded.end();
+       ExcludedIt++) {
+
+    if (IsUnder(Path, *ExcludedIt)) {
+      return true;
+    }
+
+  }
+
+  return Copy(Source);
+
+}
+
+void OutputDirectory::Exclude(StringRef Directory) {
+
+  string Path = GetAbsolutePath(Directory);
+
+  while (Path.size() > 1
+         && llvm::sys::path::is_separator(Path[Path.size() - 1])) {
+    Path.erase(Path.size() - 1);
+  }
+
+  Excluded.push_back(Path);
+
+}
+
+bool OutputDirectory::Write(unsigned Jobs) {
+
+  OutputJob Job;
+  Job.Directory = Directory;
+  Job.Files = &Files;
+  Job.Manifest = &Manifest;
+
+  tools::ParallelFor(Jobs, Files.size(), WriteFile, &Job);
+
+  bool Succeeded = true;
+
+  vector<OutputFile>::iterator FileIt;
+
+  for (FileIt = Files.begin(); FileIt != Files.end(); FileIt++) {
+
+    if (!FileIt->Error.empty()) {
+      logging::Out() << "\tCouldn't write " << FileIt->Path << ": "
+                     << FileIt->Error << "\n";
+      Manifest.erase(FileIt->Path);
+      Succeeded = false;
+      continue;
+    }
+
+    if (logging::Enabled(logging::Progress)) {
+      logging::Out() << "\t" << (FileIt->Unchanged ? "Unchanged: "
+                                                   : "Writing: ")
+                     << FileIt->Path << "\n";
+    }
+
+    Manifest[FileIt->Path] = FileIt->Hash;
+
+  }
+
+  if (!WriteManifest()) {
+    logging::Out() << "\tCouldn't write " << GetManifestPath() << "\n";
+    return false;
+  }
+
+  return Succeeded;
+
+}
+
+} // End namespace speculation
@@ -0,0 +1,82 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _OUTPUTDIRECTORY_H_
+#define _OUTPUTDIRECTORY_H_
+
+#include "Classes.h"
+
+#include "clang/Basic/LLVM.h"
+
+using clang::StringRef;
+
+namespace speculation {
+
+struct OutputFile {
+
+  // Where the file goes, relative to the output directory
+  string Path;
+  string Text;
+  uint64_t Hash;
+  bool Unchanged;
+  string Error;
+
+};
+
+// Writes rewritten sources under a directory instead of over the originals.
+// Each source keeps its path relative to the working directory; anything
+// outside of it is placed under its absolute path instead.
+//
+// The directory holds a manifest with the hash of every file last written to
+// it. A file whose new text hashes the same is left alone, timestamp and
+// all, so make and ccache only rebuild what the instrumentation changed.
+class OutputDirectory {
+
+ private:
+
+  string Directory;
+  vector<OutputFile> Files;
+  map<string, unsigned> FileIndices;
+  map<string, uint64_t> Manifest;
+
+  // Absolute directories CopyLocal leaves alone
+  vector<string> Excluded;
+
+  static string GetAbsolutePath(StringRef Source);
+  static bool IsUnder(StringRef Path, StringRef Parent);
+
+  string GetRelativePath(StringRef Source);
+  string GetManifestPath();
+  void ReadManifest();
+  bool WriteManifest();
+
+  static void WriteFile(unsigned Index, void *Data);
+
+ public:
+
+  OutputDirectory(string Directory);
+
+  // A source added again, as a header rewritten by more than one translation
+  // unit is, replaces what it was added with before
+  void Add(StringRef Source, StringRef Text);
+
+  // Adds Source as it is on disk, unless it has already been added
+  bool Copy(StringRef Source);
+
+  // As Copy, for a source under the working directory and outside of any
+  // excluded directory. Anything else is left out and counts as copied.
+  bool CopyLocal(StringRef Source);
+
+  void Exclude(StringRef Directory);
+
+  // Writes every added file, up to Jobs at a time. Returns false if any of
+  // them couldn't be written.
+  bool Write(unsigned Jobs);
+
+};
+
+} // End namespace speculation
+
+#endif
@@ -0,0 +1,509 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "PlanOptimizer.h"
+
+#include "DeclExtractor.h"
+#include "Globals.h"
+#include "PragmaDirective.h"
+#include "Tools.h"
+
+#include "clang/AST/RecursiveASTVisitor.h"
+
+using clang::dyn_cast;
+using clang::dyn_cast_or_null;
+using clang::isa;
+
+using clang::AbstractConditionalOperator;
+using clang::BinaryOperator;
+using clang::CompoundStmt;
+using clang::DeclStmt;
+using clang::DoStmt;
+using clang::RecursiveASTVisitor;
+using clang::SourceLocation;
+using clang::StmtExpr;
+using clang::UnaryExprOrTypeTraitExpr;
+using clang::VarDecl;
+using clang::WhileStmt;
+
+namespace speculation {
+
+// Looks for anything that splits a statement's evaluation over more than one
+// block of the control flow graph
+class BranchFinder
+    : public RecursiveASTVisitor<BranchFinder> {
+
+ private:
+
+  bool Found;
+
+ public:
+
+  BranchFinder()
+      : RecursiveASTVisitor<BranchFinder>(),
+        Found(false) {
+
+  }
+
+  bool FoundBranch() {
+    return Found;
+  }
+
+  bool VisitStmt(Stmt *S) {
+
+    BinaryOperator *Binary = dyn_cast<BinaryOperator>(S);
+
+    Found = isa<AbstractConditionalOperator>(S)
+            || isa<StmtExpr>(S)
+            || (Binary && Binary->isLogicalOp());
+
+    return !Found;
+
+  }
+
+};
+
+PlanOptimizer::PlanOptimizer(PragmaDirectiveMap &Directives,
+                             ParentMap &PM,
+                             CompilerInstance &CI)
+    : Directives(Directives),
+      PM(PM),
+      CI(CI),
+      Loops(CI),
+      Flow(NULL),
+      DirectiveScopes(),
+      CanonicalForms(),
+      ChunkLoops(),
+      CanonicalLoops() {
+
+}
+
+PlanOptimizer::~PlanOptimizer() {
+  delete Flow;
+}
+
+// Private
+bool PlanOptimizer::IsLoop(Stmt * S) {
+  return isa<ForStmt>(S) || isa<WhileStmt>(S) || isa<DoStmt>(S);
+}
+
+// Private
+PragmaDirective * PlanOptimizer::GetDirective(Stmt * S) {
+
+  // Directives are parsed as a compound statement header in front of the
+  // statement they apply to
+  PragmaDirectiveMap::iterator DirectiveIt;
+
+  DirectiveIt = Directives.find(S->getLocStart().getRawEncoding());
+
+  if (DirectiveIt != Directives.end()) {
+    return DirectiveIt->second;
+  }
+
+  CompoundStmt * Parent = dyn_cast_or_null<CompoundStmt>(PM.getParent(S));
+
+  if (!Parent) {
+    return NULL;
+  }
+
+  Stmt * Previous = NULL;
+  CompoundStmt::body_iterator BodyIt;
+
+  for (BodyIt = Parent->body_begin(); BodyIt != Parent->body_end(); BodyIt++) {
+
+    if (*BodyIt == S) {
+      break;
+    }
+
+    Previous = *BodyIt;
+
+  }
+
+  if (!Previous || !isa<CompoundStmt>(Previous)) {
+    return NULL;
+  }
+
+  DirectiveIt = Directives.find(Previous->getLocStart().getRawEncoding());
+
+  if (DirectiveIt != Directives.end()) {
+    return DirectiveIt->second;
+  }
+
+  return NULL;
+
+}
+
+// Private
+bool PlanOptimizer::HasDirectives(Stmt * S) {
+
+  map<Stmt *, bool>::iterator ScopeIt = DirectiveScopes.find(S);
+
+  if (ScopeIt != DirectiveScopes.end()) {
+    return ScopeIt->second;
+  }
+
+  bool Found = false;
+  PragmaDirectiveMap::iterator DirectiveIt;
+
+  for (DirectiveIt = Directives.begin();
+       !Found && DirectiveIt != Directives.end();
+       DirectiveIt++) {
+
+    SourceLocation Loc = SourceLocation::getFromRawEncoding(DirectiveIt->first);
+
+    Found = tools::InsideRange(Loc, S->getSourceRange(), CI);
+
+  }
+
+  DirectiveScopes.insert(make_pair(S, Found));
+
+  return Found;
+
+}
+
+// Private
+bool PlanOptimizer::IsStraight(Stmt * S) {
+
+  BranchFinder Finder;
+  Finder.TraverseStmt(S);
+
+  return !Finder.FoundBranch();
+
+}
+
+// Private
+bool PlanOptimizer::GetCanonical(ForStmt * Loop,
+                                 PragmaDirective * Directive,
+                                 CanonicalLoop *&Canonical) {
+
+  Canonical = &CanonicalLoops[Loop];
+
+  map<ForStmt *, bool>::iterator LoopIt = CanonicalForms.find(Loop);
+
+  if (LoopIt != CanonicalForms.end()) {
+    return LoopIt->second;
+  }
+
+  Canonical->Private = Directive->getPrivateIdentifiers();
+
+  bool Found = Directive->MainConstruct.Type == ForConstruct
+               && Loops.GetCanonicalLoop(Loop, *Canonical);
+
+  CanonicalForms.insert(make_pair(Loop, Found));
+
+  return Found;
+
+}
+
+// Private
+bool PlanOptimizer::GetChunkLoop(ForStmt * Loop,
+                                 PragmaDirective * Directive,
+                                 CanonicalLoop *&Canonical) {
+
+  map<ForStmt *, bool>::iterator LoopIt = ChunkLoops.find(Loop);
+
+  if (LoopIt != ChunkLoops.end()) {
+    Canonical = &CanonicalLoops[Loop];
+    return LoopIt->second;
+  }
+
+  // The setup goes in front of the directive, which for a combined parallel
+  // for is still serial code, where there's only the one thread
+  bool Chunked = !Directive->Parallel
+                 && GetCanonical(Loop, Directive, Canonical);
+
+  vector<PragmaClause>::iterator ClauseIt;
+
+  for (ClauseIt = Directive->Clauses.begin();
+       ClauseIt != Directive->Clauses.end();
+       ClauseIt++) {
+
+    // The schedule is about to be pinned down, and the others change which
+    // iterations a thread gets
+    if (ClauseIt->Type == ScheduleClause
+        || ClauseIt->Type == CollapseClause
+        || ClauseIt->Type == OrderedClause) {
+      Chunked = false;
+    }
+
+  }
+
+  Chunked = Chunked && !Loops.HasJumps(Loop->getBody());
+
+  ChunkLoops.insert(make_pair(Loop, Chunked));
+
+  return Chunked;
+
+}
+
+// Public
+Stmt * PlanOptimizer::GetHoistTarget(DeclRefExpr * Ref, Stmt * Root) {
+
+  if (!isa<VarDecl>(Ref->getDecl())
+      || !tools::IsValueType(Ref)
+      || tools::IsStructOrUnionType(Ref)
+      || Ref->getType().isVolatileQualified()) {
+    return NULL;
+  }
+
+  NamedDecl * D = globals::GetNamedDecl(Ref->getFoundDecl());
+
+  Stmt * Target = NULL;
+  Stmt * Current = Ref;
+
+  // Once a loop writes it, so does every loop around that one
+  while ((Current = PM.getParent(Current)) && Current != Root) {
+
+    if (GetDirective(Current)) {
+      break;
+    }
+
+    if (!IsLoop(Current)) {
+      continue;
+    }
+
+    if (Loops.MayWrite(Current, D)) {
+      break;
+    }
+
+    // A barrier inside starts tracking afresh, which a read hoisted above
+    // the loop would only be tracked before
+    if (HasDirectives(Current)) {
+      break;
+    }
+
+    Target = Current;
+
+  }
+
+  return Target;
+
+}
+
+// Public
+bool PlanOptimizer::GetChunkRange(ArraySubscriptExpr * Access,
+                                  Stmt * Root,
+                                  PragmaDirective * RootDirective,
+                                  PragmaDirective *&Directive,
+                                  CanonicalLoop *&Canonical,
+                                  AffineIndex &Index) {
+
+  DeclRefExpr * Base
+      = dyn_cast<DeclRefExpr>(Access->getBase()->IgnoreParenImpCasts());
+
+  if (!Base || !isa<VarDecl>(Base->getDecl())) {
+    return false;
+  }
+
+  // Only straight line code between the access and the loop's body, so the
+  // access happens on every iteration
+  Stmt * Child = Access;
+  Stmt * Current;
+  ForStmt * Loop = NULL;
+
+  while (!Loop && (Current = PM.getParent(Child))) {
+
+    if (ForStmt * For = dyn_cast<ForStmt>(Current)) {
+
+      if (Child != For->getBody()) {
+        return false;
+      }
+
+      Directive = Current == Root ? RootDirective : GetDirective(For);
+      Loop = For;
+
+    } else if (isa<AbstractConditionalOperator>(Current)
+               || isa<UnaryExprOrTypeTraitExpr>(Current)) {
+
+      return false;
+
+    } else if (BinaryOperator * Binary = dyn_cast<BinaryOperator>(Current)) {
+
+      if (Binary->isLogicalOp()) {
+        return false;
+      }
+
+    } else if (!isa<Expr>(Current)
+               && !isa<CompoundStmt>(Current)
+               && !isa<DeclStmt>(Current)) {
+
+      return false;
+
+    }
+
+    if (Current == Root) {
+      break;
+    }
+
+    Child = Current;
+
+  }
+
+  // The code in front of a nested loop's directive has to be somewhere a
+  // declaration can go. The start point's own loop is always given brackets.
+  if (!Loop
+      || !Directive
+      || (Loop != Root && !isa<CompoundStmt>(PM.getParent(Loop)))
+      || !GetChunkLoop(Loop, Directive, Canonical)) {
+    return false;
+  }
+
+  if (!Base->getType()->isArrayType() && !Loops.IsInvariant(Base, *Canonical)) {
+    return false;
+  }
+
+  return Loops.GetAffineIndex(Access->getIdx(), *Canonical, Index)
+         && Index.Scale > 0;
+
+}
+
+// Public
+bool PlanOptimizer::GetLoopIndex(ArraySubscriptExpr * Access,
+                                 Stmt * Root,
+                                 PragmaDirective * RootDirective,
+                                 ForStmt *&Loop,
+                                 AffineIndex &Index) {
+
+  DeclRefExpr * Base
+      = dyn_cast<DeclRefExpr>(Access->getBase()->IgnoreParenImpCasts());
+
+  if (!Base || !isa<VarDecl>(Base->getDecl())) {
+    return false;
+  }
+
+  // The innermost loop with an omp for directive, with the access in its body
+  Stmt * Child = Access;
+  Stmt * Current = NULL;
+  PragmaDirective * Directive = NULL;
+
+  Loop = NULL;
+
+  while (!Loop && (Current = PM.getParent(Child))) {
+
+    ForStmt * For = dyn_cast<ForStmt>(Current);
+
+    if (For && Child == For->getBody()) {
+
+      Directive = Current == Root ? RootDirective : GetDirective(For);
+
+      if (Directive && Directive->MainConstruct.Type == ForConstruct) {
+        Loop = For;
+      }
+
+    }
+
+    if (Current == Root) {
+      break;
+    }
+
+    Child = Current;
+
+  }
+
+  if (!Loop) {
+    return false;
+  }
+
+  // A collapsed loop hands out the iterations of the loops inside it
+  vector<PragmaClause>::iterator ClauseIt;
+
+  for (ClauseIt = Directive->Clauses.begin();
+       ClauseIt != Directive->Clauses.end();
+       ClauseIt++) {
+
+    if (ClauseIt->Type == CollapseClause) {
+      return false;
+    }
+
+  }
+
+  Current = Loop;
+
+  while (Current != Root && (Current = PM.getParent(Current))) {
+
+    if (IsLoop(Current)) {
+      return false;
+    }
+
+  }
+
+  CanonicalLoop * Canonical = NULL;
+
+  if (!GetCanonical(Loop, Directive, Canonical)) {
+    return false;
+  }
+
+  if (!Base->getType()->isArrayType() && !Loops.IsInvariant(Base, *Canonical)) {
+    return false;
+  }
+
+  return Loops.GetAffineIndex(Access->getIdx(), *Canonical, Index);
+
+}
+
+// Public
+bool PlanOptimizer::MayDepend(AffineIndex &A, AffineIndex &B) {
+  return Loops.MayDepend(A, B);
+}
+
+// Public
+bool PlanOptimizer::IsCovered(Stmt * Site,
+                              Stmt * Other,
+                              Expr * Address,
+                              Stmt * Root) {
+
+  if (Site == Other
+      || !IsStraight(Site)
+      || !IsStraight(Other)
+      || Address->HasSideEffects(CI.getASTContext())) {
+    return false;
+  }
+
+  if (!Flow) {
+    Flow = new FlowAnalysis(Root, PM, Loops, CI);
+  }
+
+  if (!Flow->Dominates(Site, Other)) {
+    return false;
+  }
+
+  // Without gotos, the last time Site ran before Other was inside the
+  // smallest statement around both. Barriers don't show up in the graph,
+  // so there mustn't be any directive in there.
+  set<Stmt *> Ancestors;
+
+  for (Stmt * Current = Site; Current; Current = PM.getParent(Current)) {
+    Ancestors.insert(Current);
+  }
+
+  Stmt * Common = Other;
+
+  while (Common && !Ancestors.count(Common)) {
+    Common = PM.getParent(Common);
+  }
+
+  if (!Common || HasDirectives(Common)) {
+    return false;
+  }
+
+  set<NamedDecl *> Decls;
+  DeclExtractor Extractor(Decls);
+  Extractor.TraverseStmt(Address);
+
+  set<NamedDecl *>::iterator DeclIt;
+
+  for (DeclIt = Decls.begin(); DeclIt != Decls.end(); DeclIt++) {
+
+    if (isa<VarDecl>(*DeclIt) && Flow->MayWriteBetween(Site, Other, *DeclIt)) {
+      return false;
+    }
+
+  }
+
+  return true;
+
+}
+
+} // End namespace speculation
@@ -0,0 +1,120 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _PLANOPTIMIZER_H_
+#define _PLANOPTIMIZER_H_
+
+#include "Classes.h"
+#include "FlowAnalysis.h"
+#include "LoopAnalysis.h"
+
+#include "clang/AST/AST.h"
+#include "clang/AST/ParentMap.h"
+#include "clang/Frontend/CompilerInstance.h"
+
+using clang::ArraySubscriptExpr;
+using clang::CompilerInstance;
+using clang::DeclRefExpr;
+using clang::Expr;
+using clang::ForStmt;
+using clang::NamedDecl;
+using clang::ParentMap;
+using clang::Stmt;
+
+namespace speculation {
+
+// Answers questions about where in a handler start point an access can be
+// moved to without changing which addresses end up tracked.
+class PlanOptimizer {
+
+ private:
+
+  PragmaDirectiveMap &Directives;
+  ParentMap &PM;
+  CompilerInstance &CI;
+  LoopAnalysis Loops;
+
+  // Built on the first question that needs it
+  FlowAnalysis * Flow;
+
+  // Statements already checked by HasDirectives, and whether they qualified
+  map<Stmt *, bool> DirectiveScopes;
+
+  // Loops already checked by GetCanonical and GetChunkLoop, and whether they
+  // qualified
+  map<ForStmt *, bool> CanonicalForms;
+  map<ForStmt *, bool> ChunkLoops;
+  map<ForStmt *, CanonicalLoop> CanonicalLoops;
+
+  bool IsLoop(Stmt * S);
+
+  // The directive in front of S, if there is one
+  PragmaDirective * GetDirective(Stmt * S);
+
+  // Whether a directive is inside S, which may be a barrier or need one
+  bool HasDirectives(Stmt * S);
+
+  // Whether S is evaluated in one go, with no branches inside
+  bool IsStraight(Stmt * S);
+
+  bool GetCanonical(ForStmt * Loop,
+                    PragmaDirective * Directive,
+                    CanonicalLoop *&Canonical);
+
+  bool GetChunkLoop(ForStmt * Loop,
+                    PragmaDirective * Directive,
+                    CanonicalLoop *&Canonical);
+
+ public:
+
+  PlanOptimizer(PragmaDirectiveMap &Directives,
+                ParentMap &PM,
+                CompilerInstance &CI);
+  ~PlanOptimizer();
+
+  // The outermost loop inside Root that never writes Ref's variable, or NULL.
+  // A read of the variable before that loop tracks the same address as every
+  // read of it inside. Loops can't be left past a directive, as the read
+  // would then be outside the construct, nor hoisted out of when they hold
+  // one, as its check would leave the later reads untracked.
+  Stmt * GetHoistTarget(DeclRefExpr * Ref, Stmt * Root);
+
+  // Finds the omp for loop that Access is evaluated in exactly once per
+  // iteration, with an index that's affine in the loop's induction variable.
+  // The loop has to be in canonical form with no schedule clause, so that it
+  // can be given a static one and each thread's iterations are known up
+  // front. Root is the start point's statement, and RootDirective the
+  // directive in front of it, if any.
+  bool GetChunkRange(ArraySubscriptExpr * Access,
+                     Stmt * Root,
+                     PragmaDirective * RootDirective,
+                     PragmaDirective *&Directive,
+                     CanonicalLoop *&Canonical,
+                     AffineIndex &Index);
+
+  // Finds the omp for loop whose iterations Access is spread over, with an
+  // index that's affine in the loop's induction variable. Unlike
+  // GetChunkRange the access can be anywhere in the loop's body and the loop
+  // can have any schedule, but each of its iterations has to run once per
+  // start point, so it can't be collapsed or inside another loop.
+  bool GetLoopIndex(ArraySubscriptExpr * Access,
+                    Stmt * Root,
+                    PragmaDirective * RootDirective,
+                    ForStmt *&Loop,
+                    AffineIndex &Index);
+
+  bool MayDepend(AffineIndex &A, AffineIndex &B);
+
+  // Whether Address, tracked just ahead of the statement Site, is still
+  // tracked at the same address whenever the statement Other starts. Site
+  // has to run first on every path to Other, with nothing in between that
+  // may change what Address evaluates to or reset what's been tracked.
+  bool IsCovered(Stmt * Site, Stmt * Other, Expr * Address, Stmt * Root);
+
+};
+
+} // End namespace speculation
+
+#endif
@@ -11,6 +11,8 @@
 #include "clang/AST/AST.h"
 #include "clang/Lex/Preprocessor.h"
 
+#include "llvm/Support/Allocator.h"
+
 using clang::IdentifierInfo;
 using clang::SourceRange;
 using clang::Token;
@@ -109,6 +111,10 @@ class PragmaDirective {
   
 };
 
+// Directives are only ever freed all at once, with their translation unit
+typedef llvm::SpecificBumpPtrAllocator<PragmaDirective>
+    PragmaDirectiveAllocator;
+
 } // End namespace "speculation"
 
 #endif
@@ -0,0 +1,437 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "PrivateInference.h"
+
+#include "DeclExtractor.h"
+#include "FlowAnalysis.h"
+#include "PragmaDirective.h"
+#include "Tools.h"
+
+#include "clang/AST/RecursiveASTVisitor.h"
+
+#include "llvm/ADT/APSInt.h"
+
+using clang::dyn_cast;
+using clang::dyn_cast_or_null;
+using clang::isa;
+
+using clang::ArraySubscriptExpr;
+using clang::ASTContext;
+using clang::BinaryOperator;
+using clang::CompoundStmt;
+using clang::ConstantArrayType;
+using clang::DeclRefExpr;
+using clang::Expr;
+using clang::IdentifierInfo;
+using clang::ImplicitCastExpr;
+using clang::NamedDecl;
+using clang::ParenExpr;
+using clang::QualType;
+using clang::RecursiveASTVisitor;
+
+namespace speculation {
+
+// Arrays with more elements than this aren't followed element by element
+static const unsigned MaxFacts = 64;
+
+// Collects every reference to a variable in a statement
+class RefCollector
+    : public RecursiveASTVisitor<RefCollector> {
+
+ private:
+
+  VarDecl *VD;
+  vector<DeclRefExpr *> &Refs;
+
+ public:
+
+  RefCollector(VarDecl *VD, vector<DeclRefExpr *> &Refs)
+      : RecursiveASTVisitor<RefCollector>(),
+        VD(VD),
+        Refs(Refs) {
+
+  }
+
+  bool VisitDeclRefExpr(DeclRefExpr *E) {
+
+    if (E->getDecl() == VD) {
+      Refs.push_back(E);
+    }
+
+    return true;
+
+  }
+
+};
+
+// Collects the headers of the directives in a statement that only one
+// thread runs the statement after
+class OneThreadFinder
+    : public RecursiveASTVisitor<OneThreadFinder> {
+
+ private:
+
+  PragmaDirectiveMap &Directives;
+  vector<CompoundStmt *> &Headers;
+
+ public:
+
+  OneThreadFinder(PragmaDirectiveMap &Directives,
+                  vector<CompoundStmt *> &Headers)
+      : RecursiveASTVisitor<OneThreadFinder>(),
+        Directives(Directives),
+        Headers(Headers) {
+
+  }
+
+  bool VisitCompoundStmt(CompoundStmt *S) {
+
+    PragmaDirectiveMap::iterator DirectiveIt;
+    DirectiveIt = Directives.find(S->getLocStart().getRawEncoding());
+
+    if (DirectiveIt != Directives.end()
+        && (DirectiveIt->second->MainConstruct.Type == SingleConstruct
+            || DirectiveIt->second->MainConstruct.Type == MasterConstruct)) {
+      Headers.push_back(S);
+    }
+
+    return true;
+
+  }
+
+};
+
+// One fact per element of a variable, set once the element is written. Only
+// an assignment to the whole variable, or to an element at a constant index,
+// writes it. Any other reference reads it, which needs the element set, or
+// all of them when it isn't known which.
+class DefinitionTransfer
+    : public FlowTransfer {
+
+ private:
+
+  VarDecl *VD;
+  unsigned NumFacts;
+  ParentMap &PM;
+  ASTContext &Context;
+
+  bool Mentions(Stmt *S) {
+
+    vector<DeclRefExpr *> Refs;
+    RefCollector Collector(VD, Refs);
+    Collector.TraverseStmt(S);
+
+    return !Refs.empty();
+
+  }
+
+  // The element at Access's index, or -1 if it isn't a known one
+  int GetElement(ArraySubscriptExpr *Access) {
+
+    llvm::APSInt Index;
+
+    if (!Access->getIdx()->EvaluateAsInt(Index, Context)
+        || Index.isNegative()
+        || Index.uge(NumFacts)) {
+      return -1;
+    }
+
+    return static_cast<int>(Index.getZExtValue());
+
+  }
+
+  // The element Ref is used for, or -1 for the whole variable
+  int GetFact(DeclRefExpr *Ref) {
+
+    if (!VD->getType()->isArrayType()) {
+      return -1;
+    }
+
+    Stmt *Child = Ref;
+    Stmt *Parent = PM.getParent(Child);
+
+    while (Parent
+           && (isa<ImplicitCastExpr>(Parent) || isa<ParenExpr>(Parent))) {
+      Child = Parent;
+      Parent = PM.getParent(Child);
+    }
+
+    ArraySubscriptExpr *Access = dyn_cast_or_null<ArraySubscriptExpr>(Parent);
+
+    if (!Access || Access->getBase() != Child) {
+      return -1;
+    }
+
+    return GetElement(Access);
+
+  }
+
+ public:
+
+  DefinitionTransfer(VarDecl *VD,
+                     unsigned NumFacts,
+                     ParentMap &PM,
+                     ASTContext &Context)
+      : FlowTransfer(),
+        VD(VD),
+        NumFacts(NumFacts),
+        PM(PM),
+        Context(Context) {
+
+  }
+
+  bool Apply(Stmt *S, llvm::BitVector &Facts) {
+
+    BinaryOperator *Assign = dyn_cast<BinaryOperator>(S);
+
+    if (Assign
+        && Assign->getOpcode() == clang::BO_Assign
+        && !Mentions(Assign->getRHS())) {
+
+      Expr *LHS = Assign->getLHS()->IgnoreParens();
+
+      if (DeclRefExpr *Ref = dyn_cast<DeclRefExpr>(LHS)) {
+
+        if (Ref->getDecl() == VD) {
+          Facts.set();
+          return true;
+        }
+
+      } else if (ArraySubscriptExpr *Access
+                     = dyn_cast<ArraySubscriptExpr>(LHS)) {
+
+        DeclRefExpr *Base
+            = dyn_cast<DeclRefExpr>(Access->getBase()->IgnoreParenImpCasts());
+
+        if (Base && Base->getDecl() == VD && !Mentions(Access->getIdx())) {
+
+          int Element = GetElement(Access);
+
+          if (Element >= 0) {
+            Facts.set(Element);
+          }
+
+          return true;
+
+        }
+
+      }
+
+    }
+
+    vector<DeclRefExpr *> Refs;
+    RefCollector Collector(VD, Refs);
+    Collector.TraverseStmt(S);
+
+    vector<DeclRefExpr *>::iterator RefIt;
+
+    for (RefIt = Refs.begin(); RefIt != Refs.end(); RefIt++) {
+
+      int Fact = GetFact(*RefIt);
+
+      if (Fact < 0 ? Facts.count() != Facts.size() : !Facts.test(Fact)) {
+        return false;
+      }
+
+    }
+
+    return true;
+
+  }
+
+};
+
+PrivateInference::PrivateInference(PragmaDirectiveMap &Directives,
+                                   CompilerInstance &CI)
+    : Directives(Directives),
+      CI(CI),
+      Loops(CI) {
+
+}
+
+// Private
+unsigned PrivateInference::GetNumFacts(VarDecl * VD) {
+
+  QualType QT = VD->getType();
+
+  if (!VD->hasLocalStorage()
+      || QT.isVolatileQualified()
+      || QT.isConstQualified()
+      || Loops.MayBeAliased(VD)) {
+    return 0;
+  }
+
+  const ConstantArrayType * Array
+      = CI.getASTContext().getAsConstantArrayType(QT);
+
+  if (Array) {
+
+    if (Array->getElementType()->isArrayType()
+        || Array->getSize().ugt(MaxFacts)
+        || Array->getSize() == 0) {
+      return 0;
+    }
+
+    return static_cast<unsigned>(Array->getSize().getZExtValue());
+
+  }
+
+  return QT->isArrayType() ? 0 : 1;
+
+}
+
+// Private
+bool PrivateInference::IsUsedOutside(VarDecl * VD,
+                                     Stmt * S,
+                                     FunctionDecl * F) {
+
+  vector<DeclRefExpr *> Refs;
+  RefCollector Collector(VD, Refs);
+  Collector.TraverseStmt(F->getBody());
+
+  vector<DeclRefExpr *>::iterator RefIt;
+
+  for (RefIt = Refs.begin(); RefIt != Refs.end(); RefIt++) {
+
+    if (!tools::IsChild(*RefIt, S)) {
+      return true;
+    }
+
+  }
+
+  return false;
+
+}
+
+// Private
+bool PrivateInference::IsUsedByOneThread(VarDecl * VD,
+                                         Stmt * S,
+                                         ParentMap &PM) {
+
+  vector<CompoundStmt *> Headers;
+  OneThreadFinder Finder(Directives, Headers);
+  Finder.TraverseStmt(S);
+
+  vector<CompoundStmt *>::iterator HeaderIt;
+
+  for (HeaderIt = Headers.begin(); HeaderIt != Headers.end(); HeaderIt++) {
+
+    CompoundStmt * Parent
+        = dyn_cast_or_null<CompoundStmt>(PM.getParent(*HeaderIt));
+
+    if (!Parent) {
+      return true;
+    }
+
+    // The directive applies to the statement after its header
+    CompoundStmt::body_iterator BodyIt = Parent->body_begin();
+
+    while (BodyIt != Parent->body_end() && *BodyIt != *HeaderIt) {
+      BodyIt++;
+    }
+
+    if (BodyIt == Parent->body_end() || ++BodyIt == Parent->body_end()) {
+      continue;
+    }
+
+    vector<DeclRefExpr *> Refs;
+    RefCollector Collector(VD, Refs);
+    Collector.TraverseStmt(*BodyIt);
+
+    if (!Refs.empty()) {
+      return true;
+    }
+
+  }
+
+  return false;
+
+}
+
+// Public
+vector<VarDecl *> PrivateInference::Infer(PragmaDirective * Directive,
+                                          Stmt * S) {
+
+  vector<VarDecl *> Inferred;
+
+  FunctionDecl * F = tools::GetEnclosingFunction(S);
+
+  if (!F || !F->hasBody()) {
+    return Inferred;
+  }
+
+  // Anything a clause names has already been decided on
+  set<IdentifierInfo *> Named;
+  vector<PragmaClause>::iterator ClauseIt;
+
+  for (ClauseIt = Directive->Clauses.begin();
+       ClauseIt != Directive->Clauses.end();
+       ClauseIt++) {
+    Named.insert(ClauseIt->Options.begin(), ClauseIt->Options.end());
+  }
+
+  set<NamedDecl *> Decls;
+  DeclExtractor Extractor(Decls);
+  Extractor.TraverseStmt(S);
+
+  // Keyed on where they're declared, so they come out in that order
+  map<unsigned, pair<VarDecl *, unsigned> > Candidates;
+  set<NamedDecl *>::iterator DeclIt;
+
+  for (DeclIt = Decls.begin(); DeclIt != Decls.end(); DeclIt++) {
+
+    VarDecl * VD = dyn_cast<VarDecl>(*DeclIt);
+
+    if (!VD
+        || Named.count(VD->getIdentifier())
+        || tools::InsideRange(VD->getLocation(), S->getSourceRange(), CI)) {
+      continue;
+    }
+
+    unsigned NumFacts = GetNumFacts(VD);
+
+    if (NumFacts == 0 || !Loops.MayWrite(S, VD) || IsUsedOutside(VD, S, F)) {
+      continue;
+    }
+
+    Candidates.insert(make_pair(VD->getLocation().getRawEncoding(),
+                                make_pair(VD, NumFacts)));
+
+  }
+
+  if (Candidates.empty()) {
+    return Inferred;
+  }
+
+  ParentMap PM(S);
+  FlowAnalysis Flow(S, PM, Loops, CI);
+
+  map<unsigned, pair<VarDecl *, unsigned> >::iterator CandidateIt;
+
+  for (CandidateIt = Candidates.begin();
+       CandidateIt != Candidates.end();
+       CandidateIt++) {
+
+    VarDecl * VD = CandidateIt->second.first;
+    unsigned NumFacts = CandidateIt->second.second;
+
+    if (IsUsedByOneThread(VD, S, PM)) {
+      continue;
+    }
+
+    DefinitionTransfer Transfer(VD, NumFacts, PM, CI.getASTContext());
+
+    if (Flow.Satisfies(Transfer, NumFacts)) {
+      Inferred.push_back(VD);
+    }
+
+  }
+
+  return Inferred;
+
+}
+
+} // End namespace speculation
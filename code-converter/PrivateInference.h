@@ -0,0 +1,57 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _PRIVATEINFERENCE_H_
+#define _PRIVATEINFERENCE_H_
+
+#include "Classes.h"
+#include "LoopAnalysis.h"
+
+#include "clang/AST/AST.h"
+#include "clang/AST/ParentMap.h"
+#include "clang/Frontend/CompilerInstance.h"
+
+using clang::CompilerInstance;
+using clang::FunctionDecl;
+using clang::ParentMap;
+using clang::Stmt;
+using clang::VarDecl;
+
+namespace speculation {
+
+// Finds the shared variables of a top level directive that could have been
+// private: every thread writes them before reading them inside the region,
+// and nothing outside it uses them. Only locals whose address is never taken
+// are considered, along with arrays of them small enough to follow element
+// by element.
+class PrivateInference {
+
+ private:
+
+  PragmaDirectiveMap &Directives;
+  CompilerInstance &CI;
+  LoopAnalysis Loops;
+
+  // How many elements of VD are followed, or 0 if it can't be inferred
+  unsigned GetNumFacts(VarDecl * VD);
+
+  bool IsUsedOutside(VarDecl * VD, Stmt * S, FunctionDecl * F);
+
+  // Whether VD is used inside a construct in S that not every thread runs
+  bool IsUsedByOneThread(VarDecl * VD, Stmt * S, ParentMap &PM);
+
+ public:
+
+  PrivateInference(PragmaDirectiveMap &Directives, CompilerInstance &CI);
+
+  // The variables, in the order they're declared in. S is the statement
+  // Directive applies to.
+  vector<VarDecl *> Infer(PragmaDirective * Directive, Stmt * S);
+
+};
+
+} // End namespace speculation
+
+#endif
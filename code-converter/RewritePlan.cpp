@@ -0,0 +1,708 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "RewritePlan.h"
+
+#include "Log.h"
+#include "Tools.h"
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Rewrite/Core/Rewriter.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/YAMLParser.h"
+#include "llvm/Support/raw_ostream.h"
+
+using clang::FileEntry;
+using clang::FileID;
+using clang::Rewriter;
+using clang::SourceManager;
+
+namespace speculation {
+
+RewritePlan::RewritePlan()
+    : Edits(),
+      Tables(0),
+      Units(),
+      Hashes(),
+      Failed(false) {
+
+}
+
+static const char * GetKindName(PlanEditKind Kind) {
+
+  switch (Kind) {
+   case AccessEdit:    return "access";
+   case CacheInitEdit: return "cache-init";
+   case CheckEdit:     return "check";
+   case TablesEdit:    return "tables";
+   case BracketEdit:   return "brackets";
+   case RegionEdit:    return "region";
+   case InitEdit:      return "init";
+   case HeaderEdit:    return "header";
+  }
+
+  assert(false && "Unknown plan edit kind");
+  return "";
+
+}
+
+static bool GetKind(StringRef Name, PlanEditKind &Kind) {
+
+  PlanEditKind Kinds[] = {
+    AccessEdit, CacheInitEdit, CheckEdit, TablesEdit, BracketEdit, RegionEdit,
+    InitEdit, HeaderEdit
+  };
+
+  for (unsigned i = 0; i < sizeof(Kinds) / sizeof(Kinds[0]); i++) {
+
+    if (Name == GetKindName(Kinds[i])) {
+      Kind = Kinds[i];
+      return true;
+    }
+
+  }
+
+  return false;
+
+}
+
+// Private
+
+bool RewritePlan::GetFileOffset(CompilerInstance &CI,
+                                SourceLocation Loc,
+                                string &File,
+                                unsigned &Offset) {
+
+  SourceManager &SM = CI.getSourceManager();
+
+  // The Rewriter can't edit anything but file locations either
+  if (Loc.isInvalid() || !Loc.isFileID()) {
+    logging::Out() << "\tCouldn't record an edit at "
+                   << (Loc.isValid() ? Loc.printToString(SM) : "<invalid>")
+                   << ", which isn't in a file\n";
+    Failed = true;
+    return false;
+  }
+
+  std::pair<FileID, unsigned> Decomposed = SM.getDecomposedLoc(Loc);
+
+  const FileEntry *FE = SM.getFileEntryForID(Decomposed.first);
+
+  if (!FE) {
+    logging::Out() << "\tCouldn't record an edit at "
+                   << Loc.printToString(SM) << ", which isn't in a file\n";
+    Failed = true;
+    return false;
+  }
+
+  File = FE->getName();
+  Offset = Decomposed.second;
+
+  if (!Hashes.count(File)) {
+    StringRef Contents = SM.getBuffer(Decomposed.first)->getBuffer();
+    Hashes[File] = tools::HashString(Contents);
+  }
+
+  return true;
+
+}
+
+// Public
+
+string RewritePlan::Render(const PlanEdit &Edit, int Tables) {
+
+  stringstream ss;
+  vector<string>::const_iterator NameIt;
+
+  switch (Edit.Kind) {
+
+   case AccessEdit:
+    ss << "SPEC" << (Edit.Write ? "WRITE" : "READ")
+       << (Edit.Range ? "RANGE" : "")
+       << "(" << Edit.Decl << ", " << Edit.Expr << ");\n";
+    break;
+
+   case CacheInitEdit:
+    for (NameIt = Edit.Reads.begin(); NameIt != Edit.Reads.end(); NameIt++) {
+      ss << (Edit.Leading ? "\n" : "") << "SPECREADINIT(" << *NameIt << ");"
+         << (Edit.Leading ? "" : "\n");
+    }
+    for (NameIt = Edit.Writes.begin(); NameIt != Edit.Writes.end(); NameIt++) {
+      ss << (Edit.Leading ? "\n" : "") << "SPECWRITEINIT(" << *NameIt << ");"
+         << (Edit.Leading ? "" : "\n");
+    }
+    break;
+
+   case CheckEdit:
+    ss << "\ndetectDependences();\n";
+    break;
+
+   case TablesEdit:
+    ss << "createTables(" << Tables << ");\n";
+    break;
+
+   default:
+    return Edit.Text;
+
+  }
+
+  return ss.str();
+
+}
+
+void RewritePlan::RecordInsert(CompilerInstance &CI,
+                               SourceLocation Loc,
+                               PlanEdit Edit) {
+
+  if (!GetFileOffset(CI, Loc, Edit.File, Edit.Offset)) {
+    return;
+  }
+
+  Edit.Unit = Units.insert(make_pair(&CI, Units.size())).first->second;
+  Edit.Length = 0;
+
+  Edits.push_back(Edit);
+
+}
+
+void RewritePlan::RecordRemove(CompilerInstance &CI,
+                               SourceRange Range,
+                               PlanEditKind Kind) {
+
+  PlanEdit Edit;
+  string EndFile;
+  unsigned EndOffset;
+
+  if (!GetFileOffset(CI, Range.getBegin(), Edit.File, Edit.Offset)
+      || !GetFileOffset(CI, Range.getEnd(), EndFile, EndOffset)) {
+    return;
+  }
+
+  if (EndFile != Edit.File || EndOffset < Edit.Offset) {
+    logging::Out() << "\tCouldn't record a removal spanning "
+                   << Range.getBegin().printToString(CI.getSourceManager())
+                   << " to "
+                   << Range.getEnd().printToString(CI.getSourceManager())
+                   << "\n";
+    Failed = true;
+    return;
+  }
+
+  // Like the Rewriter, the range ends with its last token
+  EndOffset += clang::Lexer::MeasureTokenLength(Range.getEnd(),
+                                                CI.getSourceManager(),
+                                                CI.getLangOpts());
+
+  Edit.Kind = Kind;
+  Edit.Unit = Units.insert(make_pair(&CI, Units.size())).first->second;
+  Edit.Length = EndOffset - Edit.Offset;
+  Edit.InsertAfter = false;
+  Edit.IndentNewLines = false;
+
+  Edits.push_back(Edit);
+
+}
+
+void RewritePlan::SetTables(int Size) {
+  Tables = Size;
+}
+
+static void WriteNames(llvm::raw_ostream &Out, const vector<string> &Names) {
+
+  Out << "[";
+
+  vector<string>::const_iterator NameIt;
+
+  for (NameIt = Names.begin(); NameIt != Names.end(); NameIt++) {
+    Out << (NameIt != Names.begin() ? ", " : "")
+        << "\"" << tools::JSONEscape(*NameIt) << "\"";
+  }
+
+  Out << "]";
+
+}
+
+bool RewritePlan::Write(string Filename) {
+
+  if (Failed) {
+    return false;
+  }
+
+  string Error;
+  llvm::raw_fd_ostream Out(Filename.c_str(), Error);
+
+  if (!Error.empty()) {
+    return false;
+  }
+
+  Out << "{\"version\": 3, \"tables\": " << Tables << ", \"files\": [\n";
+
+  map<string, uint64_t>::iterator HashIt;
+
+  for (HashIt = Hashes.begin(); HashIt != Hashes.end(); HashIt++) {
+
+    if (HashIt != Hashes.begin()) {
+      Out << ",\n";
+    }
+
+    Out << "  {\"file\": \"" << tools::JSONEscape(HashIt->first) << "\""
+        << ", \"hash\": \"";
+    Out.write_hex(HashIt->second) << "\"}";
+
+  }
+
+  Out << "\n], \"edits\": [\n";
+
+  vector<PlanEdit>::iterator EditIt;
+
+  for (EditIt = Edits.begin(); EditIt != Edits.end(); EditIt++) {
+
+    if (EditIt != Edits.begin()) {
+      Out << ",\n";
+    }
+
+    Out << "  {\"kind\": \"" << GetKindName(EditIt->Kind) << "\""
+        << ", \"unit\": " << EditIt->Unit
+        << ", \"file\": \"" << tools::JSONEscape(EditIt->File) << "\""
+        << ", \"offset\": " << EditIt->Offset
+        << ", \"length\": " << EditIt->Length
+        << ", \"after\": " << (EditIt->InsertAfter ? "true" : "false")
+        << ", \"indent\": " << (EditIt->IndentNewLines ? "true" : "false");
+
+    switch (EditIt->Kind) {
+
+     case AccessEdit:
+      Out << ", \"decl\": \"" << tools::JSONEscape(EditIt->Decl) << "\""
+          << ", \"expr\": \"" << tools::JSONEscape(EditIt->Expr) << "\""
+          << ", \"write\": " << (EditIt->Write ? "true" : "false")
+          << ", \"range\": " << (EditIt->Range ? "true" : "false");
+      break;
+
+     case CacheInitEdit:
+      Out << ", \"reads\": ";
+      WriteNames(Out, EditIt->Reads);
+      Out << ", \"writes\": ";
+      WriteNames(Out, EditIt->Writes);
+      Out << ", \"leading\": " << (EditIt->Leading ? "true" : "false");
+      break;
+
+     case CheckEdit:
+     case TablesEdit:
+      break;
+
+     default:
+      Out << ", \"text\": \"" << tools::JSONEscape(EditIt->Text) << "\"";
+
+    }
+
+    Out << "}";
+
+  }
+
+  Out << "\n]}\n";
+
+  return !Out.has_error();
+
+}
+
+static bool GetScalar(llvm::yaml::Node *N, string &Value) {
+
+  llvm::yaml::ScalarNode *Scalar =
+      llvm::dyn_cast_or_null<llvm::yaml::ScalarNode>(N);
+
+  if (!Scalar) {
+    return false;
+  }
+
+  llvm::SmallString<128> Storage;
+  Value = Scalar->getValue(Storage);
+
+  return true;
+
+}
+
+static bool GetNames(llvm::yaml::Node *N, vector<string> &Names) {
+
+  llvm::yaml::SequenceNode *Sequence =
+      llvm::dyn_cast_or_null<llvm::yaml::SequenceNode>(N);
+
+  if (!Sequence) {
+    return false;
+  }
+
+  llvm::yaml::SequenceNode::iterator NameIt;
+
+  for (NameIt = Sequence->begin(); NameIt != Sequence->end(); ++NameIt) {
+
+    string Name;
+
+    if (!GetScalar(&*NameIt, Name)) {
+      return false;
+    }
+
+    Names.push_back(Name);
+
+  }
+
+  return true;
+
+}
+
+static bool ReadHash(llvm::yaml::MappingNode *Mapping,
+                     map<string, uint64_t> &Hashes) {
+
+  string File;
+  string Hash;
+
+  llvm::yaml::MappingNode::iterator It;
+
+  for (It = Mapping->begin(); It != Mapping->end(); ++It) {
+
+    string Key;
+    string Value;
+
+    if (!GetScalar(It->getKey(), Key) || !GetScalar(It->getValue(), Value)) {
+      return false;
+    }
+
+    if (Key == "file") {
+      File = Value;
+    } else if (Key == "hash") {
+      Hash = Value;
+    }
+
+  }
+
+  uint64_t Value;
+
+  if (File.empty() || StringRef(Hash).getAsInteger(16, Value)) {
+    return false;
+  }
+
+  Hashes[File] = Value;
+
+  return true;
+
+}
+
+static bool ReadEdit(llvm::yaml::MappingNode *Mapping, PlanEdit &Edit) {
+
+  string Kind;
+  string Unit;
+  string Offset;
+  string Length;
+  string After;
+  string Indent;
+  string Write;
+  string Range;
+  string Leading;
+
+  llvm::yaml::MappingNode::iterator It;
+
+  for (It = Mapping->begin(); It != Mapping->end(); ++It) {
+
+    string Key;
+    string Value;
+
+    if (!GetScalar(It->getKey(), Key)) {
+      return false;
+    }
+
+    if (Key == "reads" || Key == "writes") {
+
+      if (!GetNames(It->getValue(), Key == "reads" ? Edit.Reads
+                                                   : Edit.Writes)) {
+        return false;
+      }
+
+      continue;
+
+    }
+
+    if (!GetScalar(It->getValue(), Value)) {
+      return false;
+    }
+
+    if (Key == "kind") {
+      Kind = Value;
+    } else if (Key == "unit") {
+      Unit = Value;
+    } else if (Key == "file") {
+      Edit.File = Value;
+    } else if (Key == "offset") {
+      Offset = Value;
+    } else if (Key == "length") {
+      Length = Value;
+    } else if (Key == "after") {
+      After = Value;
+    } else if (Key == "indent") {
+      Indent = Value;
+    } else if (Key == "text") {
+      Edit.Text = Value;
+    } else if (Key == "decl") {
+      Edit.Decl = Value;
+    } else if (Key == "expr") {
+      Edit.Expr = Value;
+    } else if (Key == "write") {
+      Write = Value;
+    } else if (Key == "range") {
+      Range = Value;
+    } else if (Key == "leading") {
+      Leading = Value;
+    }
+
+  }
+
+  Edit.InsertAfter = After == "true";
+  Edit.IndentNewLines = Indent == "true";
+  Edit.Write = Write == "true";
+  Edit.Range = Range == "true";
+  Edit.Leading = Leading == "true";
+
+  return !Edit.File.empty()
+         && !StringRef(Unit).getAsInteger(10, Edit.Unit)
+         && !StringRef(Offset).getAsInteger(10, Edit.Offset)
+         && !StringRef(Length).getAsInteger(10, Edit.Length)
+         && GetKind(Kind, Edit.Kind);
+
+}
+
+bool RewritePlan::Read(string Filename) {
+
+  llvm::OwningPtr<llvm::MemoryBuffer> Buffer;
+
+  if (llvm::MemoryBuffer::getFile(Filename, Buffer)) {
+    return false;
+  }
+
+  // JSON is a subset of YAML's flow style, so LLVM's YAML parser reads it
+  llvm::SourceMgr SM;
+  llvm::yaml::Stream Stream(Buffer->getBuffer(), SM);
+  llvm::yaml::document_iterator DocIt = Stream.begin();
+
+  if (DocIt == Stream.end()) {
+    return false;
+  }
+
+  llvm::yaml::MappingNode *Root =
+      llvm::dyn_cast_or_null<llvm::yaml::MappingNode>(DocIt->getRoot());
+
+  if (!Root) {
+    return false;
+  }
+
+  Edits.clear();
+  Hashes.clear();
+
+  llvm::yaml::MappingNode::iterator It;
+
+  for (It = Root->begin(); It != Root->end(); ++It) {
+
+    string Key;
+
+    if (!GetScalar(It->getKey(), Key)) {
+      return false;
+    }
+
+    if (Key == "version") {
+
+      // Version 1 plans only held the text of each edit, and version 2 ones
+      // had nothing to check the files against
+      string Value;
+
+      if (!GetScalar(It->getValue(), Value) || Value != "3") {
+        return false;
+      }
+
+    } else if (Key == "tables") {
+
+      string Value;
+
+      if (!GetScalar(It->getValue(), Value)
+          || StringRef(Value).getAsInteger(10, Tables)) {
+        return false;
+      }
+
+    } else if (Key == "files") {
+
+      llvm::yaml::SequenceNode *Sequence =
+          llvm::dyn_cast_or_null<llvm::yaml::SequenceNode>(It->getValue());
+
+      if (!Sequence) {
+        return false;
+      }
+
+      llvm::yaml::SequenceNode::iterator FileIt;
+
+      for (FileIt = Sequence->begin(); FileIt != Sequence->end(); ++FileIt) {
+
+        llvm::yaml::MappingNode *Mapping =
+            llvm::dyn_cast<llvm::yaml::MappingNode>(&*FileIt);
+
+        if (!Mapping || !ReadHash(Mapping, Hashes)) {
+          return false;
+        }
+
+      }
+
+    } else if (Key == "edits") {
+
+      llvm::yaml::SequenceNode *Sequence =
+          llvm::dyn_cast_or_null<llvm::yaml::SequenceNode>(It->getValue());
+
+      if (!Sequence) {
+        return false;
+      }
+
+      llvm::yaml::SequenceNode::iterator EditIt;
+
+      for (EditIt = Sequence->begin(); EditIt != Sequence->end(); ++EditIt) {
+
+        llvm::yaml::MappingNode *Mapping =
+            llvm::dyn_cast<llvm::yaml::MappingNode>(&*EditIt);
+
+        PlanEdit Edit;
+
+        if (!Mapping || !ReadEdit(Mapping, Edit)) {
+          return false;
+        }
+
+        Edits.push_back(Edit);
+
+      }
+
+    } else {
+
+      // Skip over anything else
+      It->skip();
+
+    }
+
+  }
+
+  return true;
+
+}
+
+bool RewritePlan::Apply(CompilerInstance &CI, OutputDirectory *Output) {
+
+  SourceManager &SM = CI.getSourceManager();
+
+  // Each unit's edits are kept apart, as they were in the run that recorded
+  // them
+  map<unsigned, Rewriter *> Rewriters;
+  map<string, FileID> Files;
+
+  bool Succeeded = true;
+  vector<PlanEdit>::iterator EditIt;
+
+  for (EditIt = Edits.begin();
+       Succeeded && EditIt != Edits.end();
+       EditIt++) {
+
+    map<string, FileID>::iterator FileIt = Files.find(EditIt->File);
+
+    if (FileIt == Files.end()) {
+
+      const FileEntry *FE = CI.getFileManager().getFile(EditIt->File);
+
+      if (!FE) {
+        logging::Out() << "\tCouldn't open " << EditIt->File << "\n";
+        Succeeded = false;
+        break;
+      }
+
+      FileID FID = SM.createFileID(FE, SourceLocation(), clang::SrcMgr::C_User);
+      FileIt = Files.insert(make_pair(EditIt->File, FID)).first;
+
+      // The offsets are only good for the contents they were recorded in,
+      // not an edited or already instrumented file
+      map<string, uint64_t>::iterator HashIt = Hashes.find(EditIt->File);
+
+      if (HashIt == Hashes.end()
+          || tools::HashString(SM.getBuffer(FID)->getBuffer())
+             != HashIt->second) {
+        logging::Out() << "\t" << EditIt->File << " has changed since the "
+                       << "plan was written\n";
+        Succeeded = false;
+        break;
+      }
+
+    }
+
+    Rewriter *&Rewrite = Rewriters[EditIt->Unit];
+
+    if (!Rewrite) {
+      Rewrite = new Rewriter(SM, CI.getLangOpts());
+    }
+
+    SourceLocation Loc = SM.getLocForStartOfFile(FileIt->second);
+    Loc = Loc.getLocWithOffset(EditIt->Offset);
+
+    bool Failed;
+
+    if (EditIt->Length) {
+      Failed = Rewrite->RemoveText(Loc, EditIt->Length);
+    } else {
+      Failed = Rewrite->InsertText(Loc,
+                                   Render(*EditIt, Tables),
+                                   EditIt->InsertAfter,
+                                   EditIt->IndentNewLines);
+    }
+
+    if (Failed) {
+      logging::Out() << "\tCouldn't apply a " << GetKindName(EditIt->Kind)
+                     << " edit at " << EditIt->File << ":" << EditIt->Offset
+                     << "\n";
+      Succeeded = false;
+    }
+
+  }
+
+  map<unsigned, Rewriter *>::iterator RewriterIt;
+
+  for (RewriterIt = Rewriters.begin();
+       RewriterIt != Rewriters.end();
+       RewriterIt++) {
+
+    Rewriter *Rewrite = RewriterIt->second;
+
+    if (Succeeded && Output) {
+
+      Rewriter::buffer_iterator BufferIt;
+
+      for (BufferIt = Rewrite->buffer_begin();
+           BufferIt != Rewrite->buffer_end();
+           BufferIt++) {
+
+        const FileEntry *FE = SM.getFileEntryForID(BufferIt->first);
+
+        if (FE) {
+          Output->Add(FE->getName(),
+                      string(BufferIt->second.begin(),
+                             BufferIt->second.end()));
+        }
+
+      }
+
+    } else if (Succeeded && Rewrite->overwriteChangedFiles()) {
+      Succeeded = false;
+    }
+
+    delete Rewrite;
+
+  }
+
+  return Succeeded;
+
+}
+
+} // End namespace speculation
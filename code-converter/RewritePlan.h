@@ -0,0 +1,138 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _REWRITEPLAN_H_
+#define _REWRITEPLAN_H_
+
+#include "Classes.h"
+#include "OutputDirectory.h"
+
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Frontend/CompilerInstance.h"
+
+using clang::CompilerInstance;
+using clang::SourceLocation;
+using clang::SourceRange;
+using clang::StringRef;
+
+namespace speculation {
+
+enum PlanEditKind {
+  AccessEdit,     // SPECREAD / SPECWRITE and their RANGE forms
+  CacheInitEdit,  // A set of SPECREADINIT / SPECWRITEINIT
+  CheckEdit,      // detectDependences()
+  TablesEdit,     // createTables()
+  BracketEdit,    // Brackets around a statement that gained accesses
+  RegionEdit,     // The rest of the region setup, from the pragmas to the
+                  // calls around the region and the loop chunks
+  InitEdit,       // The rest of main's setup
+  HeaderEdit      // Including Spec/CPUSpec.h
+};
+
+// The instrumentation edits only say what they instrument, and get their text
+// from Render, so that changing how they're emitted doesn't need the analysis
+// to be run again. Everything else is kept as the text it inserts.
+struct PlanEdit {
+  PlanEditKind Kind;
+  // Which translation unit made the edit, numbered in the order they're
+  // first seen
+  unsigned Unit;
+  string File;
+  unsigned Offset;
+  // Characters removed from Offset. Text is only inserted when this is 0.
+  unsigned Length;
+  bool InsertAfter;
+  bool IndentNewLines;
+  // Anything but the instrumentation
+  string Text;
+  // AccessEdit: what's accessed, as the decl and either the expression or a
+  // RANGE's bounds
+  string Decl;
+  string Expr;
+  bool Write;
+  bool Range;
+  // CacheInitEdit: the decls needing a cache, each put on a line of its own
+  // after the previous one when Leading is set, or before the next one
+  // otherwise
+  vector<string> Reads;
+  vector<string> Writes;
+  bool Leading;
+  PlanEdit()
+      : Kind(RegionEdit), Unit(0), File(), Offset(0), Length(0),
+        InsertAfter(false), IndentNewLines(true), Text(), Decl(), Expr(),
+        Write(false), Range(false), Reads(), Writes(), Leading(false) {}
+};
+
+// Every edit DirectiveHandler makes to the sources, recorded against file
+// offsets so the analysis can be saved and the rewriting replayed later
+// without parsing anything. Each file edited is saved with a hash of the
+// contents the offsets are into, and the plan is only applied to a file that
+// still hashes the same. Saved as JSON:
+//   {"version": 3, "tables": N,
+//    "files": [{"file": "a.c", "hash": "8c3f..."}, ...],
+//    "edits": [
+//     {"kind": "access", "unit": 0, "file": "a.c", "offset": 120,
+//      "length": 0, "after": false, "indent": true,
+//      "decl": "a", "expr": "a[i]", "write": false, "range": false},
+//     {"kind": "cache-init", ..., "reads": ["a"], "writes": ["b"],
+//      "leading": false},
+//     {"kind": "check", ...}, {"kind": "tables", ...},
+//     {"kind": "region", ..., "text": "startParallelExe();\n"},
+//     ...
+//   ]}
+// Edits are kept in the order they were made, which is the order the
+// Rewriter needs to stack insertions at the same location.
+class RewritePlan {
+
+ private:
+
+  vector<PlanEdit> Edits;
+  int Tables;
+  map<CompilerInstance *, unsigned> Units;
+  // The hash of each file's contents as they were analyzed
+  map<string, uint64_t> Hashes;
+  bool Failed;
+
+  bool GetFileOffset(CompilerInstance &CI,
+                     SourceLocation Loc,
+                     string &File,
+                     unsigned &Offset);
+
+ public:
+
+  RewritePlan();
+
+  // The text Edit inserts, with Tables as createTables()'s size
+  static string Render(const PlanEdit &Edit, int Tables);
+
+  // Records Edit, which only needs what it inserts filled in, at Loc
+  void RecordInsert(CompilerInstance &CI,
+                    SourceLocation Loc,
+                    PlanEdit Edit);
+
+  void RecordRemove(CompilerInstance &CI,
+                    SourceRange Range,
+                    PlanEditKind Kind);
+
+  // The size passed to createTables()
+  void SetTables(int Size);
+
+  // Fails if an edit couldn't be recorded, being somewhere other than a file
+  bool Write(string Filename);
+  bool Read(string Filename);
+
+  // Makes every edit through a Rewriter on CI's SourceManager, one for each
+  // translation unit, and overwrites the files, or adds them to Output if
+  // given. A file edited by more than one unit ends up as the last one left
+  // it, as when rewriting in place. Nothing is changed if any file differs
+  // from when the plan was written. CI only needs its FileManager and
+  // SourceManager.
+  bool Apply(CompilerInstance &CI, OutputDirectory *Output = NULL);
+
+};
+
+} // End namespace speculation
+
+#endif
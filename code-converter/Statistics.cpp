@@ -0,0 +1,210 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "Statistics.h"
+
+#include "Tools.h"
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Timer.h"
+
+#include <sys/resource.h>
+
+namespace speculation {
+
+namespace stats {
+
+struct Stage {
+
+  string Name;
+  llvm::TimeRecord Time;
+  // Peak resident set size of the whole process, in KB
+  long PeakRSS;
+
+};
+
+// Only ever touched from the main thread
+static unsigned Counters[NumCounters];
+static vector<Stage> Stages;
+static bool InStage = false;
+
+static const char * GetCounterName(Counter C) {
+
+  switch (C) {
+   case DeclsCounter:        return "decls";
+   case FunctionsCounter:    return "functions";
+   case CallsCounter:        return "calls";
+   case DirectivesCounter:   return "directives";
+   case InferredCounter:     return "decls_inferred_private";
+   case TraversalsCounter:   return "fixpoint_traversals";
+   case InstrumentedCounter: return "accesses_instrumented";
+   case PrivateCounter:      return "accesses_elided_private";
+   case ReadOnlyCounter:     return "accesses_elided_read_only";
+   case DuplicateCounter:    return "accesses_elided_duplicate";
+   case CoveredCounter:      return "accesses_elided_covered";
+   case HoistedCounter:      return "accesses_hoisted";
+   case SummarizedCounter:   return "accesses_summarized";
+   case IndependentCounter:  return "accesses_elided_independent";
+   case NumCounters:         break;
+  }
+
+  assert(false && "Unknown counter");
+  return "";
+
+}
+
+static long GetPeakRSS() {
+
+  struct rusage Usage;
+
+  if (getrusage(RUSAGE_SELF, &Usage)) {
+    return 0;
+  }
+
+  return Usage.ru_maxrss;
+
+}
+
+void Increment(Counter C, unsigned Amount) {
+
+  assert(C < NumCounters);
+
+  Counters[C] += Amount;
+
+}
+
+unsigned Get(Counter C) {
+
+  assert(C < NumCounters);
+
+  return Counters[C];
+
+}
+
+void BeginStage(string Name) {
+
+  EndStage();
+
+  Stage S;
+  S.Name = Name;
+  S.Time = llvm::TimeRecord::getCurrentTime(true);
+  S.PeakRSS = 0;
+
+  Stages.push_back(S);
+  InStage = true;
+
+}
+
+void EndStage() {
+
+  if (!InStage) {
+    return;
+  }
+
+  Stage &S = Stages.back();
+
+  llvm::TimeRecord End = llvm::TimeRecord::getCurrentTime(false);
+  End -= S.Time;
+
+  S.Time = End;
+  S.PeakRSS = GetPeakRSS();
+
+  InStage = false;
+
+}
+
+void PrintStages(llvm::raw_ostream &OS) {
+
+  llvm::TimeRecord Total;
+
+  OS << llvm::format("%-36s %10s %10s %10s %12s\n",
+                     "Stage", "Wall (s)", "User (s)", "Sys (s)",
+                     "Peak RSS (KB)");
+
+  vector<Stage>::iterator StageIt;
+
+  for (StageIt = Stages.begin(); StageIt != Stages.end(); StageIt++) {
+
+    OS << llvm::format("%-36s %10.3f %10.3f %10.3f %12ld\n",
+                       StageIt->Name.c_str(),
+                       StageIt->Time.getWallTime(),
+                       StageIt->Time.getUserTime(),
+                       StageIt->Time.getSystemTime(),
+                       StageIt->PeakRSS);
+
+    Total += StageIt->Time;
+
+  }
+
+  OS << llvm::format("%-36s %10.3f %10.3f %10.3f %12ld\n",
+                     "Total",
+                     Total.getWallTime(),
+                     Total.getUserTime(),
+                     Total.getSystemTime(),
+                     GetPeakRSS());
+
+}
+
+void PrintCounters(llvm::raw_ostream &OS) {
+
+  for (unsigned i = 0; i < NumCounters; i++) {
+    OS << llvm::format("%-36s %10u\n",
+                       GetCounterName(static_cast<Counter>(i)),
+                       Counters[i]);
+  }
+
+}
+
+bool WriteJSON(string Filename) {
+
+  string Error;
+  llvm::raw_fd_ostream Out(Filename.c_str(), Error);
+
+  if (!Error.empty()) {
+    return false;
+  }
+
+  Out << "{\"peak_rss_kb\": " << GetPeakRSS() << ",\n";
+  Out << " \"counters\": {";
+
+  for (unsigned i = 0; i < NumCounters; i++) {
+
+    if (i) {
+      Out << ", ";
+    }
+
+    Out << "\"" << GetCounterName(static_cast<Counter>(i)) << "\": "
+        << Counters[i];
+
+  }
+
+  Out << "},\n";
+  Out << " \"stages\": [";
+
+  vector<Stage>::iterator StageIt;
+
+  for (StageIt = Stages.begin(); StageIt != Stages.end(); StageIt++) {
+
+    if (StageIt != Stages.begin()) {
+      Out << ",";
+    }
+
+    Out << "\n  {\"name\": \"" << tools::JSONEscape(StageIt->Name) << "\""
+        << llvm::format(", \"wall\": %.6f", StageIt->Time.getWallTime())
+        << llvm::format(", \"user\": %.6f", StageIt->Time.getUserTime())
+        << llvm::format(", \"system\": %.6f", StageIt->Time.getSystemTime())
+        << ", \"peak_rss_kb\": " << StageIt->PeakRSS << "}";
+
+  }
+
+  Out << "\n]}\n";
+
+  return !Out.has_error();
+
+}
+
+} // End namespace stats
+
+} // End namespace speculation
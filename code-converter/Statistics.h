@@ -0,0 +1,51 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _STATISTICS_H_
+#define _STATISTICS_H_
+
+#include "Classes.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+namespace speculation {
+
+namespace stats {
+
+enum Counter {
+  DeclsCounter,
+  FunctionsCounter,
+  CallsCounter,
+  DirectivesCounter,
+  InferredCounter,
+  TraversalsCounter,
+  InstrumentedCounter,
+  PrivateCounter,
+  ReadOnlyCounter,
+  DuplicateCounter,
+  CoveredCounter,
+  HoistedCounter,
+  SummarizedCounter,
+  IndependentCounter,
+  NumCounters
+};
+
+void Increment(Counter C, unsigned Amount = 1);
+unsigned Get(Counter C);
+
+// Stages run one after another, so beginning a stage ends the previous one.
+// Each records its wall and CPU time, and the peak RSS once it has finished.
+void BeginStage(string Name);
+void EndStage();
+
+void PrintStages(llvm::raw_ostream &OS);
+void PrintCounters(llvm::raw_ostream &OS);
+bool WriteJSON(string Filename);
+
+} // End namespace stats
+
+} // End namespace speculation
+
+#endif
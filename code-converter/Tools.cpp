@@ -6,8 +6,16 @@
 #include "Tools.h"
 
 #include "Globals.h"
+#include "Log.h"
 #include "NoEditStmtPrinter.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/Threading.h"
+
+#include <cstdio>
+#include <pthread.h>
+
 using clang::cast;
 using clang::dyn_cast;
 
@@ -21,7 +29,6 @@ using clang::Lexer;
 using clang::PrintingPolicy;
 using clang::Qualifiers;
 using clang::QualType;
-using clang::StringRef;
 using clang::Token;
 
 namespace speculation {
@@ -199,9 +206,7 @@ SourceLocation FindSemiAfterLocation(SourceLocation loc,
 
 bool InsideRange(SourceLocation Loc, SourceRange Range, CompilerInstance &CI) {
 
-  SourceManager &SM = CI.getSourceManager();
-
-  if (!SM.isLocalSourceLocation(Loc)) {
+  if (Loc.isInvalid()) {
     return false;
   }
 
@@ -223,6 +228,69 @@ bool InsideRange(SourceLocation Loc, SourceRange Range, CompilerInstance &CI) {
 
 }
 
+// Where a statement sits in a depth first walk of its function's body. A
+// statement is inside another iff its interval is nested inside the other's.
+struct StmtInterval {
+  unsigned Begin;
+  unsigned End;
+  FunctionDecl * Function;
+  // Reached along more than one path, so the interval means nothing
+  bool Shared;
+};
+
+static llvm::DenseMap<Stmt *, StmtInterval> StmtIndex;
+static unsigned NextStmtNumber = 0;
+
+static void IndexStmt(Stmt * S, FunctionDecl * F) {
+
+  if (!S) {
+    return;
+  }
+
+  StmtInterval Interval;
+  Interval.Begin = NextStmtNumber++;
+  Interval.Function = F;
+  Interval.Shared = false;
+
+  Stmt::child_iterator It;
+
+  for (It = S->child_begin(); It != S->child_end(); It++) {
+    IndexStmt(*It, F);
+  }
+
+  Interval.End = NextStmtNumber++;
+
+  pair<llvm::DenseMap<Stmt *, StmtInterval>::iterator, bool> Inserted;
+  Inserted = StmtIndex.insert(make_pair(S, Interval));
+
+  if (!Inserted.second) {
+    Inserted.first->second.Shared = true;
+  }
+
+}
+
+void IndexFunction(FunctionDecl * F) {
+
+  assert(F);
+
+  if (F->hasBody()) {
+    IndexStmt(F->getBody(), F);
+  }
+
+}
+
+FunctionDecl * GetEnclosingFunction(Stmt * S) {
+
+  llvm::DenseMap<Stmt *, StmtInterval>::iterator It = StmtIndex.find(S);
+
+  if (It == StmtIndex.end()) {
+    return NULL;
+  }
+
+  return It->second.Function;
+
+}
+
 bool IsChild(Stmt * Item, Stmt * Parent) {
 
   if (Item == Parent) {
@@ -233,6 +301,27 @@ bool IsChild(Stmt * Item, Stmt * Parent) {
     return false;
   }
 
+  llvm::DenseMap<Stmt *, StmtInterval>::iterator ParentIt;
+  ParentIt = StmtIndex.find(Parent);
+
+  // Everything below an indexed statement is indexed as well, so only a null
+  // Item (which matches empty child slots) needs the full search
+  if (Item && ParentIt != StmtIndex.end() && !ParentIt->second.Shared) {
+
+    llvm::DenseMap<Stmt *, StmtInterval>::iterator ItemIt;
+    ItemIt = StmtIndex.find(Item);
+
+    if (ItemIt == StmtIndex.end()) {
+      return false;
+    }
+
+    if (!ItemIt->second.Shared) {
+      return ParentIt->second.Begin < ItemIt->second.Begin
+             && ItemIt->second.End < ParentIt->second.End;
+    }
+
+  }
+
   Stmt::child_iterator It;
 
   for (It = Parent->child_begin(); It != Parent->child_end(); It++) {
@@ -330,7 +419,7 @@ Expr * GetRelevantParent(Expr * Current, ParentMap * PM) {
       case Stmt::CallExprClass:
         break;
       case Stmt::ConditionalOperatorClass:
-        llvm::errs() << "Warning: Unchecked Ternary\n";
+        logging::Out() << "Warning: Unchecked Ternary\n";
         break;
       default:
         break;
@@ -383,6 +472,134 @@ string GetStmtString(Stmt * Current, CompilerInstance &CI) {
 
 }
 
+uint64_t HashString(StringRef Str, uint64_t Seed) {
+
+  uint64_t Hash = Seed;
+
+  for (unsigned i = 0; i < Str.size(); i++) {
+    Hash ^= static_cast<unsigned char>(Str[i]);
+    Hash *= 1099511628211ULL;
+  }
+
+  return Hash;
+
+}
+
+string JSONEscape(StringRef Str) {
+
+  string Escaped;
+  Escaped.reserve(Str.size());
+
+  for (unsigned i = 0; i < Str.size(); i++) {
+
+    unsigned char C = Str[i];
+
+    switch (C) {
+     case '"':  Escaped += "\\\""; break;
+     case '\\': Escaped += "\\\\"; break;
+     case '\n': Escaped += "\\n"; break;
+     case '\r': Escaped += "\\r"; break;
+     case '\t': Escaped += "\\t"; break;
+     default:
+
+      if (C < 0x20) {
+        char Buffer[8];
+        snprintf(Buffer, sizeof(Buffer), "\\u%04x", C);
+        Escaped += Buffer;
+      } else {
+        Escaped += C;
+      }
+
+    }
+
+  }
+
+  return Escaped;
+
+}
+
+struct ParallelForState {
+
+  unsigned Count;
+  unsigned Next;
+  void (*Body)(unsigned, void *);
+  void *Data;
+  llvm::sys::Mutex Lock;
+
+};
+
+static void *ParallelForWorker(void *Arg) {
+
+  ParallelForState *State = static_cast<ParallelForState *>(Arg);
+
+  while (true) {
+
+    unsigned Index;
+
+    {
+      llvm::sys::ScopedLock Guard(State->Lock);
+
+      if (State->Next == State->Count) {
+        return NULL;
+      }
+
+      Index = State->Next++;
+    }
+
+    State->Body(Index, State->Data);
+
+  }
+
+}
+
+void ParallelFor(unsigned Jobs,
+                 unsigned Count,
+                 void (*Body)(unsigned Index, void *Data),
+                 void *Data) {
+
+  if (Jobs > Count) {
+    Jobs = Count;
+  }
+
+  if (Jobs <= 1
+      || (!llvm::llvm_is_multithreaded() && !llvm::llvm_start_multithreaded())) {
+
+    for (unsigned i = 0; i < Count; i++) {
+      Body(i, Data);
+    }
+
+    return;
+
+  }
+
+  ParallelForState State;
+  State.Count = Count;
+  State.Next = 0;
+  State.Body = Body;
+  State.Data = Data;
+
+  // The calling thread works as well, so only spawn Jobs - 1 helpers
+  vector<pthread_t> Threads;
+
+  for (unsigned i = 1; i < Jobs; i++) {
+
+    pthread_t Thread;
+
+    if (pthread_create(&Thread, NULL, ParallelForWorker, &State) == 0) {
+      Threads.push_back(Thread);
+    }
+
+  }
+
+  ParallelForWorker(&State);
+
+  vector<pthread_t>::iterator ThreadIt;
+  for (ThreadIt = Threads.begin(); ThreadIt != Threads.end(); ThreadIt++) {
+    pthread_join(*ThreadIt, NULL);
+  }
+
+}
+
 
 } // End namespace tools
 
@@ -22,12 +22,14 @@ using clang::Preprocessor;
 using clang::SourceLocation;
 using clang::SourceManager;
 using clang::SourceRange;
+using clang::StringRef;
 using clang::Stmt;
 using clang::ParentMap;
 using clang::Expr;
 using clang::BinaryOperator;
 using clang::ArraySubscriptExpr;
 using clang::CompilerInstance;
+using clang::FunctionDecl;
 using clang::Type;
 using clang::VarDecl;
 
@@ -53,6 +55,12 @@ SourceLocation FindSemiAfterLocation(SourceLocation loc, ASTContext &Context);
 bool InsideRange(SourceLocation Loc, SourceRange Range, CompilerInstance &CI);
 bool IsChild(Stmt * Item, Stmt * Parent);
 
+// Records the ancestry of every statement in F's body, after which IsChild and
+// GetEnclosingFunction answer in constant time for them. Anything that was
+// never indexed falls back to searching the tree.
+void IndexFunction(FunctionDecl * F);
+FunctionDecl * GetEnclosingFunction(Stmt * S);
+
 bool IsPointerArrayStructUnionType(Expr * E);
 bool IsPointerOrArrayType(Expr * E);
 bool IsStructOrUnionType(Expr * E);
@@ -73,6 +81,20 @@ string GetType(const Type * T);
 string GetType(Expr * E);
 string GetStmtString(Stmt * Current, CompilerInstance &CI);
 
+// FNV-1a, so the result is stable between runs and can be used for names on
+// disk.
+uint64_t HashString(StringRef Str, uint64_t Seed = 14695981039346656037ULL);
+
+// Escapes Str for use inside a double quoted JSON string
+string JSONEscape(StringRef Str);
+
+// Runs Body(0, Data) ... Body(Count - 1, Data) on up to Jobs threads. Falls
+// back to a serial loop when Jobs <= 1 or LLVM was built without threads.
+void ParallelFor(unsigned Jobs,
+                 unsigned Count,
+                 void (*Body)(unsigned Index, void *Data),
+                 void *Data);
+
 } // End namespace tools
 
 } // End namespace speculation
@@ -0,0 +1,141 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#include "TypePaths.h"
+
+#include "Tools.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+
+using clang::MemberExpr;
+
+using llvm::dyn_cast;
+
+namespace speculation {
+
+namespace typepaths {
+
+// These are only filled in once parsing has finished, so need no locking
+static llvm::StringMap<TypePath> Ids;
+static vector<llvm::StringMapEntry<TypePath> *> Names;
+
+static llvm::DenseMap<pair<TypePath, const Type *>, TypePath> TypePaths;
+static llvm::DenseMap<pair<TypePath, NamedDecl *>, TypePath> FieldStubs;
+static llvm::DenseMap<pair<TypePath, const Type *>, bool> Containments;
+
+static TypePath Intern(StringRef Name) {
+
+  if (Names.empty()) {
+    Names.push_back(&Ids.GetOrCreateValue("", EmptyPath));
+  }
+
+  llvm::StringMapEntry<TypePath> &Entry
+      = Ids.GetOrCreateValue(Name, Names.size());
+
+  if (Entry.getValue() == Names.size()) {
+    Names.push_back(&Entry);
+  }
+
+  return Entry.getValue();
+
+}
+
+TypePath GetTypePath(TypePath Path, const Type * T) {
+
+  assert(T);
+
+  llvm::DenseMap<pair<TypePath, const Type *>, TypePath>::iterator It;
+  It = TypePaths.find(make_pair(Path, T));
+
+  if (It != TypePaths.end()) {
+    return It->second;
+  }
+
+  TypePath Result;
+
+  if (Path == EmptyPath) {
+    Result = Intern(tools::GetType(T));
+  } else {
+    Result = Intern(GetName(Path).str() + GetName(GetTypePath(EmptyPath, T)).str());
+  }
+
+  TypePaths[make_pair(Path, T)] = Result;
+
+  return Result;
+
+}
+
+TypePath GetFieldStub(TypePath Path, NamedDecl * Field) {
+
+  assert(Field);
+
+  llvm::DenseMap<pair<TypePath, NamedDecl *>, TypePath>::iterator It;
+  It = FieldStubs.find(make_pair(Path, Field));
+
+  if (It != FieldStubs.end()) {
+    return It->second;
+  }
+
+  TypePath Result = Intern(GetName(Path).str() + "." + Field->getName().str() + ":");
+  FieldStubs[make_pair(Path, Field)] = Result;
+
+  return Result;
+
+}
+
+TypePath GetStub(Expr * E) {
+
+  MemberExpr * ME = dyn_cast<MemberExpr>(E);
+
+  if (!ME) {
+    return EmptyPath;
+  }
+
+  const Type * ParentType = ME->getBase()->getType()->getUnqualifiedDesugaredType();
+
+  if (ME->isArrow()) {
+    ParentType = ParentType->getPointeeType()->getUnqualifiedDesugaredType();
+  }
+
+  return GetFieldStub(GetTypePath(EmptyPath, ParentType), ME->getMemberDecl());
+
+}
+
+bool Contains(TypePath Path, const Type * T) {
+
+  assert(T);
+
+  llvm::DenseMap<pair<TypePath, const Type *>, bool>::iterator It;
+  It = Containments.find(make_pair(Path, T));
+
+  if (It != Containments.end()) {
+    return It->second;
+  }
+
+  StringRef Name = GetName(GetTypePath(EmptyPath, T));
+  bool Result = GetName(Path).find(Name) != StringRef::npos;
+
+  Containments[make_pair(Path, T)] = Result;
+
+  return Result;
+
+}
+
+StringRef GetName(TypePath Path) {
+
+  if (Path == EmptyPath) {
+    return StringRef();
+  }
+
+  assert(Path < Names.size());
+
+  return Names[Path]->getKey();
+
+}
+
+} // End namespace typepaths
+
+} // End namespace speculation
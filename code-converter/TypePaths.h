@@ -0,0 +1,50 @@
+//=============================================================================
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//=============================================================================
+
+#ifndef _TYPEPATHS_H_
+#define _TYPEPATHS_H_
+
+#include "Classes.h"
+
+#include "clang/AST/AST.h"
+
+using clang::Expr;
+using clang::NamedDecl;
+using clang::StringRef;
+using clang::Type;
+
+namespace speculation {
+
+// A type path names one level of a tracked variable's type hierarchy, such as
+// "int *" or "struct S.next:struct S *". Every distinct path is interned once
+// and is afterwards only handled by its id, so the trackers can key on an
+// integer instead of building and comparing strings.
+typedef unsigned TypePath;
+
+namespace typepaths {
+
+// The empty path, i.e. the stub for a variable's own type
+const TypePath EmptyPath = 0;
+
+// Path + tools::GetType(T)
+TypePath GetTypePath(TypePath Path, const Type * T);
+
+// Path + "." + Field + ":"
+TypePath GetFieldStub(TypePath Path, NamedDecl * Field);
+
+// The stub tools::GetType(E) would produce for E
+TypePath GetStub(Expr * E);
+
+// Whether tools::GetType(T) already appears in Path, which is how recursive
+// structs are cut off
+bool Contains(TypePath Path, const Type * T);
+
+StringRef GetName(TypePath Path);
+
+} // End namespace typepaths
+
+} // End namespace speculation
+
+#endif
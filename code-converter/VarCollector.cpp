@@ -6,6 +6,7 @@
 #include "VarCollector.h"
 
 #include "DirectiveList.h"
+#include "Log.h"
 #include "PragmaDirective.h"
 #include "StmtPrinter.h"
 #include "Tools.h"
@@ -16,7 +17,6 @@ using speculation::tools::FindLocationAfterSemi;
 using speculation::tools::FindSemiAfterLocation;
 using speculation::tools::GetLocation;
 using speculation::tools::GetRelevantParent;
-using speculation::tools::GetType;
 using speculation::tools::InsideRange;
 using speculation::tools::IsArrayIndex;
 using speculation::tools::IsPointerType;
@@ -25,13 +25,16 @@ using speculation::tools::IsChild;
 
 namespace speculation {
 
-VarCollector::VarCollector() : RecursiveASTVisitor<VarCollector>(),
-                               Directives(NULL),
-                               FullDirectives(NULL),
-                               WaitingDirective(NULL),
-                               WaitingHeader(NULL),
-                               MemberWarnings(),
-                               CompilerInstanceStack() {
+VarCollector::VarCollector(bool VerifySummaries)
+    : RecursiveASTVisitor<VarCollector>(),
+      Directives(NULL),
+      FullDirectives(NULL),
+      WaitingDirective(NULL),
+      WaitingHeader(NULL),
+      MemberWarnings(),
+      CompilerInstanceStack(),
+      UndefinedCalls(),
+      VerifySummaries(VerifySummaries) {
 
 }
 
@@ -135,12 +138,33 @@ bool VarCollector::VisitForStmt(ForStmt *S) {
 
 }
 
+void VarCollector::TraverseCallee(FunctionCall * FC, bool Summarize) {
+
+  if (Summarize) {
+    FullDirectives->BeginSummary(FC);
+  }
+
+  CompilerInstanceStack.push_back(FC->CI);
+  TraverseStmt(FC->S);
+  CompilerInstanceStack.pop_back();
+
+  if (Summarize) {
+    FullDirectives->EndSummary(FC);
+  }
+
+}
+
 bool VarCollector::VisitCallExpr(CallExpr *e) {
 
   FunctionCall * FC = FullDirectives->Push(e);
+  CompilerInstance &CI = *(CompilerInstanceStack.back());
 
   if (!FC) {
-    CompilerInstance &CI = *(CompilerInstanceStack.back());
+
+    if (!UndefinedCalls.insert(e).second) {
+      return true;
+    }
+
     DiagnosticsEngine &Diags = CI.getDiagnostics();
 
     unsigned DiagID =
@@ -149,17 +173,50 @@ bool VarCollector::VisitCallExpr(CallExpr *e) {
                               "definition, hence cannot be checked for safety");
     Diags.Report(e->getLocStart(), DiagID) << e->getDirectCallee()->getName();
 
-  } else {
-    CompilerInstanceStack.push_back(FC->CI);
-    TraverseStmt(FC->S);
-    CompilerInstanceStack.pop_back();
+    return true;
+
   }
 
-  return true;
+  StackSnapshot Before;
 
-}
+  if (VerifySummaries) {
+    FullDirectives->SaveStack(Before);
+  }
+
+  if (!FullDirectives->ApplySummary(FC, CI)) {
+    TraverseCallee(FC, true);
+    return true;
+  }
+
+  if (!VerifySummaries) {
+    return true;
+  }
+
+  // Redo the call by traversing the body, and keep what that gives
+  StackSnapshot Summarized;
+  FullDirectives->SaveStack(Summarized);
+  FullDirectives->RestoreStack(Before);
+
+  TraverseCallee(FC, false);
+
+  StackSnapshot Traversed;
+  FullDirectives->SaveStack(Traversed);
+
+  if (!DirectiveList::SameStack(Summarized, Traversed)) {
+
+    DiagnosticsEngine &Diags = CI.getDiagnostics();
+
+    unsigned DiagID =
+        Diags.getCustomDiagID(DiagnosticsEngine::Error,
+                              "Summary of '%0' contaminates differently to "
+                              "traversing its body");
+    Diags.Report(e->getLocStart(), DiagID) << FC->TheFunction->getName();
+
+  }
 
+  return true;
 
+}
 
 bool VarCollector::VisitDeclStmt(DeclStmt *S) {
 
@@ -184,7 +241,8 @@ bool VarCollector::VisitDeclStmt(DeclStmt *S) {
 
       if (T->isPointerType()) {
 
-        string TS = GetType(VD->getType()->getUnqualifiedDesugaredType());
+        const Type * VT = VD->getType()->getUnqualifiedDesugaredType();
+        TypePath TS = typepaths::GetTypePath(typepaths::EmptyPath, VT);
 
         if (IsArray) {
           HandleArrayInit(VD, TS, S->getLocStart());
@@ -235,8 +293,8 @@ bool VarCollector::VisitBinaryOperator(BinaryOperator *e)  {
   // Where on earth is it writing to!?
   // TODO: Convert to actual error!
   if (!LDominantRef) {
-    llvm::errs() << "Warning: Found a pointer being modified that we have no "
-                 << "idea where came from. Can't determine if private or not!\n";
+    logging::Out() << "Warning: Found a pointer being modified that we have no "
+                   << "idea where came from. Can't determine if private or not!\n";
     return true;
   }
   
@@ -249,7 +307,9 @@ bool VarCollector::VisitBinaryOperator(BinaryOperator *e)  {
 
   // If there isn't a dominant variable now being pointed to, just return
   if (!RDominantRef) {
-    llvm::errs() << "No dominant right ref\n";
+    if (logging::Enabled(logging::Debug)) {
+      logging::Out() << "No dominant right ref\n";
+    }
     return true;
   }
 
@@ -258,8 +318,8 @@ bool VarCollector::VisitBinaryOperator(BinaryOperator *e)  {
 
   const Type * T = LDominantExpr->getType().getTypePtr();
 
-  string LT = GetType(LDominantExpr);
-  string RT = GetType(RDominantExpr);
+  TypePath LT = typepaths::GetStub(LDominantExpr);
+  TypePath RT = typepaths::GetStub(RDominantExpr);
 
   maybeContaminated(VDLHS, LT, VDRHS, RT, T, e->getLocStart());
 
@@ -268,13 +328,13 @@ bool VarCollector::VisitBinaryOperator(BinaryOperator *e)  {
 }
 
 void VarCollector::HandleArrayInit(VarDecl *VDLHS,
-                                   string TLHS,
+                                   TypePath TLHS,
                                    SourceLocation StmtLoc) {
 
   InitListExpr * Inits = dyn_cast<InitListExpr>(VDLHS->getInit());
   
   if (!Inits) {
-    llvm::errs() << "Warning: Expected to find an InitListExpr but didn't!\n";
+    logging::Out() << "Warning: Expected to find an InitListExpr but didn't!\n";
     return;
   }
 
@@ -283,7 +343,7 @@ void VarCollector::HandleArrayInit(VarDecl *VDLHS,
 }
 
 void VarCollector::HandleArrayInitList(VarDecl *VDLHS,
-                                       string TLHS,
+                                       TypePath TLHS,
                                        InitListExpr * Inits,
                                        SourceLocation StmtLoc) {
 
@@ -317,15 +377,15 @@ void VarCollector::HandleArrayInitList(VarDecl *VDLHS,
       // DEBUG:
       // Print out the dominant LHS and RHS
       
-/*      llvm::errs() << "Found init of a pointer:\n";
-      llvm::errs() << "RHS Ref " << RDominantRef->getDecl()->getName()
-                   << " -> " << GetStmtString(RDominantExpr)
-                   << " ("
-                   << RDominantExpr->getType().getAsString()
-                   << ")\n";*/
+/*      logging::Out() << "Found init of a pointer:\n";
+      logging::Out() << "RHS Ref " << RDominantRef->getDecl()->getName()
+                     << " -> " << GetStmtString(RDominantExpr)
+                     << " ("
+                     << RDominantExpr->getType().getAsString()
+                     << ")\n";*/
 
       VarDecl * VDRHS = dyn_cast<VarDecl>(RDominantRef->getDecl());
-      string TRHS = GetType(RDominantExpr);
+      TypePath TRHS = typepaths::GetStub(RDominantExpr);
 
       const Type * T = RDominantExpr->getType()->getUnqualifiedDesugaredType();
 
@@ -338,7 +398,7 @@ void VarCollector::HandleArrayInitList(VarDecl *VDLHS,
 }
 
 void VarCollector::HandlePointerInit(VarDecl *VDLHS,
-                                     string TLHS,
+                                     TypePath TLHS,
                                      SourceLocation StmtLoc) {
 
   CompilerInstance &CI = FullDirectives->GetCI(StmtLoc);
@@ -358,16 +418,16 @@ void VarCollector::HandlePointerInit(VarDecl *VDLHS,
   // DEBUG:
   // Print out the dominant LHS and RHS
   
-  /*llvm::errs() << "Found init of a pointer:\n";
-  llvm::errs() << "RHS Ref " << RDominantRef->getDecl()->getName()
-               << " -> " << GetStmtString(RDominantExpr)
-               << " ("
-               << RDominantExpr->getType().getAsString()
-               << ")\n";*/
+  /*logging::Out() << "Found init of a pointer:\n";
+  logging::Out() << "RHS Ref " << RDominantRef->getDecl()->getName()
+                 << " -> " << GetStmtString(RDominantExpr)
+                 << " ("
+                 << RDominantExpr->getType().getAsString()
+                 << ")\n";*/
 
   VarDecl * VDRHS = dyn_cast<VarDecl>(RDominantRef->getDecl());
 
-  string TRHS = GetType(RDominantExpr);
+  TypePath TRHS = typepaths::GetStub(RDominantExpr);
 
   const Type * T = RDominantExpr->getType()->getUnqualifiedDesugaredType();
 
@@ -391,14 +451,18 @@ string VarCollector::GetStmtString(Stmt * S) {
 }
 
 void VarCollector::maybeContaminated(VarDecl *VDLHS,
-                                     string TLHS,
+                                     TypePath TLHS,
                                      VarDecl *VDRHS,
-                                     string TRHS,
+                                     TypePath TRHS,
                                      const Type * T,
                                      SourceLocation StmtLoc) {
 
-  llvm::errs() << "MaybeContamined\n";
-  if (FullDirectives->ContaminateDecl(VDLHS, TLHS, VDRHS, TRHS, T)) {
+  if (logging::Enabled(logging::Debug)) {
+    logging::Out() << "MaybeContamined\n";
+  }
+
+  if (FullDirectives->ContaminateDecl(VDLHS, TLHS, VDRHS, TRHS, T)
+      && logging::Enabled(logging::Verbose)) {
 
     CompilerInstance &CI = FullDirectives->GetCI(StmtLoc);
     DiagnosticsEngine &Diags = CI.getDiagnostics();
@@ -406,11 +470,12 @@ void VarCollector::maybeContaminated(VarDecl *VDLHS,
     unsigned DiagID =
         Diags.getCustomDiagID(DiagnosticsEngine::Warning,
                               "Contamination Occurred above type '%0' and '%1'");
-    Diags.Report(StmtLoc, DiagID) << TLHS + GetType(T) << TRHS + GetType(T);
+    Diags.Report(StmtLoc, DiagID) << typepaths::GetName(typepaths::GetTypePath(TLHS, T))
+                                  << typepaths::GetName(typepaths::GetTypePath(TRHS, T));
 
-    llvm::errs() << "LHS: " << VDLHS->getNameAsString() << "\n";
+    logging::Out() << "LHS: " << VDLHS->getNameAsString() << "\n";
     FullDirectives->printStack(VDLHS);
-    llvm::errs() << "RHS: " << VDRHS->getNameAsString() << "\n";
+    logging::Out() << "RHS: " << VDRHS->getNameAsString() << "\n";
     FullDirectives->printStack(VDRHS);
 
   }
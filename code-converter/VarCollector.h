@@ -7,6 +7,7 @@
 #define _VARCOLLECTOR_H_
 
 #include "Classes.h"
+#include "TypePaths.h"
 
 #include "clang/Basic/FileManager.h"
 #include "clang/Lex/Preprocessor.h"
@@ -57,9 +58,18 @@ class VarCollector
   vector<MemberExpr *> MemberWarnings;
   vector<CompilerInstance *> CompilerInstanceStack;
 
+  // Calls already warned about having no definition, so that a body is
+  // warned about once however often it's traversed or summarized
+  set<CallExpr *> UndefinedCalls;
+  // Traverse the body behind every summary applied as well, and report an
+  // error where they disagree
+  bool VerifySummaries;
+
+  void TraverseCallee(FunctionCall * FC, bool Summarize);
+
  public:
 
-  VarCollector();
+  VarCollector(bool VerifySummaries);
 
   void HandleDirective(PragmaDirectiveMap *Directives,
                        DirectiveList *FullDirectives,
@@ -75,18 +85,18 @@ class VarCollector
   bool VisitDeclStmt(DeclStmt *s);
   bool VisitBinaryOperator(BinaryOperator *e);
   
-  void HandleArrayInit(VarDecl *VDLHS, string TLHS, SourceLocation StmtLoc);
+  void HandleArrayInit(VarDecl *VDLHS, TypePath TLHS, SourceLocation StmtLoc);
   void HandleArrayInitList(VarDecl *VDLHS,
-                           string TLHS,
+                           TypePath TLHS,
                            InitListExpr * Inits,
                            SourceLocation StmtLoc);
-  void HandlePointerInit(VarDecl *VDLHS, string TLHS, SourceLocation StmtLoc);
+  void HandlePointerInit(VarDecl *VDLHS, TypePath TLHS, SourceLocation StmtLoc);
   string GetStmtString(Stmt * Current);
 
   void maybeContaminated(VarDecl *VDLHS,
-                         string TLHS,
+                         TypePath TLHS,
                          VarDecl *VDRHS,
-                         string TRHS,
+                         TypePath TRHS,
                          const Type * T,
                          SourceLocation StmtLoc);
 
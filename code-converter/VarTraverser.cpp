@@ -36,6 +36,10 @@ VarTraverser::VarTraverser(Expr *Parent,
                               PM(new ParentMap(Parent)) {
 }
 
+VarTraverser::~VarTraverser() {
+  delete PM;
+}
+
 bool VarTraverser::VisitDeclRefExpr(DeclRefExpr *e) {
 
   TraverseExpr(e, e, e);
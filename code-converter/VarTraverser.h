@@ -41,6 +41,8 @@ class VarTraverser
                Expr *&OutExpr,
                CompilerInstance &CI,
                bool AddrOf = false);
+
+  ~VarTraverser();
   
   bool VisitDeclRefExpr(DeclRefExpr *e);
   bool VisitUnaryOperator(UnaryOperator *e);